@@ -9,6 +9,7 @@ Modified work Copyleft (c) 2013 Marcelo Aquino, https://github.com/mapnull
 */
 
 #include "arduino-serial-lib.h"
+#include "pool.h"
 
 #include <stdio.h>    // Standard input/output definitions 
 #include <unistd.h>   // UNIX standard function definitions 
@@ -16,7 +17,9 @@ Modified work Copyleft (c) 2013 Marcelo Aquino, https://github.com/mapnull
 #include <errno.h>    // Error number definitions 
 #include <termios.h>  // POSIX terminal control definitions 
 #include <string.h>   // String function definitions 
+#include <stdlib.h>
 #include <sys/ioctl.h>
+#include <sys/uio.h>
 #include <time.h>
 #include <sys/time.h>
 
@@ -62,6 +65,24 @@ int serialport_init(const char* serialport, int baud)
     case 38400:  brate=B38400;  break;
     case 57600:  brate=B57600;  break;
     case 115200: brate=B115200; break;
+#ifdef B230400
+    case 230400: brate=B230400; break;
+#endif
+#ifdef B460800
+    case 460800: brate=B460800; break;
+#endif
+#ifdef B500000
+    case 500000: brate=B500000; break;
+#endif
+#ifdef B576000
+    case 576000: brate=B576000; break;
+#endif
+#ifdef B921600
+    case 921600: brate=B921600; break;
+#endif
+#ifdef B1000000
+    case 1000000: brate=B1000000; break;
+#endif
     }
     cfsetispeed(&toptions, brate);
     cfsetospeed(&toptions, brate);
@@ -78,6 +99,8 @@ int serialport_init(const char* serialport, int baud)
 
     toptions.c_cflag |= CREAD | CLOCAL;  // turn on READ & ignore ctrl lines
     toptions.c_iflag &= ~(IXON | IXOFF | IXANY); // turn off s/w flow ctrl
+    // no input translation, binary frames carry \r and \n as data
+    toptions.c_iflag &= ~(ICRNL | INLCR | IGNCR | ISTRIP | BRKINT | PARMRK | IGNBRK);
 
     toptions.c_lflag &= ~(ICANON | ECHO | ECHOE | ISIG); // make raw
     toptions.c_oflag &= ~OPOST; // make raw
@@ -126,10 +149,16 @@ int serialport_write(int fd, const char* str)
 //
 int serialport_printlf(int fd, const char* str)
 {
-	const char eol = '\n';
+	char eol = '\n';
+	struct iovec iov[2];
     int len = strlen(str);
-    int n = write(fd, str, len);
-	n += write(fd, &eol, 1);
+    int n;
+
+	iov[0].iov_base = (char *)str;
+	iov[0].iov_len = len;
+	iov[1].iov_base = &eol;
+	iov[1].iov_len = 1;
+	n = writev(fd, iov, 2);
     if( n!=len+1 ) {
         perror("serialport_write: couldn't write whole string\n");
         return -1;
@@ -202,9 +231,265 @@ int serialport_send(int fd, const char* str)
 	return serialport_printlf(fd, str);
 }
 
+// allocates a ring that holds two frames of up to frame_max bytes.
+// returns 0 or -1 when out of memory
+int serialport_rx_alloc(struct serialport_rx *rx, int frame_max)
+{
+	rx->size = SERIALPORT_RX_SIZE;
+	while (rx->size < 2 * (unsigned int)frame_max)
+		rx->size <<= 1;
+	rx->buf = malloc(rx->size);
+	serialport_rx_init(rx);
+	return rx->buf ? 0 : -1;
+}
+
+//
+void serialport_rx_free(struct serialport_rx *rx)
+{
+	free(rx->buf);
+	rx->buf = NULL;
+}
+
+//
+void serialport_rx_init(struct serialport_rx *rx)
+{
+	rx->head = 0;
+	rx->tail = 0;
+	rx->scan = 0;
+	rx->discard = 0;
+}
+
+// reads everything the driver has buffered, up to the free space in the ring,
+// with a single syscall.
+// returns the number of bytes read, 0 if nothing was available or -1 on error
+int serialport_fill(int fd, struct serialport_rx *rx)
+{
+	struct iovec iov[2];
+	unsigned int used, start, space;
+	int iovcnt = 1;
+	ssize_t n;
+
+	used = rx->head - rx->tail;
+	if (used == rx->size)
+		return 0;
+
+	start = rx->head & (rx->size - 1);
+	space = rx->size - used;
+
+	iov[0].iov_base = &rx->buf[start];
+	if (start + space > rx->size) {
+		iov[0].iov_len = rx->size - start;
+		iov[1].iov_base = &rx->buf[0];
+		iov[1].iov_len = space - iov[0].iov_len;
+		iovcnt = 2;
+	} else {
+		iov[0].iov_len = space;
+	}
+
+	n = readv(fd, iov, iovcnt);
+	if (n == -1) {
+		if (errno == EAGAIN || errno == EINTR)
+			return 0;
+		return -1;
+	}
+#ifdef SERIALPORTDEBUG
+	printf("serialport_fill: n=%d\n", (int)n);
+#endif
+	rx->head += n;
+	return n;
+}
+
+// cuts the next complete frame, terminated by until, out of the ring.
+// the delimiter, and a trailing '\r' of '\n' terminated lines, are stripped
+// and frame is null terminated.
+// returns the frame length, SERIALPORT_NO_FRAME when no complete frame is
+// buffered or SERIALPORT_OVERFLOW when a frame didn't fit and was dropped
+int serialport_frame(struct serialport_rx *rx, char *frame, int frame_max, char until)
+{
+	unsigned int start, end, len, first;
+	char *found = NULL;
+
+	// Search only the bytes that arrived since the last call
+	start = rx->tail + rx->scan;
+	while (!found && start != rx->head) {
+		end = rx->head;
+		if ((start & ~(rx->size - 1)) != (end & ~(rx->size - 1)))
+			end = (start | (rx->size - 1)) + 1;		// Stop at the wrap
+		found = memchr(&rx->buf[start & (rx->size - 1)], until, end - start);
+		if (!found)
+			start = end;
+	}
+
+	if (!found) {
+		rx->scan = rx->head - rx->tail;
+		if (rx->scan == rx->size) {
+			// The ring is full and there is no delimiter, drop it all
+			rx->tail = rx->head;
+			rx->scan = 0;
+			if (!rx->discard) {
+				rx->discard = 1;
+				return SERIALPORT_OVERFLOW;
+			}
+		}
+		return SERIALPORT_NO_FRAME;
+	}
+
+	len = start + (found - &rx->buf[start & (rx->size - 1)]) - rx->tail;
+	if (rx->discard || len >= frame_max) {
+		rx->tail += len + 1;
+		rx->scan = 0;
+		if (rx->discard) {
+			// Tail of a frame already reported as dropped
+			rx->discard = 0;
+			return serialport_frame(rx, frame, frame_max, until);
+		}
+		return SERIALPORT_OVERFLOW;
+	}
+
+	start = rx->tail & (rx->size - 1);
+	first = rx->size - start;
+	if (first >= len) {
+		memcpy(frame, &rx->buf[start], len);
+	} else {
+		memcpy(frame, &rx->buf[start], first);
+		memcpy(frame + first, &rx->buf[0], len - first);
+	}
+	rx->tail += len + 1;
+	rx->scan = 0;
+
+	if (until == '\n' && len > 0 && frame[len - 1] == '\r')
+		len--;
+	frame[len] = 0;
+
+	return len;
+}
+
+static long serialport_elapsed(struct timespec *from, struct timespec *to)
+{
+	return ((to->tv_sec - from->tv_sec) * 1000) + ((to->tv_nsec - from->tv_nsec) / 1000000);		// msecs
+}
+
+//
+void serialport_txq_init(struct serialport_txq *txq, int pacing)
+{
+	memset(txq, 0, sizeof(struct serialport_txq));
+	txq->pacing = pacing;
+}
+
+//
+void serialport_txq_clear(struct serialport_txq *txq)
+{
+	struct serialport_msg *msg;
+
+	while ((msg = txq->head)) {
+		txq->head = msg->next;
+		pool_put(msg);
+	}
+	txq->tail = NULL;
+	txq->depth = 0;
+}
+
+// appends len bytes of data to the queue, eol is added when it is sent.
+// returns the queue depth or -1 when the queue is full or out of memory
+int serialport_queue(struct serialport_txq *txq, const char *data, int len, char eol)
+{
+	struct serialport_msg *msg;
+
+	if (txq->depth >= SERIALPORT_TXQ_MAX) {
+		txq->dropped++;
+		return -1;
+	}
+
+	msg = pool_get(sizeof(struct serialport_msg) + len);
+	if (!msg) {
+		txq->dropped++;
+		return -1;
+	}
+	memcpy(msg->data, data, len);
+	msg->len = len;
+	msg->eol = eol;
+	msg->sent = 0;
+	msg->next = NULL;
+	clock_gettime(CLOCK_MONOTONIC, &msg->queued);
+
+	if (txq->tail)
+		txq->tail->next = msg;
+	else
+		txq->head = msg;
+	txq->tail = msg;
+
+	txq->depth++;
+	if (txq->depth > txq->max_depth)
+		txq->max_depth = txq->depth;
+	return txq->depth;
+}
+
+// writes queued lines, line and end of line in a single writev, while the
+// pacing gap allows it. never sleeps.
+// returns 0 when the queue is empty, the msecs to wait before the next line,
+// SERIALPORT_TX_BLOCKED when the port is full or -1 on error
+int serialport_drain(int fd, struct serialport_txq *txq)
+{
+	struct serialport_msg *msg;
+	struct timespec now;
+	struct iovec iov[2];
+	long wait;
+	int iovcnt;
+	ssize_t n;
+
+	while ((msg = txq->head)) {
+		clock_gettime(CLOCK_MONOTONIC, &now);
+
+		if (msg->sent == 0 && txq->sent) {
+			wait = txq->pacing - serialport_elapsed(&txq->last, &now);
+			if (wait > 0)
+				return wait;
+		}
+
+		iovcnt = 0;
+		if (msg->sent < msg->len) {
+			iov[iovcnt].iov_base = msg->data + msg->sent;
+			iov[iovcnt++].iov_len = msg->len - msg->sent;
+		}
+		iov[iovcnt].iov_base = &msg->eol;
+		iov[iovcnt++].iov_len = 1;
+
+		n = writev(fd, iov, iovcnt);
+		if (n == -1) {
+			if (errno == EAGAIN || errno == EINTR)
+				return SERIALPORT_TX_BLOCKED;
+			perror("serialport_drain: write failed");
+			return -1;
+		}
+		msg->sent += n;
+		if (msg->sent <= msg->len)
+			return SERIALPORT_TX_BLOCKED;		// Partial write
+
+		wait = serialport_elapsed(&msg->queued, &now);
+		txq->wait_total += wait;
+		if (wait > txq->wait_max)
+			txq->wait_max = wait;
+
+		txq->head = msg->next;
+		if (!txq->head)
+			txq->tail = NULL;
+		txq->depth--;
+		txq->sent++;
+		txq->last = now;
+		pool_put(msg);
+	}
+	return 0;
+}
+
 //
 int serialport_flush(int fd)
 {
     sleep(2); //required to make flush work, for some reason
+    return serialport_discard(fd);
+}
+
+// flush without the settle delay, for callers that already waited
+int serialport_discard(int fd)
+{
     return tcflush(fd, TCIOFLUSH);
 }
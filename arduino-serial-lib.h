@@ -12,6 +12,46 @@ Modified work Copyleft (c) 2013 Marcelo Aquino, https://github.com/mapnull
 #define __ARDUINO_SERIAL_LIB_H__
 
 #include <stdint.h>   // Standard types
+#include <time.h>
+
+#define SERIALPORT_RX_SIZE 256		// Smallest receive ring, a power of two
+
+#define SERIALPORT_NO_FRAME -1		// No complete frame buffered yet
+#define SERIALPORT_OVERFLOW -2		// Frame larger than the buffer, dropped
+
+#define SERIALPORT_TX_BLOCKED -3	// The port can't take more bytes, wait for POLLOUT
+#define SERIALPORT_TXQ_MAX 64		// Messages queued per port before new ones are refused
+
+struct serialport_msg {
+	struct serialport_msg *next;
+	struct timespec queued;
+	int len;						// Data length, without the end of line
+	int sent;						// Bytes already written, including the end of line
+	char eol;
+	char data[];
+};
+
+struct serialport_txq {
+	struct serialport_msg *head;
+	struct serialport_msg *tail;
+	int pacing;						// Minimum gap between messages, msecs
+	struct timespec last;			// When the last message went out
+	int depth;
+	int max_depth;
+	unsigned long sent;
+	unsigned long dropped;
+	unsigned long long wait_total;	// Time spent queued, msecs
+	unsigned long wait_max;
+};
+
+struct serialport_rx {
+	char *buf;
+	unsigned int size;				// Power of two, twice the largest frame or more
+	unsigned int head;				// Write position, free running
+	unsigned int tail;				// Read position, free running
+	unsigned int scan;				// Bytes after tail already searched for the delimiter
+	int discard;					// Dropping an oversized frame up to the next delimiter
+};
 
 int serialport_init(const char* serialport, int baud);
 int serialport_close(int fd);
@@ -21,6 +61,16 @@ int serialport_printlf(int fd, const char* str);
 int serialport_printbytelf(int fd, uint8_t b);
 int serialport_read_until(int fd, char* buf, char until, int buf_max,int timeout);
 int serialport_send(int fd, const char* str);
+int serialport_rx_alloc(struct serialport_rx *rx, int frame_max);
+void serialport_rx_free(struct serialport_rx *rx);
+void serialport_rx_init(struct serialport_rx *rx);
+int serialport_fill(int fd, struct serialport_rx *rx);
+int serialport_frame(struct serialport_rx *rx, char *frame, int frame_max, char until);
+void serialport_txq_init(struct serialport_txq *txq, int pacing);
+void serialport_txq_clear(struct serialport_txq *txq);
+int serialport_queue(struct serialport_txq *txq, const char *data, int len, char eol);
+int serialport_drain(int fd, struct serialport_txq *txq);
 int serialport_flush(int fd);
+int serialport_discard(int fd);
 
 #endif
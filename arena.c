@@ -0,0 +1,124 @@
+/*
+* The MIT License (MIT)
+*
+* Copyright (c) 2013, Marcelo Aquino, https://github.com/mapnull
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+* THE SOFTWARE.
+*/
+
+#include "arena.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+
+struct arena_chunk {
+	struct arena_chunk *next;
+	size_t size;
+	max_align_t data[];
+};
+
+#define ARENA_ROUND(n) (((n) + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1))
+
+static bool arena_within(const void *p, const void *start, size_t size)
+{
+	return (uintptr_t)p >= (uintptr_t)start && (uintptr_t)p < (uintptr_t)start + size;
+}
+
+// The block is allocated on first use
+void arena_init(struct arena_t *arena, size_t size)
+{
+	arena->buf = NULL;
+	arena->size = ARENA_ROUND(size);
+	arena->used = 0;
+	arena->spill = NULL;
+	arena->spilled = 0;
+	arena->heap_calls = 0;
+}
+
+void *arena_alloc(struct arena_t *arena, size_t size)
+{
+	struct arena_chunk *chunk;
+	void *p;
+
+	size = ARENA_ROUND(size ? size : 1);
+
+	if (!arena->buf) {
+		arena->heap_calls++;
+		arena->buf = malloc(arena->size);
+		if (!arena->buf)
+			return NULL;
+	}
+
+	if (arena->size - arena->used >= size) {
+		p = arena->buf + arena->used;
+		arena->used += size;
+		return p;
+	}
+
+	arena->heap_calls++;
+	chunk = malloc(sizeof(struct arena_chunk) + size);
+	if (!chunk)
+		return NULL;
+	chunk->next = arena->spill;
+	chunk->size = size;
+	arena->spill = chunk;
+	arena->spilled += size;
+	return chunk->data;
+}
+
+bool arena_owns(const struct arena_t *arena, const void *p)
+{
+	const struct arena_chunk *chunk;
+
+	if (arena->buf && arena_within(p, arena->buf, arena->size))
+		return true;
+	for (chunk = arena->spill; chunk; chunk = chunk->next) {
+		if (arena_within(p, chunk->data, chunk->size))
+			return true;
+	}
+	return false;
+}
+
+// Everything allocated so far is gone
+void arena_reset(struct arena_t *arena)
+{
+	struct arena_chunk *chunk;
+
+	while ((chunk = arena->spill)) {
+		arena->spill = chunk->next;
+		free(chunk);
+		arena->heap_calls++;
+	}
+	if (arena->spilled) {
+		// Room for the whole round next time
+		arena->size = ARENA_ROUND(arena->used + arena->spilled);
+		free(arena->buf);
+		arena->buf = NULL;
+		arena->heap_calls++;
+		arena->spilled = 0;
+	}
+	arena->used = 0;
+}
+
+void arena_cleanup(struct arena_t *arena)
+{
+	arena_reset(arena);
+	free(arena->buf);
+	arena->buf = NULL;
+}
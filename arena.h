@@ -0,0 +1,57 @@
+/*
+* The MIT License (MIT)
+*
+* Copyright (c) 2013, Marcelo Aquino, https://github.com/mapnull
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+* THE SOFTWARE.
+*/
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+* Bump pointer arena. Allocations are never freed one by one, the whole
+* arena goes back at once with arena_reset(). What doesn't fit spills to
+* chunks of its own, and the next reset grows the block to hold all of it,
+* so once the largest round has been seen there are no more heap calls.
+*/
+
+#define ARENA_ALIGN 16
+
+struct arena_chunk;
+
+struct arena_t {
+	char *buf;
+	size_t size;
+	size_t used;
+	struct arena_chunk *spill;				// Allocations that didn't fit
+	size_t spilled;
+	unsigned long heap_calls;				// malloc and free calls, ever
+};
+
+void arena_init(struct arena_t *, size_t);
+void *arena_alloc(struct arena_t *, size_t);
+bool arena_owns(const struct arena_t *, const void *);
+void arena_reset(struct arena_t *);
+void arena_cleanup(struct arena_t *);
+
+#endif
@@ -0,0 +1,93 @@
+/*
+* The MIT License (MIT)
+*
+* Copyright (c) 2013, Marcelo Aquino, https://github.com/mapnull
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+* THE SOFTWARE.
+*/
+
+#include "batch.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// size is the longest payload a batch may grow to
+struct batch_t *batch_new(int size)
+{
+	struct batch_t *batch;
+
+	batch = calloc(1, sizeof(struct batch_t));
+	if (batch)
+		batch->buf = malloc(size);
+	if (!batch || !batch->buf) {
+		fprintf(stderr, "Error: No memory left.\n");
+		exit(1);
+	}
+	batch->size = size;
+	return batch;
+}
+
+void batch_free(struct batch_t *batch)
+{
+	if (!batch)
+		return;
+	free(batch->buf);
+	free(batch);
+}
+
+// Appends a frame, topic only for bridge wide batches
+// returns 0 on success, -1 when it doesn't fit, the batch is left untouched
+int batch_add(struct batch_t *batch, const char *topic, const char *payload, long long ts, int qos)
+{
+	int len, room;
+
+	room = batch->size - batch->len - 1;		// Keep a byte for the closing ']'
+	if (topic)
+		len = snprintf(batch->buf + batch->len, room, "%c{\"ts\":%lld,\"t\":\"%s\",\"d\":%s}",
+			batch->count ? ',' : '[', ts, topic, payload);
+	else
+		len = snprintf(batch->buf + batch->len, room, "%c{\"ts\":%lld,\"d\":%s}",
+			batch->count ? ',' : '[', ts, payload);
+	if (len < 0 || len >= room) {
+		batch->buf[batch->len] = 0;
+		return -1;
+	}
+
+	batch->len += len;
+	batch->count++;
+	if (qos > batch->qos)
+		batch->qos = qos;
+	return 0;
+}
+
+// Closes the array, the payload stays valid until batch_reset()
+char *batch_finish(struct batch_t *batch)
+{
+	batch->buf[batch->len++] = ']';
+	batch->buf[batch->len] = 0;
+	return batch->buf;
+}
+
+void batch_reset(struct batch_t *batch)
+{
+	batch->len = 0;
+	batch->count = 0;
+	batch->qos = 0;
+}
@@ -0,0 +1,61 @@
+/*
+* The MIT License (MIT)
+*
+* Copyright (c) 2013, Marcelo Aquino, https://github.com/mapnull
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+* THE SOFTWARE.
+*/
+
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <stdbool.h>
+
+/*
+* Publish aggregation: device frames collected over a window and sent as
+* one JSON array, [{"ts":<epoch ms>,"d":<frame>},...], with "t":<topic>
+* on every item when the batch is shared by the whole bridge.
+*/
+
+#define BATCH_OFF 0
+#define BATCH_DEVICE 1						// One batch per device, on <topic>/batch
+#define BATCH_BRIDGE 2						// One batch for all, on b/<bridge uuid>/batch
+
+#define BATCH_TOPIC_LEN 64
+#define BATCH_SIZE_MIN 64
+
+struct batch_t {
+	char topic[BATCH_TOPIC_LEN];
+	char *buf;
+	int len;
+	int size;
+	int count;
+	int qos;								// Highest qos of the items
+	bool pending;							// Linked in the flush list
+	struct batch_t *next;
+	struct batch_t *prev;
+};
+
+struct batch_t *batch_new(int);
+void batch_free(struct batch_t *);
+int batch_add(struct batch_t *, const char *, const char *, long long, int);
+char *batch_finish(struct batch_t *);
+void batch_reset(struct batch_t *);
+
+#endif
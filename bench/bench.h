@@ -0,0 +1,100 @@
+/*
+* The MIT License (MIT)
+*
+* Copyright (c) 2013, Marcelo Aquino, https://github.com/mapnull
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+* THE SOFTWARE.
+*/
+
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/*
+* Helpers for the microbenchmarks in this folder. They are built with
+* "./compile.sh bench" and run from the top of the tree.
+*/
+
+#define BENCH_CORPUS "bench/payloads.txt"
+#define BENCH_LINES_MAX 64
+#define BENCH_LINE_LEN 512
+
+// Monotonic clock, secs
+static inline double bench_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// CPU time of the calling thread, secs
+static inline double bench_cpu(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static inline int bench_arg(int argc, char *argv[], int i, int def)
+{
+	return argc > i ? atoi(argv[i]) : def;
+}
+
+// Reads the payload corpus, one JSON message per line, returns the count
+static inline int bench_corpus(const char *path, char lines[][BENCH_LINE_LEN])
+{
+	FILE *fp;
+	int n = 0, len;
+
+	fp = fopen(path, "r");
+	if (!fp) {
+		fprintf(stderr, "Error: Can't open %s, run from the top of the tree.\n", path);
+		exit(1);
+	}
+	while (n < BENCH_LINES_MAX && fgets(lines[n], BENCH_LINE_LEN, fp)) {
+		len = strcspn(lines[n], "\r\n");
+		lines[n][len] = 0;
+		if (len)
+			n++;
+	}
+	fclose(fp);
+	return n;
+}
+
+// Bytes of an MQTT remaining length field
+static inline int bench_varint_size(int n)
+{
+	return n < 128 ? 1 : n < 16384 ? 2 : n < 2097152 ? 3 : 4;
+}
+
+// Bytes of an MQTT 3.1.1 PUBLISH on the wire, fixed header included
+static inline int bench_publish_size(int topic_len, int payload_len, int qos)
+{
+	int rest = 2 + topic_len + (qos ? 2 : 0) + payload_len;
+
+	return 1 + bench_varint_size(rest) + rest;
+}
+
+#endif
@@ -0,0 +1,139 @@
+/*
+* The MIT License (MIT)
+*
+* Copyright (c) 2013, Marcelo Aquino, https://github.com/mapnull
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+* THE SOFTWARE.
+*/
+
+/*
+* Broker messages and bytes on the wire with and without aggregation.
+* Simulates devices reporting every period msecs for a minute through
+* batch.c, flushing on the window and on aggregate_size the way the
+* bridge does. Bytes are MQTT PUBLISH packets; "+tcp" adds 52 bytes of
+* IP and TCP headers per packet, one segment each.
+*
+* ./bench/bench_batch [devices] [period msecs] [aggregate_size]
+*/
+
+#include "bench.h"
+#include "../batch.h"
+
+#define BENCH_SECS 60
+#define BENCH_TCP_IP 52
+#define BENCH_DEVICES_MAX 1000
+#define BENCH_BRIDGE_TOPIC "b/5a000000-7d1c-11ee-b962-0242ac120002/batch"
+
+struct result {
+	long messages;
+	long bytes;
+	long frames;
+};
+
+static void publish(struct result *res, const char *topic, const char *payload)
+{
+	res->messages++;
+	res->bytes += bench_publish_size(strlen(topic), strlen(payload), 0);
+}
+
+static void flush(struct result *res, struct batch_t *batch)
+{
+	if (!batch->count)
+		return;
+	publish(res, batch->topic, batch_finish(batch));
+	batch_reset(batch);
+}
+
+static void add(struct result *res, struct batch_t *batch, const char *topic, const char *device_topic,
+	const char *payload, long long ts)
+{
+	if (!batch_add(batch, topic, payload, ts, 0))
+		return;
+	flush(res, batch);
+	if (batch_add(batch, topic, payload, ts, 0))
+		publish(res, device_topic, payload);		// Bigger than a batch
+}
+
+static void run(const char *name, int mode, int window, int devices, int period, int size)
+{
+	struct batch_t *batch[BENCH_DEVICES_MAX];
+	char topic[BENCH_DEVICES_MAX][16], payload[128];
+	struct result res;
+	long long t;
+	int d;
+
+	memset(&res, 0, sizeof(res));
+	for (d = 0; d < devices; d++) {
+		snprintf(topic[d], sizeof(topic[d]), "%d", 1000 + d);
+		batch[d] = NULL;
+		if (mode == BATCH_DEVICE || (mode == BATCH_BRIDGE && d == 0))
+			batch[d] = batch_new(size);
+		if (mode == BATCH_DEVICE)
+			snprintf(batch[d]->topic, BATCH_TOPIC_LEN, "%s/batch", topic[d]);
+	}
+	if (mode == BATCH_BRIDGE)
+		snprintf(batch[0]->topic, BATCH_TOPIC_LEN, "%s", BENCH_BRIDGE_TOPIC);
+
+	for (t = 0; t < BENCH_SECS * 1000; t++) {
+		if (mode != BATCH_OFF && t % window == 0)
+			for (d = 0; d < (mode == BATCH_DEVICE ? devices : 1); d++)
+				flush(&res, batch[d]);
+		for (d = 0; d < devices; d++) {
+			// Spread over the period, like boards started at random
+			if ((t + d * period / devices) % period)
+				continue;
+			snprintf(payload, sizeof(payload), "{\"t\":%.1f,\"h\":%d,\"bat\":%.2f,\"rssi\":%d}",
+				20 + (t / 1000 + d) % 50 / 10.0, 40 + (int)(t / 700 + d) % 30, 3.6 + d % 10 / 100.0, -60 - d % 30);
+			res.frames++;
+			if (mode == BATCH_OFF)
+				publish(&res, topic[d], payload);
+			else if (mode == BATCH_DEVICE)
+				add(&res, batch[d], NULL, topic[d], payload, 1700000000000LL + t);
+			else
+				add(&res, batch[0], topic[d], topic[d], payload, 1700000000000LL + t);
+		}
+	}
+	for (d = 0; d < devices; d++)
+		if (batch[d]) {
+			flush(&res, batch[d]);
+			batch_free(batch[d]);
+		}
+
+	printf("%-14s %10.1f %12.0f %12.0f %10.1f\n", name, (double)res.messages / BENCH_SECS,
+		(double)res.bytes / BENCH_SECS, (double)(res.bytes + res.messages * BENCH_TCP_IP) / BENCH_SECS,
+		(double)res.frames / res.messages);
+}
+
+int main(int argc, char *argv[])
+{
+	int devices = bench_arg(argc, argv, 1, 50);
+	int period = bench_arg(argc, argv, 2, 200);
+	int size = bench_arg(argc, argv, 3, 1024);
+
+	if (devices > BENCH_DEVICES_MAX)
+		devices = BENCH_DEVICES_MAX;
+	printf("%d devices every %d msecs, aggregate_size %d\n", devices, period, size);
+	printf("%-14s %10s %12s %12s %10s\n", "aggregate", "msgs/s", "bytes/s", "+tcp bytes/s", "frames/msg");
+	run("off", BATCH_OFF, 0, devices, period, size);
+	run("device 100", BATCH_DEVICE, 100, devices, period, size);
+	run("device 1000", BATCH_DEVICE, 1000, devices, period, size);
+	run("bridge 100", BATCH_BRIDGE, 100, devices, period, size);
+	run("bridge 1000", BATCH_BRIDGE, 1000, devices, period, size);
+	return 0;
+}
@@ -0,0 +1,150 @@
+/*
+* The MIT License (MIT)
+*
+* Copyright (c) 2013, Marcelo Aquino, https://github.com/mapnull
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+* THE SOFTWARE.
+*/
+
+/*
+* Device lookup cost at 10, 1k and 100k devices: the hash tables in
+* bridge.c against the linked list walk they replaced. Uuids are time
+* based, so they differ only in their first eight digits like real ones.
+*
+* ./bench/bench_devices [lookups]
+*/
+
+#include "bench.h"
+#include "../bridge.h"
+
+// The list the bridge used to walk, one malloc per device
+struct list_device {
+	char *uuid;
+	int id;
+	struct list_device *next;
+};
+
+static volatile uintptr_t sink;
+
+static uint32_t rnd(uint32_t *state)
+{
+	*state ^= *state << 13;
+	*state ^= *state >> 17;
+	*state ^= *state << 5;
+	return *state;
+}
+
+static void make_uuid(char *uuid, int n)
+{
+	sprintf(uuid, "%08x-7d1c-11ee-b962-0242ac120002", 0x5a000000u + n * 7919u);
+}
+
+static struct list_device *list_get(struct list_device *list, char *uuid)
+{
+	for (; list; list = list->next)
+		if (!strcmp(list->uuid, uuid))
+			return list;
+	return NULL;
+}
+
+static struct list_device *list_get_by_id(struct list_device *list, int id)
+{
+	for (; list; list = list->next)
+		if (list->id == id)
+			return list;
+	return NULL;
+}
+
+static void run(int count, int lookups)
+{
+	struct bridge_serial serial;
+	struct bridge_t bridge;
+	struct device_t *device;
+	struct list_device *list = NULL, *node;
+	char (*uuids)[DEVICE_UUID_LEN + 1];
+	double start, t_hash, t_list, t_hash_id, t_list_id;
+	uint32_t state = 2463534242u;
+	int i, list_lookups;
+
+	memset(&serial, 0, sizeof(serial));
+	serial.max_frame = 256;
+	bridge_init(&bridge, "bench", &serial, 1);
+	uuids = malloc(sizeof(*uuids) * count);
+	if (!uuids) {
+		fprintf(stderr, "Error: Out of memory\n");
+		exit(1);
+	}
+	for (i = 0; i < count; i++) {
+		make_uuid(uuids[i], i);
+		device = bridge_add_device(&bridge, &bridge.ports[0], uuids[i]);
+		bridge_set_device_id(&bridge, device, i + 1);
+		node = malloc(sizeof(*node));
+		if (!node) {
+			fprintf(stderr, "Error: Out of memory\n");
+			exit(1);
+		}
+		node->uuid = strdup(uuids[i]);
+		node->id = i + 1;
+		node->next = list;
+		list = node;
+	}
+
+	// The walk is O(n), keep it to a few seconds at 100k
+	list_lookups = lookups;
+	if ((double)list_lookups * count > 2e9)
+		list_lookups = 2e9 / count;
+
+	start = bench_now();
+	for (i = 0; i < lookups; i++)
+		sink += (uintptr_t)bridge_get_device(&bridge, uuids[rnd(&state) % count]);
+	t_hash = (bench_now() - start) / lookups;
+	start = bench_now();
+	for (i = 0; i < list_lookups; i++)
+		sink += (uintptr_t)list_get(list, uuids[rnd(&state) % count]);
+	t_list = (bench_now() - start) / list_lookups;
+	start = bench_now();
+	for (i = 0; i < lookups; i++)
+		sink += (uintptr_t)bridge_get_device_by_id(&bridge, &bridge.ports[0], rnd(&state) % count + 1);
+	t_hash_id = (bench_now() - start) / lookups;
+	start = bench_now();
+	for (i = 0; i < list_lookups; i++)
+		sink += (uintptr_t)list_get_by_id(list, rnd(&state) % count + 1);
+	t_list_id = (bench_now() - start) / list_lookups;
+
+	printf("%8d %12.1f %12.1f %12.1f %12.1f\n", count, t_hash * 1e9, t_list * 1e9, t_hash_id * 1e9, t_list_id * 1e9);
+	while (list) {
+		node = list->next;
+		free(list->uuid);
+		free(list);
+		list = node;
+	}
+	free(uuids);
+}
+
+int main(int argc, char *argv[])
+{
+	int lookups = bench_arg(argc, argv, 1, 1000000);
+
+	printf("%d lookups, nsecs per lookup\n", lookups);
+	printf("%8s %12s %12s %12s %12s\n", "devices", "uuid hash", "uuid list", "id hash", "id list");
+	run(10, lookups);
+	run(1000, lookups);
+	run(100000, lookups);
+	return 0;
+}
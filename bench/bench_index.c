@@ -0,0 +1,123 @@
+/*
+* The MIT License (MIT)
+*
+* Copyright (c) 2013, Marcelo Aquino, https://github.com/mapnull
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+* THE SOFTWARE.
+*/
+
+/*
+* Member lookups on wide objects, 10 to 200 keys as the richer sensor
+* boards send, with and without the index cJSON_IndexObjects() builds at
+* parse time. Also the parse cost of building it.
+*
+* ./bench/bench_index [lookups]
+*/
+
+#include "bench.h"
+#include "../cJSON.h"
+
+#define BENCH_INDEX_MIN 16					// Objects indexed from this many keys
+#define BENCH_KEYS_MAX 200
+#define BENCH_PARSES 20000
+
+static volatile int sink;
+
+// {"s000_temp":20.1,...}, keys share a prefix the way sensor names do
+static char *wide_object(int keys)
+{
+	char *buf, *p;
+	int i;
+
+	buf = malloc(keys * 32 + 2);
+	if (!buf) {
+		fprintf(stderr, "Error: Out of memory\n");
+		exit(1);
+	}
+	p = buf;
+	*p++ = '{';
+	for (i = 0; i < keys; i++)
+		p += sprintf(p, "%s\"s%03d_value\":%d.%d", i ? "," : "", i, 20 + i % 10, i % 7);
+	strcpy(p, "}");
+	return buf;
+}
+
+static double lookups(cJSON *json, int keys, int count, cJSON *(*get)(cJSON *, const char *))
+{
+	char names[BENCH_KEYS_MAX + 1][16];
+	double start;
+	int i;
+
+	for (i = 0; i <= keys; i++)
+		sprintf(names[i], "s%03d_value", i);		// The last one is missing
+	start = bench_now();
+	for (i = 0; i < count; i++)
+		sink += get(json, names[(i * 7) % (keys + 1)]) != NULL;
+	return (bench_now() - start) / count;
+}
+
+static double parses(const char *text)
+{
+	double start;
+	int i;
+
+	start = bench_now();
+	for (i = 0; i < BENCH_PARSES; i++)
+		cJSON_Delete(cJSON_Parse(text));
+	return (bench_now() - start) / BENCH_PARSES;
+}
+
+static void run(int keys, int count)
+{
+	char *text = wide_object(keys);
+	cJSON *json;
+	double t_get, t_cs, t_parse, t_get_idx, t_cs_idx, t_parse_idx;
+
+	cJSON_IndexObjects(0);
+	json = cJSON_Parse(text);
+	t_get = lookups(json, keys, count, cJSON_GetObjectItem);
+	t_cs = lookups(json, keys, count, cJSON_GetObjectItemCS);
+	cJSON_Delete(json);
+	t_parse = parses(text);
+
+	cJSON_IndexObjects(BENCH_INDEX_MIN);
+	json = cJSON_Parse(text);
+	t_get_idx = lookups(json, keys, count, cJSON_GetObjectItem);
+	t_cs_idx = lookups(json, keys, count, cJSON_GetObjectItemCS);
+	cJSON_Delete(json);
+	t_parse_idx = parses(text);
+	cJSON_IndexObjects(0);
+
+	printf("%5d %10.1f %10.1f %10.1f %10.1f %10.2f %10.2f\n", keys, t_get * 1e9, t_cs * 1e9,
+		t_get_idx * 1e9, t_cs_idx * 1e9, t_parse * 1e6, t_parse_idx * 1e6);
+	free(text);
+}
+
+int main(int argc, char *argv[])
+{
+	int count = bench_arg(argc, argv, 1, 1000000);
+
+	printf("%d lookups, index from %d keys, nsecs per lookup, usecs per parse\n", count, BENCH_INDEX_MIN);
+	printf("%5s %10s %10s %10s %10s %10s %10s\n", "keys", "get", "get cs", "get idx", "cs idx", "parse", "parse idx");
+	run(10, count);
+	run(50, count);
+	run(100, count);
+	run(200, count);
+	return 0;
+}
@@ -0,0 +1,121 @@
+/*
+* The MIT License (MIT)
+*
+* Copyright (c) 2013, Marcelo Aquino, https://github.com/mapnull
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+* THE SOFTWARE.
+*/
+
+/*
+* jscan against cJSON on the payload corpus: validating a serial frame
+* before it is published, and reading the members of an inbound command,
+* which the bridge used to do with cJSON_Parse() and cJSON_Delete().
+*
+* ./bench/bench_jscan [passes] [corpus]
+*/
+
+#include "bench.h"
+#include "../cJSON.h"
+#include "../jscan.h"
+
+#define BENCH_KEYS 7
+
+// The members on_mqtt_message() reads
+static const char *keys[BENCH_KEYS] = { "tid", "comma", "set", "get", "run", "id", "uuid" };
+
+static volatile int sink;
+
+// The old inbound path: a tree to read tid and the command from
+static int cjson_keys(const char *payload)
+{
+	cJSON *json, *item;
+	int tid = -1;
+
+	json = cJSON_Parse(payload);
+	if (!json)
+		return -1;
+	item = cJSON_GetObjectItem(json, "tid");
+	if (item && item->type == cJSON_Number)
+		tid = item->valueint;
+	item = cJSON_GetObjectItem(json, "comma");
+	if (!item)
+		item = cJSON_GetObjectItem(json, "set");
+	if (!item)
+		item = cJSON_GetObjectItem(json, "run");
+	tid += item != NULL;
+	cJSON_Delete(json);
+	return tid;
+}
+
+static int jscan_read(const char *payload, int len)
+{
+	struct jscan_val vals[BENCH_KEYS];
+	int tid = -1;
+
+	if (!jscan_keys(payload, len, keys, vals, BENCH_KEYS))
+		return -1;
+	jscan_int(&vals[0], &tid);
+	return tid + (vals[1].type || vals[2].type || vals[4].type);
+}
+
+int main(int argc, char *argv[])
+{
+	int passes = bench_arg(argc, argv, 1, 50000);
+	const char *path = argc > 2 ? argv[2] : BENCH_CORPUS;
+	static char lines[BENCH_LINES_MAX][BENCH_LINE_LEN];
+	int lens[BENCH_LINES_MAX];
+	double start, t[4], total[4] = { 0 };
+	int count, i, p, k;
+	cJSON *json;
+
+	count = bench_corpus(path, lines);
+	for (i = 0; i < count; i++)
+		lens[i] = strlen(lines[i]);
+
+	printf("%d passes, nsecs per message\n", passes);
+	printf("%5s %10s %10s %10s %10s\n", "bytes", "validate", "cJSON", "keys", "cJSON keys");
+	for (i = 0; i < count; i++) {
+		start = bench_now();
+		for (p = 0; p < passes; p++)
+			sink += jscan_validate(lines[i], lens[i]);
+		t[0] = (bench_now() - start) / passes;
+		start = bench_now();
+		for (p = 0; p < passes; p++) {
+			json = cJSON_Parse(lines[i]);
+			sink += json != NULL;
+			cJSON_Delete(json);
+		}
+		t[1] = (bench_now() - start) / passes;
+		start = bench_now();
+		for (p = 0; p < passes; p++)
+			sink += jscan_read(lines[i], lens[i]);
+		t[2] = (bench_now() - start) / passes;
+		start = bench_now();
+		for (p = 0; p < passes; p++)
+			sink += cjson_keys(lines[i]);
+		t[3] = (bench_now() - start) / passes;
+
+		printf("%5d %10.0f %10.0f %10.0f %10.0f\n", lens[i], t[0] * 1e9, t[1] * 1e9, t[2] * 1e9, t[3] * 1e9);
+		for (k = 0; k < 4; k++)
+			total[k] += t[k];
+	}
+	printf("%5s %10.0f %10.0f %10.0f %10.0f\n", "mean", total[0] * 1e9 / count, total[1] * 1e9 / count,
+		total[2] * 1e9 / count, total[3] * 1e9 / count);
+	return 0;
+}
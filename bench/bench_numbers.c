@@ -0,0 +1,237 @@
+/*
+* The MIT License (MIT)
+*
+* Copyright (c) 2013, Marcelo Aquino, https://github.com/mapnull
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+* THE SOFTWARE.
+*/
+
+/*
+* Number parsing and printing in cJSON against the pow() and sprintf()
+* code it replaced, on arrays of the kinds of numbers sensors send. Also
+* counts the values each reads or prints inexactly, and the throughput of
+* whole numeric arrays. Includes cJSON.c to reach its static functions.
+*
+* ./bench/bench_numbers [numbers per kind]
+*/
+
+#include <stdint.h>
+
+#include "bench.h"
+#include "../cJSON.c"
+
+#define BENCH_KINDS 5
+
+static volatile double sink;
+
+static const char *kind_name[BENCH_KINDS] = { "integer", "2 decimals", "gps", "exponent", "17 digits" };
+
+/* The parser cJSON used to have. */
+static const char *old_parse_number(cJSON *item,const char *num)
+{
+	double n=0,sign=1,scale=0;int subscale=0,signsubscale=1;
+
+	if (*num=='-') sign=-1,num++;	/* Has sign? */
+	if (*num=='0') num++;			/* is zero */
+	if (*num>='1' && *num<='9')	do	n=(n*10.0)+(*num++ -'0');	while (*num>='0' && *num<='9');	/* Number? */
+	if (*num=='.' && num[1]>='0' && num[1]<='9') {num++;		do	n=(n*10.0)+(*num++ -'0'),scale--; while (*num>='0' && *num<='9');}	/* Fractional part? */
+	if (*num=='e' || *num=='E')		/* Exponent? */
+	{	num++;if (*num=='+') num++;	else if (*num=='-') signsubscale=-1,num++;		/* With sign? */
+		while (*num>='0' && *num<='9') subscale=(subscale*10)+(*num++ - '0');	/* Number? */
+	}
+
+	n=sign*n*pow(10.0,(scale+subscale*signsubscale));	/* number = +/- number.fraction * 10^+/- exponent */
+
+	item->valuedouble=n;
+	item->valueint=(int)n;
+	item->type=cJSON_Number;
+	return num;
+}
+
+/* The printer cJSON used to have. */
+static char *old_print_number(cJSON *item)
+{
+	char *str;
+	double d=item->valuedouble;
+	if (fabs(((double)item->valueint)-d)<=DBL_EPSILON && d<=INT_MAX && d>=INT_MIN)
+	{
+		str=(char*)cJSON_malloc(21);	/* 2^64+1 can be represented in 21 chars. */
+		if (str) sprintf(str,"%d",item->valueint);
+	}
+	else
+	{
+		str=(char*)cJSON_malloc(64);	/* This is a nice tradeoff. */
+		if (str)
+		{
+			if (fabs(floor(d)-d)<=DBL_EPSILON && fabs(d)<1.0e60)sprintf(str,"%.0f",d);
+			else if (fabs(d)<1.0e-6 || fabs(d)>1.0e9)			sprintf(str,"%e",d);
+			else												sprintf(str,"%f",d);
+		}
+	}
+	return str;
+}
+
+static uint32_t rnd(uint32_t *state)
+{
+	*state ^= *state << 13;
+	*state ^= *state >> 17;
+	*state ^= *state << 5;
+	return *state;
+}
+
+// A JSON array of count numbers of one kind
+static char *numbers(int kind, int count)
+{
+	uint32_t state = 2463534242u;
+	char *buf, *p;
+	double d;
+	int i;
+
+	buf = malloc(count * 32 + 2);
+	if (!buf) {
+		fprintf(stderr, "Error: Out of memory\n");
+		exit(1);
+	}
+	p = buf;
+	*p++ = '[';
+	for (i = 0; i < count; i++) {
+		if (i)
+			*p++ = ',';
+		switch (kind) {
+		case 0:
+			p += sprintf(p, "%d", (int)(rnd(&state) % 200000) - 100000);
+			break;
+		case 1:
+			p += sprintf(p, "%.2f", (int)(rnd(&state) % 10000 - 2000) / 100.0);
+			break;
+		case 2:
+			p += sprintf(p, "%.6f", (int)(rnd(&state) % 180000000 - 90000000) / 1e6);
+			break;
+		case 3:
+			p += sprintf(p, "%.3e", (rnd(&state) % 10000) / 1000.0 * pow(10, (int)(rnd(&state) % 40) - 20));
+			break;
+		default:
+			d = (double)rnd(&state) / UINT32_MAX * pow(10, (int)(rnd(&state) % 8) - 3);
+			p += sprintf(p, "%.17g", d);
+			break;
+		}
+	}
+	strcpy(p, "]");
+	return buf;
+}
+
+static void run(int kind, int count)
+{
+	char *text = numbers(kind, count), *s, *out;
+	const char *p;
+	cJSON item, *json;
+	printbuffer pb;
+	double start, t_old, t_new, t_old_print, t_new_print, t_doc;
+	int i, bad_old = 0, bad_new = 0, lossy_old = 0, lossy_new = 0;
+	char buf[CJSON_NUMBER_LEN];
+	double *values;
+
+	values = malloc(sizeof(*values) * count);
+	if (!values) {
+		fprintf(stderr, "Error: Out of memory\n");
+		exit(1);
+	}
+	memset(&item, 0, sizeof(item));
+	for (p = text + 1, i = 0; i < count; i++, p++)
+		values[i] = strtod(p, (char **)&p);
+
+	// Parse, both against strtod()
+	start = bench_now();
+	for (p = text + 1, i = 0; i < count; i++) {
+		p = old_parse_number(&item, p) + 1;
+		sink += item.valuedouble;
+	}
+	t_old = (bench_now() - start) / count;
+	start = bench_now();
+	for (p = text + 1, i = 0; i < count; i++) {
+		p = parse_number(&item, p) + 1;
+		sink += item.valuedouble;
+	}
+	t_new = (bench_now() - start) / count;
+	for (p = text + 1, i = 0; i < count; i++) {
+		s = (char *)old_parse_number(&item, p) + 1;
+		bad_old += item.valuedouble != values[i];
+		parse_number(&item, p);
+		bad_new += item.valuedouble != values[i];
+		p = s;
+	}
+
+	// Print, both read back
+	start = bench_now();
+	for (i = 0; i < count; i++) {
+		item.valuedouble = values[i];
+		item.valueint = (int)values[i];
+		out = old_print_number(&item);
+		sink += out[0];
+		cJSON_free(out);
+	}
+	t_old_print = (bench_now() - start) / count;
+	pb.buffer = buf;
+	pb.length = sizeof(buf);
+	pb.fixed = 1;
+	start = bench_now();
+	for (i = 0; i < count; i++) {
+		item.valuedouble = values[i];
+		pb.offset = pb.fail = 0;
+		print_number(&item, &pb);
+		sink += buf[0];
+	}
+	t_new_print = (bench_now() - start) / count;
+	for (i = 0; i < count; i++) {
+		item.valuedouble = values[i];
+		item.valueint = (int)values[i];
+		out = old_print_number(&item);
+		lossy_old += strtod(out, NULL) != values[i];
+		cJSON_free(out);
+		print_double(values[i], buf);
+		lossy_new += strtod(buf, NULL) != values[i];
+	}
+
+	// A whole array, parsed and printed back
+	start = bench_now();
+	json = cJSON_Parse(text);
+	out = cJSON_PrintBuffered(json, strlen(text) + 16, 0);
+	t_doc = bench_now() - start;
+	cJSON_free(out);
+	cJSON_Delete(json);
+
+	printf("%-11s %8.1f %8.1f %6d %6d %8.1f %8.1f %6d %6d %8.1f\n", kind_name[kind],
+		t_old * 1e9, t_new * 1e9, bad_old, bad_new, t_old_print * 1e9, t_new_print * 1e9,
+		lossy_old, lossy_new, strlen(text) / t_doc / 1e6);
+	free(values);
+	free(text);
+}
+
+int main(int argc, char *argv[])
+{
+	int count = bench_arg(argc, argv, 1, 200000);
+	int kind;
+
+	printf("%d numbers per kind, nsecs per number; inexact of %d; MB/s for the array\n", count, count);
+	printf("%-11s %8s %8s %6s %6s %8s %8s %6s %6s %8s\n", "kind", "old read", "read", "inex", "inex",
+		"old prt", "print", "lossy", "lossy", "MB/s");
+	for (kind = 0; kind < BENCH_KINDS; kind++)
+		run(kind, count);
+	return 0;
+}
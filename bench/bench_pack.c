@@ -0,0 +1,123 @@
+/*
+* The MIT License (MIT)
+*
+* Copyright (c) 2013, Marcelo Aquino, https://github.com/mapnull
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+* THE SOFTWARE.
+*/
+
+/*
+* Encode cost and wire size of CBOR and MessagePack against the JSON the
+* bridge forwards, over the payload corpus. "text" packs straight from the
+* serial frame, "tree" from a parsed cJSON tree, "unpack" is the inbound
+* side. Wire bytes are whole PUBLISH packets on a server id topic. The last
+* line sets @J# text frames against packed binary frames on the serial line.
+*
+* ./bench/bench_pack [passes] [corpus]
+*/
+
+#include "bench.h"
+#include "../pack.h"
+#include "../frame.h"
+#include "../serial.h"
+
+#define BENCH_TOPIC "1234"
+#define BENCH_PACK_MAX 1024
+
+static volatile int sink;
+
+static const char *pack_name[] = { "json", "cbor", "msgpack" };
+
+int main(int argc, char *argv[])
+{
+	int passes = bench_arg(argc, argv, 1, 20000);
+	const char *path = argc > 2 ? argv[2] : BENCH_CORPUS;
+	static char lines[BENCH_LINES_MAX][BENCH_LINE_LEN];
+	cJSON *trees[BENCH_LINES_MAX], *json;
+	uint8_t out[BENCH_PACK_MAX], coded[FRAME_ENCODED_MAX(BENCH_PACK_MAX)];
+	char frame[BENCH_PACK_MAX];
+	long payload, wire, json_wire = 0, text_line = 0, packed_line = 0;
+	double start, t_text, t_tree, t_unpack;
+	int count, fmt, i, p, len;
+
+	count = bench_corpus(path, lines);
+	for (i = 0; i < count; i++) {
+		trees[i] = cJSON_Parse(lines[i]);
+		if (!trees[i]) {
+			fprintf(stderr, "Error: Invalid JSON on line %d of %s.\n", i + 1, path);
+			return 1;
+		}
+	}
+
+	printf("%d messages x %d passes\n", count, passes);
+	printf("%-8s %10s %10s %8s %10s %10s %10s\n", "format", "payload", "wire", "saved", "text ns", "tree ns", "unpack ns");
+	for (fmt = PACK_JSON; fmt <= PACK_MSGPACK; fmt++) {
+		payload = wire = 0;
+		for (i = 0; i < count; i++) {
+			len = fmt == PACK_JSON ? (int)strlen(lines[i]) : pack_json(fmt, lines[i], out, sizeof(out));
+			if (len < 0) {
+				fprintf(stderr, "Error: Can't pack line %d of %s.\n", i + 1, path);
+				return 1;
+			}
+			payload += len;
+			wire += bench_publish_size(strlen(BENCH_TOPIC), len, 0);
+		}
+		if (fmt == PACK_JSON) {
+			json_wire = wire;
+			printf("%-8s %10ld %10ld %8s %10s %10s %10s\n", pack_name[fmt], payload, wire, "-", "-", "-", "-");
+			continue;
+		}
+
+		start = bench_now();
+		for (p = 0; p < passes; p++)
+			for (i = 0; i < count; i++)
+				sink += pack_json(fmt, lines[i], out, sizeof(out));
+		t_text = (bench_now() - start) / passes / count;
+		start = bench_now();
+		for (p = 0; p < passes; p++)
+			for (i = 0; i < count; i++)
+				sink += pack_cjson(fmt, trees[i], out, sizeof(out));
+		t_tree = (bench_now() - start) / passes / count;
+		start = bench_now();
+		for (p = 0; p < passes; p++)
+			for (i = 0; i < count; i++) {
+				len = pack_cjson(fmt, trees[i], out, sizeof(out));
+				json = pack_parse(fmt, out, len);
+				sink += json != NULL;
+				cJSON_Delete(json);
+			}
+		t_unpack = (bench_now() - start) / passes / count - t_tree;
+
+		printf("%-8s %10ld %10ld %7.1f%% %10.0f %10.0f %10.0f\n", pack_name[fmt], payload, wire,
+			100.0 - 100.0 * wire / json_wire, t_text * 1e9, t_tree * 1e9, t_unpack * 1e9);
+	}
+
+	for (i = 0; i < count; i++) {
+		text_line += SERIAL_INIT_LEN + strlen(lines[i]) + 1;
+		memcpy(frame, SERIAL_SINGLE_JSON_STR, SERIAL_INIT_LEN);
+		len = pack_json(PACK_CBOR, lines[i], (uint8_t *)frame + SERIAL_INIT_LEN, sizeof(frame) - SERIAL_INIT_LEN);
+		packed_line += frame_encode(frame, SERIAL_INIT_LEN + len, coded, sizeof(coded)) + 1;
+	}
+	printf("serial   text %ld, packed %ld bytes: %.2fx the messages per second\n", text_line, packed_line,
+		(double)text_line / packed_line);
+
+	for (i = 0; i < count; i++)
+		cJSON_Delete(trees[i]);
+	return 0;
+}
@@ -0,0 +1,209 @@
+/*
+* The MIT License (MIT)
+*
+* Copyright (c) 2013, Marcelo Aquino, https://github.com/mapnull
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+* THE SOFTWARE.
+*/
+
+/*
+* Single threaded against pipelined serial input. A thread writes JSON
+* frames into a pty; the consumer parses and prints each one with cJSON
+* and, every stall_every messages, sleeps stall msecs the way a broker
+* hiccup holds up the event loop. Single threaded, the consumer also
+* reads the port; pipelined, the reader thread from pipeline.c does and
+* hands frames over through its ring.
+*
+* "blocked" is the time the board spent in write() beyond 1 msec, the
+* bytes a real UART would have lost to a full tty buffer.
+*
+* ./bench/bench_pipeline [messages] [gap usecs] [stall msecs] [stall every]
+*/
+
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "bench.h"
+#include "../bridge.h"
+#include "../cJSON.h"
+#include "../frame.h"
+#include "../pipeline.h"
+#include "../pool.h"
+
+#define BENCH_FRAME_MAX 256
+
+struct board {
+	int fd;
+	int count;
+	int gap;
+	double blocked;
+};
+
+struct consumer {
+	int count;
+	int stall;
+	int stall_every;
+	int got;
+	double lat_max;
+};
+
+static void *board_write(void *data)
+{
+	struct board *board = data;
+	char msg[128];
+	double start, took;
+	int i, len;
+
+	for (i = 0; i < board->count; i++) {
+		len = snprintf(msg, sizeof(msg), "@J#{\"ts\":%.9f,\"n\":%d,\"t\":21.6,\"h\":52,\"p\":1013.2,\"s\":[1,0,1]}\n",
+			bench_now(), i);
+		start = bench_now();
+		if (write(board->fd, msg, len) != len) {
+			perror("write");
+			break;
+		}
+		took = bench_now() - start;
+		if (took > 1e-3)
+			board->blocked += took;
+		if (board->gap)
+			usleep(board->gap);
+	}
+	return NULL;
+}
+
+// What the event loop does with a message, with the occasional stall
+static void process(struct consumer *consumer, const char *frame)
+{
+	cJSON *json;
+	char *out;
+	double lat;
+
+	json = cJSON_Parse(frame + SERIAL_INIT_LEN);
+	if (!json)
+		return;
+	lat = bench_now() - cJSON_GetObjectItem(json, "ts")->valuedouble;
+	if (lat > consumer->lat_max)
+		consumer->lat_max = lat;
+	out = cJSON_PrintUnformatted(json);
+	free(out);
+	cJSON_Delete(json);
+	if (++consumer->got % consumer->stall_every == 0 && consumer->stall)
+		usleep(consumer->stall * 1000);
+}
+
+static void consume_single(struct bridge_port *port, struct consumer *consumer)
+{
+	struct pollfd pfd = { .fd = port->sd, .events = POLLIN };
+	int len, max = port->serial->max_frame;
+
+	while (consumer->got < consumer->count) {
+		if (poll(&pfd, 1, 1000) <= 0)
+			break;
+		if (serialport_fill(port->sd, &port->rx) == -1)
+			break;
+		while ((len = frame_next(&port->rx, 0, port->frame, max + 1, port->scratch, FRAME_ENCODED_MAX(max) + 1)) != SERIALPORT_NO_FRAME)
+			if (len > 0)
+				process(consumer, port->frame);
+	}
+}
+
+static void consume_pipeline(struct bridge_port *port, struct consumer *consumer)
+{
+	struct pollfd pfd = { .fd = pipeline_fd(), .events = POLLIN };
+	struct pipeline_msg *msg;
+	uint64_t wakes;
+
+	pipeline_start(port);
+	while (consumer->got < consumer->count) {
+		if (poll(&pfd, 1, 1000) <= 0)
+			break;
+		if (read(pfd.fd, &wakes, sizeof(wakes)) == -1)
+			continue;
+		while ((msg = ring_peek(&port->reader->ring))) {
+			if (msg->kind == PIPELINE_FRAME) {
+				process(consumer, msg->data);
+				pool_put(msg->data);
+			}
+			ring_release(&port->reader->ring);
+		}
+	}
+	pipeline_stop(port);
+}
+
+static void run(const char *name, void (*consume)(struct bridge_port *, struct consumer *),
+	int count, int gap, int stall, int stall_every)
+{
+	struct bridge_serial serial;
+	struct bridge_t bridge;
+	struct bridge_port *port;
+	struct consumer consumer;
+	struct board board;
+	pthread_t thread;
+	double start, took;
+	int master;
+
+	memset(&serial, 0, sizeof(serial));
+	serial.max_frame = BENCH_FRAME_MAX;
+	bridge_init(&bridge, "bench", &serial, 1);
+	port = &bridge.ports[0];
+	master = posix_openpt(O_RDWR | O_NOCTTY);
+	if (master == -1 || grantpt(master) || unlockpt(master)) {
+		perror("pty");
+		exit(1);
+	}
+	port->sd = serialport_init(ptsname(master), 115200);
+
+	memset(&consumer, 0, sizeof(consumer));
+	consumer.count = count;
+	consumer.stall = stall;
+	consumer.stall_every = stall_every;
+	memset(&board, 0, sizeof(board));
+	board.fd = master;
+	board.count = count;
+	board.gap = gap;
+	start = bench_now();
+	pthread_create(&thread, NULL, board_write, &board);
+	consume(port, &consumer);
+	took = bench_now() - start;
+	pthread_join(thread, NULL);
+	printf("%-10s %10d %10.0f %12.1f %12.1f\n", name, consumer.got, consumer.got / took,
+		consumer.lat_max * 1e3, board.blocked * 1e3);
+	close(port->sd);
+	close(master);
+}
+
+int main(int argc, char *argv[])
+{
+	int count = bench_arg(argc, argv, 1, 50000);
+	int gap = bench_arg(argc, argv, 2, 0);
+	int stall = bench_arg(argc, argv, 3, 0);
+	int stall_every = bench_arg(argc, argv, 4, 1000);
+
+	if (pipeline_init())
+		return 1;
+	printf("%d messages, %d usecs apart, %d msecs stall every %d\n", count, gap, stall, stall_every);
+	printf("%-10s %10s %10s %12s %12s\n", "mode", "messages", "msgs/s", "max lat ms", "blocked ms");
+	run("single", consume_single, count, gap, stall, stall_every);
+	run("pipeline", consume_pipeline, count, gap, stall, stall_every);
+	pipeline_cleanup();
+	return 0;
+}
@@ -0,0 +1,169 @@
+/*
+* The MIT License (MIT)
+*
+* Copyright (c) 2013, Marcelo Aquino, https://github.com/mapnull
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+* THE SOFTWARE.
+*/
+
+/*
+* Per-port throughput and latency with one event loop serving 1, 4 and 8
+* serial ports. Each port is a pty with a thread writing timestamped frames
+* on the master side; the loop reads them with serialport_fill() and
+* frame_next() the way the bridge does.
+*
+* ./bench/bench_ports [messages per port] [gap usecs]
+*/
+
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "bench.h"
+#include "../arduino-serial-lib.h"
+#include "../event.h"
+#include "../frame.h"
+
+#define BENCH_PORTS_MAX 8
+#define BENCH_FRAME_MAX 100
+
+struct port {
+	int master;
+	int fd;
+	int count;
+	int gap;
+	int got;
+	double last;					// Time of the last frame
+	struct event_t ev;
+	struct serialport_rx rx;
+	pthread_t thread;
+};
+
+static double *lat;					// Latency of every frame, secs
+static int lat_count;
+
+static void *board_write(void *data)
+{
+	struct port *port = data;
+	char msg[64];
+	int i, len;
+
+	for (i = 0; i < port->count; i++) {
+		len = snprintf(msg, sizeof(msg), "@J#{\"ts\":%.9f,\"n\":%d}\n", bench_now(), i);
+		if (write(port->master, msg, len) != len) {
+			perror("write");
+			break;
+		}
+		if (port->gap)
+			usleep(port->gap);
+	}
+	return NULL;
+}
+
+static void port_read(int fd, uint32_t events, void *data)
+{
+	struct port *port = data;
+	char frame[BENCH_FRAME_MAX + 1], scratch[FRAME_ENCODED_MAX(BENCH_FRAME_MAX) + 1];
+	double now;
+	int len;
+
+	if (serialport_fill(fd, &port->rx) == -1)
+		return;
+	now = bench_now();
+	while ((len = frame_next(&port->rx, 0, frame, sizeof(frame), scratch, sizeof(scratch))) != SERIALPORT_NO_FRAME) {
+		if (len <= 0 || strncmp(frame, "@J#{\"ts\":", 9))
+			continue;
+		lat[lat_count++] = now - atof(frame + 9);
+		port->got++;
+		port->last = now;
+	}
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return (x > y) - (x < y);
+}
+
+static void run(int ports, int count, int gap)
+{
+	struct port port[BENCH_PORTS_MAX];
+	double start, end = 0;
+	int i, total = 0;
+
+	lat = malloc(sizeof(*lat) * ports * count);
+	if (!lat) {
+		fprintf(stderr, "Error: Out of memory\n");
+		exit(1);
+	}
+	lat_count = 0;
+	event_init();
+	for (i = 0; i < ports; i++) {
+		memset(&port[i], 0, sizeof(port[i]));
+		port[i].master = posix_openpt(O_RDWR | O_NOCTTY);
+		if (port[i].master == -1 || grantpt(port[i].master) || unlockpt(port[i].master)) {
+			perror("pty");
+			exit(1);
+		}
+		port[i].fd = serialport_init(ptsname(port[i].master), 115200);
+		port[i].count = count;
+		port[i].gap = gap;
+		serialport_rx_alloc(&port[i].rx, FRAME_ENCODED_MAX(BENCH_FRAME_MAX) + 1);
+		event_add(&port[i].ev, port[i].fd, EPOLLIN, port_read, &port[i]);
+	}
+	start = bench_now();
+	for (i = 0; i < ports; i++)
+		pthread_create(&port[i].thread, NULL, board_write, &port[i]);
+	while (lat_count < ports * count)
+		if (event_wait(1000) <= 0)
+			break;
+	for (i = 0; i < ports; i++) {
+		pthread_join(port[i].thread, NULL);
+		total += port[i].got;
+		if (port[i].last > end)
+			end = port[i].last;
+	}
+	qsort(lat, lat_count, sizeof(*lat), cmp_double);
+	printf("%5d %10d %14.0f %10.1f %10.1f %10.1f\n", ports, total, total / (end - start) / ports,
+		lat_count ? lat[lat_count / 2] * 1e6 : 0, lat_count ? lat[lat_count * 99 / 100] * 1e6 : 0,
+		lat_count ? lat[lat_count - 1] * 1e6 : 0);
+	for (i = 0; i < ports; i++) {
+		event_del(&port[i].ev);
+		serialport_rx_free(&port[i].rx);
+		close(port[i].fd);
+		close(port[i].master);
+	}
+	event_cleanup();
+	free(lat);
+}
+
+int main(int argc, char *argv[])
+{
+	int count = bench_arg(argc, argv, 1, 20000);
+	int gap = bench_arg(argc, argv, 2, 50);
+
+	printf("%d messages per port, %d usecs apart\n", count, gap);
+	printf("%5s %10s %14s %10s %10s %10s\n", "ports", "messages", "msgs/s/port", "p50 usecs", "p99 usecs", "max usecs");
+	run(1, count, gap);
+	run(4, count, gap);
+	run(8, count, gap);
+	return 0;
+}
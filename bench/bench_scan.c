@@ -0,0 +1,146 @@
+/*
+* The MIT License (MIT)
+*
+* Copyright (c) 2013, Marcelo Aquino, https://github.com/mapnull
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+* THE SOFTWARE.
+*/
+
+/*
+* scan_plain(), the SIMD scan for the end of a plain string run, against
+* the scalar loop it replaced and the 64-bit word loop gateways without
+* SSE2 or NEON get; on x86 scan_plain() takes its AVX2 loop when the CPU
+* has it. Runs on the strings of the payload corpus and on
+* runs of 8 to 256 plain bytes, then times whole cJSON parses and prints
+* of the corpus. Includes cJSON.c to reach its static functions.
+*
+* ./bench/bench_scan [passes] [corpus]
+*/
+
+#include "bench.h"
+#include "../cJSON.c"
+
+#define BENCH_RUN_MAX 256
+
+static volatile size_t sink;
+
+/* The loop parse_string() and print_string_ptr() used to run. */
+static size_t scan_scalar(const char *s,const char *end)
+{
+	const char *p=s;
+	while (p<end && (unsigned char)*p>31 && *p!='\"' && *p!='\\') p++;
+	return p-s;
+}
+
+/* scan_plain() without SSE2 or NEON. */
+static size_t scan_word(const char *s,const char *end)
+{
+	const unsigned long long ones=0x0101010101010101ULL,highs=0x8080808080808080ULL;
+	const char *p=s;
+	unsigned long long w;
+	for (;end-p>=8;p+=8)
+	{
+		memcpy(&w,p,8);
+		if ((((w^(ones*'\"'))-ones) | ((w^(ones*'\\'))-ones) | (w-ones*32)) & ~w & highs) break;
+	}
+	while (p<end && (unsigned char)*p>31 && *p!='\"' && *p!='\\') p++;
+	return p-s;
+}
+
+static size_t (*scans[])(const char *, const char *) = { scan_scalar, scan_word, scan_plain };
+
+// Scans every string of the text, from past its opening quote
+static size_t scan_strings(size_t (*scan)(const char *, const char *), const char *text, const char *end)
+{
+	const char *p = text;
+	size_t n = 0, len;
+
+	while ((p = memchr(p, '\"', end - p))) {
+		len = scan(p + 1, end);
+		n += len;
+		p += len + 2;
+		if (p >= end)
+			break;
+	}
+	return n;
+}
+
+int main(int argc, char *argv[])
+{
+	int passes = bench_arg(argc, argv, 1, 100000);
+	const char *path = argc > 2 ? argv[2] : BENCH_CORPUS;
+	static char lines[BENCH_LINES_MAX][BENCH_LINE_LEN];
+	char run[BENCH_RUN_MAX + 1];
+	double start, t[3], bytes;
+	int count, i, k, p, len;
+	size_t total;
+	cJSON *json;
+	char *out;
+
+	count = bench_corpus(path, lines);
+	printf("%d passes, nsecs per call and GB/s\n", passes);
+	printf("%-12s %14s %14s %14s\n", "input", "scalar", "word", "scan_plain");
+
+	for (total = 0, i = 0; i < count; i++)
+		total += scan_strings(scan_scalar, lines[i], lines[i] + strlen(lines[i]));
+	for (k = 0; k < 3; k++) {
+		start = bench_now();
+		for (p = 0; p < passes; p++)
+			for (i = 0; i < count; i++)
+				sink += scan_strings(scans[k], lines[i], lines[i] + strlen(lines[i]));
+		t[k] = (bench_now() - start) / passes;
+	}
+	printf("%-12s %8.0f %5.2f %8.0f %5.2f %8.0f %5.2f\n", "corpus", t[0] * 1e9 / count, total / t[0] / 1e9,
+		t[1] * 1e9 / count, total / t[1] / 1e9, t[2] * 1e9 / count, total / t[2] / 1e9);
+
+	for (len = 8; len <= BENCH_RUN_MAX; len *= 2) {
+		memset(run, 'a', len);
+		run[len] = '\"';
+		for (k = 0; k < 3; k++) {
+			start = bench_now();
+			for (p = 0; p < passes * 10; p++)
+				sink += scans[k](run, run + len + 1);
+			t[k] = (bench_now() - start) / passes / 10;
+		}
+		bytes = len;
+		printf("%-12d %8.1f %5.2f %8.1f %5.2f %8.1f %5.2f\n", len, t[0] * 1e9, bytes / t[0] / 1e9,
+			t[1] * 1e9, bytes / t[1] / 1e9, t[2] * 1e9, bytes / t[2] / 1e9);
+	}
+
+	for (total = 0, i = 0; i < count; i++)
+		total += strlen(lines[i]);
+	start = bench_now();
+	for (p = 0; p < passes / 10; p++)
+		for (i = 0; i < count; i++)
+			cJSON_Delete(cJSON_Parse(lines[i]));
+	t[0] = (bench_now() - start) / (passes / 10);
+	start = bench_now();
+	for (p = 0; p < passes / 10; p++)
+		for (i = 0; i < count; i++) {
+			json = cJSON_Parse(lines[i]);
+			out = cJSON_PrintUnformatted(json);
+			sink += out[0];
+			cJSON_free(out);
+			cJSON_Delete(json);
+		}
+	t[1] = (bench_now() - start) / (passes / 10) - t[0];
+	printf("corpus parse %8.0f ns/msg %5.0f MB/s, print %5.0f ns/msg %5.0f MB/s\n", t[0] * 1e9 / count,
+		total / t[0] / 1e6, t[1] * 1e9 / count, total / t[1] / 1e6);
+	return 0;
+}
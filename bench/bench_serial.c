@@ -0,0 +1,174 @@
+/*
+* The MIT License (MIT)
+*
+* Copyright (c) 2013, Marcelo Aquino, https://github.com/mapnull
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+* THE SOFTWARE.
+*/
+
+/*
+* Syscalls per message on serial input: serialport_read_until(), one read()
+* per byte, against serialport_fill() and frame_next(), one readv() per
+* wakeup. A thread plays the board on the master side of a pty, writing a
+* message every gap usecs (0 for back to back).
+*
+* ./bench/bench_serial [messages] [gap]
+*/
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+#include "bench.h"
+#include "../arduino-serial-lib.h"
+#include "../frame.h"
+
+#define BENCH_FRAME_MAX 100
+
+static long syscalls;
+
+// Linked with -Wl,--wrap=read,--wrap=readv, counts the library's calls too
+ssize_t __real_read(int, void *, size_t);
+ssize_t __real_readv(int, const struct iovec *, int);
+
+ssize_t __wrap_read(int fd, void *buf, size_t count)
+{
+	syscalls++;
+	return __real_read(fd, buf, count);
+}
+
+ssize_t __wrap_readv(int fd, const struct iovec *iov, int iovcnt)
+{
+	syscalls++;
+	return __real_readv(fd, iov, iovcnt);
+}
+
+struct board {
+	int fd;
+	int count;
+	int gap;
+};
+
+static void *board_write(void *data)
+{
+	struct board *board = data;
+	char msg[64];
+	int i, len;
+
+	for (i = 0; i < board->count; i++) {
+		len = snprintf(msg, sizeof(msg), "@J#{\"t\":21.6,\"h\":52,\"n\":%d}\n", i);
+		if (write(board->fd, msg, len) != len) {
+			perror("write");
+			break;
+		}
+		if (board->gap)
+			usleep(board->gap);
+	}
+	return NULL;
+}
+
+static int pty_open(int *master)
+{
+	*master = posix_openpt(O_RDWR | O_NOCTTY);
+	if (*master == -1 || grantpt(*master) || unlockpt(*master)) {
+		perror("pty");
+		exit(1);
+	}
+	return serialport_init(ptsname(*master), 115200);
+}
+
+// Before: a line at a time, one byte per read()
+static int read_bytes(int fd, int count)
+{
+	char buf[BENCH_FRAME_MAX + 1];
+	int got = 0, len;
+
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+	while (got < count) {
+		len = serialport_read_until(fd, buf, '\n', BENCH_FRAME_MAX, 100);
+		if (len == -1)
+			break;
+		if (len > 0 && buf[len - 1] == '\n')
+			got++;
+	}
+	return got;
+}
+
+// After: whatever is there in one readv(), frames cut from the ring
+static int read_frames(int fd, int count)
+{
+	struct serialport_rx rx;
+	struct pollfd pfd = { .fd = fd, .events = POLLIN };
+	char frame[BENCH_FRAME_MAX + 1], scratch[FRAME_ENCODED_MAX(BENCH_FRAME_MAX) + 1];
+	int got = 0, len;
+
+	serialport_rx_alloc(&rx, FRAME_ENCODED_MAX(BENCH_FRAME_MAX) + 1);
+	while (got < count) {
+		syscalls++;						// The poll() the event loop does
+		if (poll(&pfd, 1, 1000) <= 0)
+			break;
+		if (serialport_fill(fd, &rx) == -1)
+			break;
+		while ((len = frame_next(&rx, 0, frame, sizeof(frame), scratch, sizeof(scratch))) != SERIALPORT_NO_FRAME)
+			if (len > 0)
+				got++;
+	}
+	serialport_rx_free(&rx);
+	return got;
+}
+
+static void run(const char *name, int (*reader)(int, int), int count, int gap)
+{
+	struct board board;
+	pthread_t thread;
+	double start, cpu;
+	int master, fd, got;
+
+	fd = pty_open(&master);
+	board.fd = master;
+	board.count = count;
+	board.gap = gap;
+	syscalls = 0;
+	start = bench_now();
+	cpu = bench_cpu();
+	pthread_create(&thread, NULL, board_write, &board);
+	got = reader(fd, count);
+	cpu = bench_cpu() - cpu;
+	pthread_join(thread, NULL);
+	printf("%-14s %8d %14.1f %14.2f %10.3f\n", name, got, got ? (double)syscalls / got : 0,
+		got ? cpu * 1e6 / got : 0, bench_now() - start);
+	close(fd);
+	close(master);
+}
+
+int main(int argc, char *argv[])
+{
+	int count = bench_arg(argc, argv, 1, 20000);
+	int gap = bench_arg(argc, argv, 2, 0);
+
+	printf("%d messages, %d usecs apart\n", count, gap);
+	printf("%-14s %8s %14s %14s %10s\n", "reader", "messages", "syscalls/msg", "cpu usecs/msg", "secs");
+	run("read_until", read_bytes, count, gap);
+	run("fill+frame", read_frames, count, gap);
+	return 0;
+}
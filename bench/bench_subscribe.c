@@ -0,0 +1,169 @@
+/*
+* The MIT License (MIT)
+*
+* Copyright (c) 2013, Marcelo Aquino, https://github.com/mapnull
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+* THE SOFTWARE.
+*/
+
+/*
+* Reconnect to ready time against a real broker: connect, then subscribe
+* to every device topic and wait for the last SUBACK. Runs one SUBSCRIBE
+* per device as the bridge used to, batches the way it does now, and the
+* single wildcard subscription.
+*
+* ./bench/bench_subscribe [host] [port] [devices]
+*/
+
+#include <mosquitto.h>
+
+#include "bench.h"
+
+#define BENCH_SUB_BATCH 64				// MQTT_SUB_BATCH in mqtt_bridge.c
+#define BENCH_TOPIC_LEN 40
+
+enum { SUB_ONE, SUB_BATCH, SUB_WILDCARD };
+
+struct state {
+	int mode;
+	int devices;
+	char (*topics)[BENCH_TOPIC_LEN];
+	int packets;						// SUBSCRIBEs sent
+	int last_mid;
+	double connected;
+	double ready;
+	bool failed;
+};
+
+static void on_subscribe(struct mosquitto *mosq, void *obj, int mid, int qos_count, const int *granted_qos)
+{
+	struct state *state = obj;
+
+	if (mid == state->last_mid)
+		state->ready = bench_now();
+}
+
+static void subscribe_check(struct state *state, int rc)
+{
+	if (rc) {
+		fprintf(stderr, "Error: Subscribe: %s\n", mosquitto_strerror(rc));
+		state->failed = true;
+	}
+	state->packets++;
+}
+
+static void on_connect(struct mosquitto *mosq, void *obj, int result)
+{
+	struct state *state = obj;
+	char *batch[BENCH_SUB_BATCH];
+	char wildcard[BENCH_TOPIC_LEN];
+	int i, n;
+
+	if (result) {
+		fprintf(stderr, "Error: Connect: %s\n", mosquitto_connack_string(result));
+		state->failed = true;
+		return;
+	}
+	state->connected = bench_now();
+	switch (state->mode) {
+	case SUB_ONE:
+		for (i = 0; i < state->devices; i++)
+			subscribe_check(state, mosquitto_subscribe(mosq, &state->last_mid, state->topics[i], 0));
+		break;
+	case SUB_BATCH:
+		for (i = 0; i < state->devices; i += n) {
+			for (n = 0; n < BENCH_SUB_BATCH && i + n < state->devices; n++)
+				batch[n] = state->topics[i + n];
+			subscribe_check(state, mosquitto_subscribe_multiple(mosq, &state->last_mid, n, batch, 0, 0, NULL));
+		}
+		break;
+	case SUB_WILDCARD:
+		snprintf(wildcard, sizeof(wildcard), "bench-bridge/+");
+		subscribe_check(state, mosquitto_subscribe(mosq, &state->last_mid, wildcard, 0));
+		break;
+	}
+}
+
+static void run(const char *name, int mode, const char *host, int port, int devices, char (*topics)[BENCH_TOPIC_LEN])
+{
+	struct mosquitto *mosq;
+	struct state state;
+	double start;
+	int rc;
+
+	memset(&state, 0, sizeof(state));
+	state.mode = mode;
+	state.devices = devices;
+	state.topics = topics;
+	mosq = mosquitto_new(NULL, true, &state);
+	if (!mosq) {
+		fprintf(stderr, "Error: Out of memory\n");
+		exit(1);
+	}
+	mosquitto_connect_callback_set(mosq, on_connect);
+	mosquitto_subscribe_callback_set(mosq, on_subscribe);
+
+	start = bench_now();
+	rc = mosquitto_connect(mosq, host, port, 60);
+	if (rc) {
+		fprintf(stderr, "Error: Connect %s:%d: %s\n", host, port, mosquitto_strerror(rc));
+		exit(1);
+	}
+	while (!state.ready && !state.failed && bench_now() - start < 30) {
+		rc = mosquitto_loop(mosq, 10, 1);
+		if (rc) {
+			fprintf(stderr, "Error: Loop: %s\n", mosquitto_strerror(rc));
+			break;
+		}
+	}
+	if (state.ready)
+		printf("%-10s %10d %12.1f %12.1f\n", name, state.packets,
+			(state.connected - start) * 1e3, (state.ready - start) * 1e3);
+	else
+		printf("%-10s %10d %12s %12s\n", name, state.packets, "-", "timeout");
+	mosquitto_disconnect(mosq);
+	mosquitto_destroy(mosq);
+}
+
+int main(int argc, char *argv[])
+{
+	const char *host = argc > 1 ? argv[1] : "localhost";
+	int port = bench_arg(argc, argv, 2, 1883);
+	int devices = bench_arg(argc, argv, 3, 1000);
+	char (*topics)[BENCH_TOPIC_LEN];
+	int i;
+
+	topics = malloc(sizeof(*topics) * devices);
+	if (!topics) {
+		fprintf(stderr, "Error: Out of memory\n");
+		exit(1);
+	}
+	for (i = 0; i < devices; i++)
+		snprintf(topics[i], BENCH_TOPIC_LEN, "%08x-7d1c-11ee-b962-0242ac120002", 0x5a000000u + i);
+
+	mosquitto_lib_init();
+	printf("%d devices on %s:%d\n", devices, host, port);
+	printf("%-10s %10s %12s %12s\n", "subscribe", "packets", "connack ms", "ready ms");
+	run("one", SUB_ONE, host, port, devices, topics);
+	run("batched", SUB_BATCH, host, port, devices, topics);
+	run("wildcard", SUB_WILDCARD, host, port, devices, topics);
+	mosquitto_lib_cleanup();
+	free(topics);
+	return 0;
+}
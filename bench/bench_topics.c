@@ -0,0 +1,120 @@
+/*
+* The MIT License (MIT)
+*
+* Copyright (c) 2013, Marcelo Aquino, https://github.com/mapnull
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+* THE SOFTWARE.
+*/
+
+/*
+* Per-message formatting cost: the topic and the serial prefix rendered
+* with snprintf() on every message, as the bridge used to, against the
+* copies each device now keeps.
+*
+* ./bench/bench_topics [messages]
+*/
+
+#include "bench.h"
+#include "../bridge.h"
+#include "../serial.h"
+
+#define BENCH_DEVICES 100
+#define BENCH_BUF_SIZE 512
+
+static const char *command = "{\"set\":{\"relay\":1,\"led\":[255,128,0]},\"tid\":4711}";
+static volatile int sink;
+
+int main(int argc, char *argv[])
+{
+	int count = bench_arg(argc, argv, 1, 10000000);
+	struct bridge_serial serial;
+	struct bridge_t bridge;
+	struct device_t *devices[BENCH_DEVICES], *device;
+	char uuid[DEVICE_UUID_LEN + 1], gbuf[BENCH_BUF_SIZE];
+	const char *topic;
+	double start, t_uuid, t_server, t_prefix, t_uuid_now, t_server_now, t_prefix_now;
+	int i, len;
+
+	memset(&serial, 0, sizeof(serial));
+	serial.max_frame = 256;
+	bridge_init(&bridge, "bench", &serial, 1);
+	for (i = 0; i < BENCH_DEVICES; i++) {
+		sprintf(uuid, "%08x-7d1c-11ee-b962-0242ac120002", 0x5a000000u + i);
+		devices[i] = bridge_add_device(&bridge, &bridge.ports[0], uuid);
+		bridge_set_device_id(&bridge, devices[i], i + 1);
+	}
+
+	// Topic of a device without a server id, "b/<uuid>"
+	start = bench_now();
+	for (i = 0; i < count; i++) {
+		device = devices[i % BENCH_DEVICES];
+		snprintf(gbuf, sizeof(gbuf), "b/%s", device->uuid);
+		sink += gbuf[2];
+	}
+	t_uuid = (bench_now() - start) / count;
+	start = bench_now();
+	for (i = 0; i < count; i++) {
+		topic = devices[i % BENCH_DEVICES]->topic;
+		sink += topic[2];
+	}
+	t_uuid_now = (bench_now() - start) / count;
+
+	for (i = 0; i < BENCH_DEVICES; i++)
+		bridge_set_device_server_id(&bridge, devices[i], 1000 + i);
+
+	// Topic of a device with a server id
+	start = bench_now();
+	for (i = 0; i < count; i++) {
+		device = devices[i % BENCH_DEVICES];
+		snprintf(gbuf, sizeof(gbuf), "%d", device->server_id);
+		sink += gbuf[2];
+	}
+	t_server = (bench_now() - start) / count;
+	start = bench_now();
+	for (i = 0; i < count; i++) {
+		topic = devices[i % BENCH_DEVICES]->topic;
+		sink += topic[2];
+	}
+	t_server_now = (bench_now() - start) / count;
+
+	// MQTT command to a multi-drop device, "@j#<id><json>"
+	start = bench_now();
+	for (i = 0; i < count; i++) {
+		device = devices[i % BENCH_DEVICES];
+		snprintf(gbuf, sizeof(gbuf), "%s%d%s", SERIAL_MULTI_JSON_STR, device->id, command);
+		sink += gbuf[4];
+	}
+	t_prefix = (bench_now() - start) / count;
+	start = bench_now();
+	for (i = 0; i < count; i++) {
+		device = devices[i % BENCH_DEVICES];
+		len = strlen(command);
+		memcpy(gbuf, device->json_prefix, device->json_prefix_len);
+		memcpy(gbuf + device->json_prefix_len, command, len + 1);
+		sink += gbuf[4];
+	}
+	t_prefix_now = (bench_now() - start) / count;
+
+	printf("%d messages over %d devices, nsecs per message\n", count, BENCH_DEVICES);
+	printf("%-22s %10s %10s\n", "", "snprintf", "rendered");
+	printf("%-22s %10.1f %10.1f\n", "topic b/<uuid>", t_uuid * 1e9, t_uuid_now * 1e9);
+	printf("%-22s %10.1f %10.1f\n", "topic <server id>", t_server * 1e9, t_server_now * 1e9);
+	printf("%-22s %10.1f %10.1f\n", "command @j#<id>", t_prefix * 1e9, t_prefix_now * 1e9);
+	return 0;
+}
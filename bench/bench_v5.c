@@ -0,0 +1,114 @@
+/*
+* The MIT License (MIT)
+*
+* Copyright (c) 2013, Marcelo Aquino, https://github.com/mapnull
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+* THE SOFTWARE.
+*/
+
+/*
+* PUBLISH bytes on the wire, MQTT 3.1.1 against v5 with topic aliases and
+* message expiry, for devices on b/<uuid> topics sending the payload
+* corpus round robin. Aliases are handed out the way mqtt_alias() does,
+* to the first devices to publish, so once there are more devices than the
+* broker allows aliases for, the rest send their topic every time.
+*
+* ./bench/bench_v5 [broker aliases] [qos] [corpus]
+*/
+
+#include <stdbool.h>
+
+#include "bench.h"
+
+#define BENCH_ROUNDS 100					// Messages per device
+#define BENCH_DEVICES_MAX 1000
+#define BENCH_TOPIC_LEN 38					// "b/<uuid>"
+
+#define PROP_ALIAS 3						// Identifier and two bytes
+#define PROP_EXPIRY 5						// Identifier and four bytes
+
+enum { MQTT_311, MQTT_5, MQTT_5_ALIAS, MQTT_5_EXPIRY };
+
+static const char *mode_name[] = { "3.1.1", "5", "5 alias", "5 alias+exp" };
+
+// Bytes of a v5 PUBLISH, the topic is left out when the alias is known
+static int publish_size_v5(int topic_len, int payload_len, int qos, int props)
+{
+	int rest = 2 + topic_len + (qos ? 2 : 0) + bench_varint_size(props) + props + payload_len;
+
+	return 1 + bench_varint_size(rest) + rest;
+}
+
+static void run(int devices, int aliases, int qos, char lines[][BENCH_LINE_LEN], int count)
+{
+	static int device_alias[BENCH_DEVICES_MAX];
+	long bytes[MQTT_5_EXPIRY + 1] = { 0 }, payload = 0, messages = 0;
+	int mode, n, d, len, props, alias_next = 1;
+	bool known;
+
+	memset(device_alias, 0, sizeof(device_alias));
+	for (n = 0; n < devices * BENCH_ROUNDS; n++) {
+		d = n % devices;
+		len = strlen(lines[n % count]);
+		payload += len;
+		messages++;
+
+		known = false;
+		if (aliases) {
+			if (device_alias[d])
+				known = true;
+			else if (alias_next <= aliases)
+				device_alias[d] = alias_next++;
+		}
+		for (mode = MQTT_311; mode <= MQTT_5_EXPIRY; mode++) {
+			if (mode == MQTT_311) {
+				bytes[mode] += bench_publish_size(BENCH_TOPIC_LEN, len, qos);
+				continue;
+			}
+			props = 0;
+			if (mode >= MQTT_5_ALIAS && device_alias[d])
+				props += PROP_ALIAS;
+			if (mode == MQTT_5_EXPIRY)
+				props += PROP_EXPIRY;
+			bytes[mode] += publish_size_v5(mode >= MQTT_5_ALIAS && known ? 0 : BENCH_TOPIC_LEN, len, qos, props);
+		}
+	}
+	for (mode = MQTT_311; mode <= MQTT_5_EXPIRY; mode++)
+		printf("%8d %-12s %10.1f %10.1f %8.1f%%\n", devices, mode_name[mode], (double)bytes[mode] / messages,
+			(double)(bytes[mode] - payload) / messages, 100.0 * bytes[mode] / bytes[MQTT_311] - 100);
+}
+
+int main(int argc, char *argv[])
+{
+	int aliases = bench_arg(argc, argv, 1, 64);
+	int qos = bench_arg(argc, argv, 2, 0);
+	const char *path = argc > 3 ? argv[3] : BENCH_CORPUS;
+	static char lines[BENCH_LINES_MAX][BENCH_LINE_LEN];
+	int count;
+
+	if (aliases > BENCH_DEVICES_MAX)
+		aliases = BENCH_DEVICES_MAX;
+	count = bench_corpus(path, lines);
+	printf("%d broker aliases, qos %d, %d payloads\n", aliases, qos, count);
+	printf("%8s %-12s %10s %10s %9s\n", "devices", "mqtt", "bytes/msg", "overhead", "vs 3.1.1");
+	run(10, aliases, qos, lines, count);
+	run(64, aliases, qos, lines, count);
+	run(200, aliases, qos, lines, count);
+	return 0;
+}
@@ -25,14 +25,19 @@
 #include "bridge.h"
 #include "mqtt_bridge.h"
 #include "utils.h"
+#include "serial.h"
+#include "frame.h"
 
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include <ctype.h>
 
-int bridge_init(struct bridge_t *bridge, char *uuid)
+int bridge_init(struct bridge_t *bridge, char *uuid, struct bridge_serial *serial, int serial_count)
 {
+	struct bridge_port *port;
+	int i;
+
 	bridge->uuid = strdup(uuid);
 	if (!bridge->uuid) {
 		fprintf(stderr, "Error: No memory left.\n");
@@ -40,91 +45,367 @@ int bridge_init(struct bridge_t *bridge, char *uuid)
 	}
 	bridge->devices = 0;
 	bridge->device_list = NULL;
-	bridge->serial_ready = 0;
-	bridge->serial_alive = 0;
-	bridge->serial_uuid = NULL;
+	bridge->device_free = NULL;
+	bridge->device_blocks = NULL;
+	bridge->device_block_count = 0;
+	bridge->id_count = 0;
+	bridge->dirty = false;
+	wheel_init(&bridge->wheel, 0);
+	bridge->table_size = BRIDGE_TABLE_MIN;
+	bridge->by_uuid = calloc(bridge->table_size, sizeof(struct bridge_slot));
+	bridge->by_id = calloc(bridge->table_size, sizeof(struct bridge_slot));
+	if (!bridge->by_uuid || !bridge->by_id) {
+		fprintf(stderr, "Error: No memory left.\n");
+		exit(1);
+	}
+
+	bridge->port_count = serial_count;
+	bridge->ports = NULL;
+	if (serial_count) {
+		bridge->ports = calloc(serial_count, sizeof(struct bridge_port));
+		if (!bridge->ports) {
+			fprintf(stderr, "Error: No memory left.\n");
+			exit(1);
+		}
+	}
+	for (i = 0; i < serial_count; i++) {
+		port = &bridge->ports[i];
+		port->index = i;
+		port->serial = &serial[i];
+		port->sd = -1;
+		port->serial_ready = 0;
+		port->serial_alive = 0;
+		port->serial_uuid = NULL;
+		port->ev.fd = -1;
+		port->tx_ev.fd = -1;
+		port->tx_armed = false;
+		port->uuid_request = 0;
+		port->framing = SERIAL_FRAMING_TEXT;
+		port->binary_offered = false;
+		port->reader = NULL;
+		port->bad_frames = 0;
+		port->bad_json = 0;
+		port->bad_comma = 0;
+		port->frame = malloc(port->serial->max_frame + 1);
+		port->scratch = malloc(FRAME_ENCODED_MAX(port->serial->max_frame) + 1);
+		if (!port->frame || !port->scratch || serialport_rx_alloc(&port->rx, FRAME_ENCODED_MAX(port->serial->max_frame) + 1)) {
+			fprintf(stderr, "Error: No memory left.\n");
+			exit(1);
+		}
+		serialport_txq_init(&port->txq, serial[i].pacing);
+	}
 
 	return 0;
 }
 
-struct device_t* bridge_add_device(struct bridge_t *bridge, char *uuid) {
-	struct device_t *device;
+static uint32_t bridge_hash_uuid(const uint8_t *uuid)
+{
+	uint64_t h, w;
+	int i;
 
-	if ((device = malloc(sizeof(struct device_t))) == NULL) {
-		fprintf(stderr, "No memory left.\n");
-		exit(1);
+	// Time based uuids share most of their bytes, mix both halves in
+	for (h = 0, i = 0; i < DEVICE_UUID_BIN; i += 8) {
+		memcpy(&w, &uuid[i], 8);
+		h ^= w;
+		h *= 0xff51afd7ed558ccdULL;
+		h ^= h >> 33;
+	}
+	return (uint32_t)h;
+}
+
+static uint32_t bridge_hash_id(int port, int id)
+{
+	uint64_t h = ((uint64_t)(uint32_t)port << 32) | (uint32_t)id;
+
+	h *= 0x9e3779b97f4a7c15ULL;
+	return (uint32_t)(h >> 32);
+}
+
+static struct bridge_slot *bridge_table_find_uuid(struct bridge_t *bridge, struct bridge_slot *table, const uint8_t *uuid, uint32_t hash)
+{
+	unsigned int mask = bridge->table_size - 1;
+	unsigned int i;
+
+	for (i = hash & mask; table[i].device; i = (i + 1) & mask) {
+		if (table[i].hash == hash && !memcmp(table[i].device->uuid_bin, uuid, DEVICE_UUID_BIN))
+			return &table[i];
+	}
+	return &table[i];		// Empty slot where it would go
+}
+
+static struct bridge_slot *bridge_table_find_id(struct bridge_t *bridge, struct bridge_slot *table, int port, int id, uint32_t hash)
+{
+	unsigned int mask = bridge->table_size - 1;
+	unsigned int i;
+
+	for (i = hash & mask; table[i].device; i = (i + 1) & mask) {
+		if (table[i].hash == hash && table[i].device->id == id && table[i].device->port->index == port)
+			return &table[i];
+	}
+	return &table[i];
+}
+
+// Backward shift deletion, keeps probe chains intact without tombstones
+static void bridge_table_remove(struct bridge_t *bridge, struct bridge_slot *table, struct bridge_slot *slot)
+{
+	unsigned int mask = bridge->table_size - 1;
+	unsigned int i, j, home;
+
+	i = slot - table;
+	j = i;
+	for (;;) {
+		j = (j + 1) & mask;
+		if (!table[j].device)
+			break;
+		home = table[j].hash & mask;
+		// Move j back into the hole at i unless its home lies in (i, j]
+		if ((j > i && (home <= i || home > j)) || (j < i && (home <= i && home > j))) {
+			table[i] = table[j];
+			i = j;
+		}
 	}
+	table[i].device = NULL;
+	table[i].hash = 0;
+}
+
+static void bridge_table_grow(struct bridge_t *bridge)
+{
+	struct bridge_slot *by_uuid, *by_id, *old_uuid, *old_id;
+	unsigned int old_size, i;
+
+	old_size = bridge->table_size;
+	old_uuid = bridge->by_uuid;
+	old_id = bridge->by_id;
 
-	device->uuid = strdup(uuid);
-	if (!device->uuid) {
+	by_uuid = calloc(old_size * 2, sizeof(struct bridge_slot));
+	by_id = calloc(old_size * 2, sizeof(struct bridge_slot));
+	if (!by_uuid || !by_id) {
 		fprintf(stderr, "Error: No memory left.\n");
 		exit(1);
 	}
+	bridge->by_uuid = by_uuid;
+	bridge->by_id = by_id;
+	bridge->table_size = old_size * 2;
+
+	for (i = 0; i < old_size; i++) {
+		if (old_uuid[i].device)
+			*bridge_table_find_uuid(bridge, by_uuid, old_uuid[i].device->uuid_bin, old_uuid[i].hash) = old_uuid[i];
+		if (old_id[i].device)
+			*bridge_table_find_id(bridge, by_id, old_id[i].device->port->index, old_id[i].device->id, old_id[i].hash) = old_id[i];
+	}
+	free(old_uuid);
+	free(old_id);
+}
+
+// Renders the publish topic and the serial prefixes, so the message paths
+// don't format anything
+static void bridge_render_device(struct device_t *device)
+{
+	if (device->server_id != 0)
+		snprintf(device->topic, DEVICE_TOPIC_LEN, "%d", device->server_id);
+	else
+		snprintf(device->topic, DEVICE_TOPIC_LEN, "b/%s", device->uuid);
+	device->alias_known = false;		// The alias is sent again, with the new topic
+
+	if (device->id == 0) {
+		device->json_prefix_len = snprintf(device->json_prefix, DEVICE_PREFIX_LEN, "%s", SERIAL_SINGLE_JSON_STR);
+		device->comma_prefix_len = snprintf(device->comma_prefix, DEVICE_PREFIX_LEN, "%s", SERIAL_SINGLE_COMMA_STR);
+	} else {
+		device->json_prefix_len = snprintf(device->json_prefix, DEVICE_PREFIX_LEN, "%s%d", SERIAL_MULTI_JSON_STR, device->id);
+		device->comma_prefix_len = snprintf(device->comma_prefix, DEVICE_PREFIX_LEN, "%s%d", SERIAL_MULTI_COMMA_STR, device->id);
+	}
+}
+
+static struct device_t *bridge_alloc_device(struct bridge_t *bridge)
+{
+	struct device_t *device, *block, **blocks;
+	int i;
+
+	if (!bridge->device_free) {
+		blocks = realloc(bridge->device_blocks, (bridge->device_block_count + 1) * sizeof(struct device_t *));
+		block = malloc(BRIDGE_DEVICE_BLOCK * sizeof(struct device_t));
+		if (!blocks || !block) {
+			fprintf(stderr, "No memory left.\n");
+			exit(1);
+		}
+		bridge->device_blocks = blocks;
+		bridge->device_blocks[bridge->device_block_count++] = block;
+
+		for (i = BRIDGE_DEVICE_BLOCK - 1; i >= 0; i--) {
+			block[i].next = bridge->device_free;
+			bridge->device_free = &block[i];
+		}
+	}
+
+	device = bridge->device_free;
+	bridge->device_free = device->next;
+	return device;
+}
+
+struct device_t* bridge_add_device(struct bridge_t *bridge, struct bridge_port *port, char *uuid) {
+	struct device_t *device;
+	struct bridge_slot *slot;
+	uint8_t uuid_bin[DEVICE_UUID_BIN];
+
+	if (!bridge_parse_uuid(uuid, uuid_bin)) {
+		fprintf(stderr, "Error: Invalid device uuid.\n");
+		return NULL;
+	}
+
+	if ((unsigned int)(bridge->devices + 1) * 2 > bridge->table_size)
+		bridge_table_grow(bridge);
+
+	device = bridge_alloc_device(bridge);
+	memcpy(device->uuid_bin, uuid_bin, DEVICE_UUID_BIN);
+	memcpy(device->uuid, uuid, DEVICE_UUID_LEN);
+	device->uuid[DEVICE_UUID_LEN] = 0;
 
 	device->id = 0;
 	device->server_id = 0;
-	device->alive = BRIDGE_ALIVE_CNT;
+	device->alias = 0;					// Not the alias of the device this slot held
+	bridge_render_device(device);
+	device->batch = NULL;
+	device->filter = NULL;
+	device->queued = 0;
+	wheel_timer_init(&device->alive);
+	bridge_touch_device(bridge, device);
+	device->port = port;
+	device->prev = NULL;
 	device->next = bridge->device_list;
+	if (device->next)
+		device->next->prev = device;
 	bridge->device_list = device;
 	bridge->devices++;
+	bridge->dirty = true;
+
+	slot = bridge_table_find_uuid(bridge, bridge->by_uuid, uuid_bin, bridge_hash_uuid(uuid_bin));
+	slot->hash = bridge_hash_uuid(uuid_bin);
+	slot->device = device;
 
 	return device;
 }
 
 struct device_t* bridge_get_device(struct bridge_t *bridge, char *uuid)
 {
-	struct device_t *device;
+	uint8_t uuid_bin[DEVICE_UUID_BIN];
 
-	for (device = bridge->device_list; device != NULL; device = device->next) {
-		if (!strcmp(device->uuid, uuid))
-			return device;
-	}
-	return NULL;
+	if (!bridge_parse_uuid(uuid, uuid_bin))
+		return NULL;
+
+	return bridge_table_find_uuid(bridge, bridge->by_uuid, uuid_bin, bridge_hash_uuid(uuid_bin))->device;
 }
 
-struct device_t *bridge_get_device_by_id(struct bridge_t *bridge, int id)
+struct device_t *bridge_get_device_by_id(struct bridge_t *bridge, struct bridge_port *port, int id)
 {
-	struct device_t *device;
+	if (id == 0)
+		return NULL;
 
-	for (device = bridge->device_list; device != NULL; device = device->next) {
-		if (device->id == id)
-			return device;
+	return bridge_table_find_id(bridge, bridge->by_id, port->index, id, bridge_hash_id(port->index, id))->device;
+}
+
+// Sets the multi-drop id of the device on its port, replacing any device
+// that held it before
+void bridge_set_device_id(struct bridge_t *bridge, struct device_t *device, int id)
+{
+	struct bridge_slot *slot;
+	uint32_t hash;
+
+	if (device->id == id)
+		return;
+
+	if (device->id != 0) {
+		slot = bridge_table_find_id(bridge, bridge->by_id, device->port->index, device->id, bridge_hash_id(device->port->index, device->id));
+		if (slot->device == device) {
+			bridge_table_remove(bridge, bridge->by_id, slot);
+			bridge->id_count--;
+		}
+	}
+
+	device->id = id;
+	bridge_render_device(device);
+	bridge->dirty = true;
+	if (id == 0)
+		return;
+
+	hash = bridge_hash_id(device->port->index, id);
+	slot = bridge_table_find_id(bridge, bridge->by_id, device->port->index, id, hash);
+	if (slot->device) {
+		slot->device->id = 0;		// Stale owner of the id
+		bridge_render_device(slot->device);
+	} else {
+		bridge->id_count++;
 	}
-	return NULL;
+	slot->hash = hash;
+	slot->device = device;
+}
+
+void bridge_set_device_server_id(struct bridge_t *bridge, struct device_t *device, int server_id)
+{
+	if (device->server_id == server_id)
+		return;
+
+	device->server_id = server_id;
+	bridge_render_device(device);		// Not in the registry, reset on every connect
+}
+
+// Moves the device to another port, its multi-drop id doesn't follow it
+void bridge_set_device_port(struct bridge_t *bridge, struct device_t *device, struct bridge_port *port)
+{
+	if (device->port == port)
+		return;
+
+	bridge_set_device_id(bridge, device, 0);
+	device->port = port;
+	bridge->dirty = true;
+}
+
+// Pushes the device timeout BRIDGE_ALIVE_CNT seconds ahead
+void bridge_touch_device(struct bridge_t *bridge, struct device_t *device)
+{
+	wheel_add(&bridge->wheel, &device->alive, bridge->wheel.now + BRIDGE_ALIVE_CNT);
 }
 
 int bridge_remove_device(struct bridge_t *bridge, char *uuid)
 {
-	struct device_t *prev_device, *device;
+	struct device_t *device;
+	struct bridge_slot *slot;
+	uint8_t uuid_bin[DEVICE_UUID_BIN];
 
-	for (prev_device = device = bridge->device_list; device != NULL; device = device->next) {
-		if (strcmp(device->uuid, uuid)) {
-			prev_device = device;
-			continue;
-		}
+	if (!bridge_parse_uuid(uuid, uuid_bin))
+		return 0;
 
-		if (!strcmp(bridge->serial_uuid, uuid)) {
-			free(bridge->serial_uuid);
-			bridge->serial_uuid = NULL;
-		}
+	slot = bridge_table_find_uuid(bridge, bridge->by_uuid, uuid_bin, bridge_hash_uuid(uuid_bin));
+	device = slot->device;
+	if (!device)
+		return 0;
 
-		if (!strcmp(device->uuid, prev_device->uuid)) {		// First of the list
-			bridge->device_list = device->next;
-		} else {
-			prev_device->next = device->next;
-		}
-		bridge->devices--;
-		free(device->uuid);
-		free(device);
-		return 1;
+	if (device->port->serial_uuid && !strcmp(device->port->serial_uuid, device->uuid)) {
+		free(device->port->serial_uuid);
+		device->port->serial_uuid = NULL;
 	}
-	return 0;
+
+	wheel_del(&device->alive);
+	bridge_set_device_id(bridge, device, 0);
+	bridge_table_remove(bridge, bridge->by_uuid, slot);
+
+	if (device->prev)
+		device->prev->next = device->next;
+	else
+		bridge->device_list = device->next;
+	if (device->next)
+		device->next->prev = device->prev;
+	bridge->devices--;
+	bridge->dirty = true;
+
+	device->next = bridge->device_free;
+	bridge->device_free = device;
+	return 1;
 }
 
-void bridge_print_device(struct device_t *device)
+void bridge_print_device(struct bridge_t *bridge, struct device_t *device)
 {
-	printf("       uuid: %s\n       id: %d\n       alive: %d\n",
-		device->uuid, device->id, device->alive);
+	printf("       uuid: %s\n       id: %d\n       alive: %ld\n",
+		device->uuid, device->id, (long)(device->alive.expires - bridge->wheel.now));
 }
 
 void bridge_print_devices(struct bridge_t *bridge)
@@ -134,7 +415,7 @@ void bridge_print_devices(struct bridge_t *bridge)
 	printf("Devices:\n");
 	
 	for (device = bridge->device_list; device != NULL; device = device->next) {
-		bridge_print_device(device);
+		bridge_print_device(bridge, device);
 	}
 }
 
@@ -161,3 +442,41 @@ int bridge_isValid_uuid(char *uuid)
 
 	return 1;
 }
+
+// Value of a hex digit, -1 for anything else
+static inline int bridge_hex(unsigned char c)
+{
+	if ((unsigned char)(c - '0') < 10)
+		return c - '0';
+	c |= 0x20;
+	if ((unsigned char)(c - 'a') < 6)
+		return c - 'a' + 10;
+	return -1;
+}
+
+// Parses the 36 chars uuid into its 16 bytes
+// returns 1 on success, 0 for an invalid uuid
+int bridge_parse_uuid(const char *uuid, uint8_t *bin)
+{
+	// Where each byte starts in "xxxxxxxx-xxxx-xxxx-xxxx-xxxxxxxxxxxx"
+	static const uint8_t pos[DEVICE_UUID_BIN] = { 0, 2, 4, 6, 9, 11, 14, 16, 19, 21, 24, 26, 28, 30, 32, 34 };
+	int i, hi, lo;
+
+	if (uuid == NULL)
+		return 0;
+
+	// In order, so a short string stops at its terminator
+	for (i = 0; i < DEVICE_UUID_BIN; i++) {
+		if (i && pos[i] != pos[i - 1] + 2 && uuid[pos[i] - 1] != '-')
+			return 0;
+		hi = bridge_hex(uuid[pos[i]]);
+		if (hi < 0)
+			return 0;
+		lo = bridge_hex(uuid[pos[i] + 1]);
+		if (lo < 0)
+			return 0;
+		bin[i] = hi << 4 | lo;
+	}
+
+	return uuid[DEVICE_UUID_LEN] == 0;
+}
@@ -27,26 +27,76 @@
 
 #include <stdbool.h>
 #include "device.h"
+#include "mqtt_bridge.h"
+#include "arduino-serial-lib.h"
+#include "event.h"
+#include "wheel.h"
+
+struct pipeline_reader;
 
 #define BRIDGE_ALIVE_CNT 360				// 6 minutes
 #define MAIN_TOPIC "0"
 
-struct bridge_t {
-	char *uuid;
+struct bridge_port {
+	int index;
+	struct bridge_serial *serial;		// Port configuration
+	int sd;
 	bool serial_ready;
 	int serial_alive;
-	char *serial_uuid;
+	char *serial_uuid;					// Single device attached to this port
+	struct serialport_rx rx;
+	char *frame;						// Decoded input, serial->max_frame + 1 bytes
+	char *scratch;						// Encoded binary frame
+	struct event_t ev;
+	struct serialport_txq txq;			// Outbound lines, paced by tx_ev
+	struct event_t tx_ev;
+	bool tx_armed;
+	int uuid_request;					// Multi-drop id whose uuid was asked for with @U#<id>
+	int framing;						// SERIAL_FRAMING_* in use, text until agreed
+	bool binary_offered;				// Waiting for the board to answer our @B#
+	unsigned long bad_frames;
+	unsigned long bad_json;				// Device frames that failed validation
+	unsigned long bad_comma;			// Comma frames that failed to parse
+	struct pipeline_reader *reader;		// Reader thread in pipeline mode
+};
+
+#define BRIDGE_DEVICE_BLOCK 64			// Devices allocated together
+#define BRIDGE_TABLE_MIN 16
+
+struct bridge_slot {
+	uint32_t hash;
+	struct device_t *device;
+};
+
+struct bridge_t {
+	char *uuid;
+	int port_count;
+	struct bridge_port *ports;
 	int devices;
-	struct device_t *device_list;
+	struct device_t *device_list;		// Live devices, for iteration
+	struct device_t *device_free;
+	struct device_t **device_blocks;
+	int device_block_count;
+	unsigned int table_size;			// Power of two, at most half full
+	struct bridge_slot *by_uuid;		// Open addressing, linear probing
+	struct bridge_slot *by_id;			// Keyed by port and multi-drop id
+	int id_count;
+	bool dirty;							// Devices changed since the last registry snapshot
+	struct wheel_t wheel;				// Device timeouts, one tick per second
 };
 
-int bridge_init(struct bridge_t *, char *);
-struct device_t *bridge_add_device(struct bridge_t *, char *);
+int bridge_init(struct bridge_t *, char *, struct bridge_serial *, int);
+struct device_t *bridge_add_device(struct bridge_t *, struct bridge_port *, char *);
 struct device_t *bridge_get_device(struct bridge_t *, char *);
-struct device_t *bridge_get_device_by_id(struct bridge_t *, int);
+struct device_t *bridge_get_device_by_id(struct bridge_t *, struct bridge_port *, int);
+void bridge_set_device_id(struct bridge_t *, struct device_t *, int);
+void bridge_set_device_server_id(struct bridge_t *, struct device_t *, int);
+void bridge_set_device_port(struct bridge_t *, struct device_t *, struct bridge_port *);
+void bridge_touch_device(struct bridge_t *, struct device_t *);
 int bridge_remove_device(struct bridge_t *, char *);
-void bridge_print_device(struct device_t *);
+void bridge_print_device(struct bridge_t *, struct device_t *);
 void bridge_print_devices(struct bridge_t *);
 int bridge_isValid_uuid(char *);
+int bridge_parse_uuid(const char *, uint8_t *);
 
 #endif
@@ -31,8 +31,18 @@
 #include <limits.h>
 #include <ctype.h>
 #include "cJSON.h"
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#if defined(__GNUC__)
+#include <immintrin.h>
+#define CJSON_AVX2	/* Built for SSE2, AVX2 taken when the CPU has it */
+#endif
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
 
 static const char *ep;
+static const char *pe;	/* End of the text being parsed, for the block scans. */
 
 const char *cJSON_GetErrorPtr(void) {return ep;}
 
@@ -43,9 +53,64 @@ static int cJSON_strcasecmp(const char *s1,const char *s2)
 	return tolower(*(const unsigned char *)s1) - tolower(*(const unsigned char *)s2);
 }
 
+static int cJSON_strcmp(const char *s1,const char *s2)
+{
+	if (!s1 || !s2) return s1!=s2;
+	return strcmp(s1,s2);
+}
+
 static void *(*cJSON_malloc)(size_t sz) = malloc;
 static void (*cJSON_free)(void *ptr) = free;
 
+/* Open addressing, linear probing. Children sharing a hash sit in the order they came in. */
+typedef struct cJSON_Index {
+	unsigned mask;
+	struct { unsigned hash; cJSON *item; } slot[];
+} cJSON_Index;
+
+static int cJSON_index_min=0;
+
+void cJSON_IndexObjects(int min) {cJSON_index_min=min;}
+
+/* FNV-1a of the lowercased key, case insensitive lookups use the index too. */
+static unsigned cJSON_hash(const char *s)
+{
+	unsigned h=2166136261u;
+	if (!s) return h;
+	for (;*s;s++) h=(h^(unsigned char)(*s>='A' && *s<='Z' ? *s+32 : *s))*16777619u;	/* tolower() in the C locale */
+	return h;
+}
+
+static void cJSON_BuildIndex(cJSON *object,int count)
+{
+	cJSON_Index *index;cJSON *c;unsigned size=4,i,h;
+	while (size<2*(unsigned)count) size<<=1;
+	index=(cJSON_Index*)cJSON_malloc(sizeof(cJSON_Index)+size*sizeof(index->slot[0]));
+	if (!index) return;		/* Lookups walk the list instead */
+	memset(index->slot,0,size*sizeof(index->slot[0]));
+	index->mask=size-1;
+	for (c=object->child;c;c=c->next)
+	{
+		h=cJSON_hash(c->string);
+		for (i=h&index->mask;index->slot[i].item;i=(i+1)&index->mask);
+		index->slot[i].hash=h;index->slot[i].item=c;
+	}
+	object->index=index;
+}
+
+static void cJSON_DropIndex(cJSON *object) {if (object->index) {cJSON_free(object->index);object->index=0;}}
+
+/* First child named string, as cmp has it. */
+static cJSON *cJSON_Lookup(cJSON *object,const char *string,int (*cmp)(const char *,const char *))
+{
+	cJSON_Index *index=object->index;cJSON *c;unsigned h,i;
+	if (!index) {c=object->child;while (c && cmp(c->string,string)) c=c->next;return c;}
+	h=cJSON_hash(string);
+	for (i=h&index->mask;(c=index->slot[i].item);i=(i+1)&index->mask)
+		if (index->slot[i].hash==h && !cmp(c->string,string)) return c;
+	return 0;
+}
+
 static char* cJSON_strdup(const char* str)
 {
       size_t len;
@@ -87,54 +152,110 @@ void cJSON_Delete(cJSON *c)
 		if (!(c->type&cJSON_IsReference) && c->child) cJSON_Delete(c->child);
 		if (!(c->type&cJSON_IsReference) && c->valuestring) cJSON_free(c->valuestring);
 		if (c->string) cJSON_free(c->string);
+		if (c->index) cJSON_free(c->index);
 		cJSON_free(c);
 		c=next;
 	}
 }
 
-/* Parse the input text to generate a number, and populate the result into item. */
+void cJSON_Free(void *ptr)
+{
+	cJSON_free(ptr);
+}
+
+/* Powers of ten that are exact doubles. */
+static const double cJSON_pow10[]={1e0,1e1,1e2,1e3,1e4,1e5,1e6,1e7,1e8,1e9,1e10,1e11,
+	1e12,1e13,1e14,1e15,1e16,1e17,1e18,1e19,1e20,1e21,1e22};
+#define CJSON_EXACT_MAX 9007199254740992.0	/* 2^53, integers up to it are exact doubles */
+
+/* Parse the input text to generate a number, and populate the result into item.
+   Up to 19 digits and exponents within +-22 take one exact multiply or divide of
+   a mantissa up to 2^53, the rest goes through strtod(). Both round correctly. */
 static const char *parse_number(cJSON *item,const char *num)
 {
-	double n=0,sign=1,scale=0;int subscale=0,signsubscale=1;
+	const char *start=num;double n;unsigned long long m=0;
+	int digits=0,scale=0,subscale=0,signsubscale=1,sign=1,exact=1;
 
 	if (*num=='-') sign=-1,num++;	/* Has sign? */
 	if (*num=='0') num++;			/* is zero */
-	if (*num>='1' && *num<='9')	do	n=(n*10.0)+(*num++ -'0');	while (*num>='0' && *num<='9');	/* Number? */
-	if (*num=='.' && num[1]>='0' && num[1]<='9') {num++;		do	n=(n*10.0)+(*num++ -'0'),scale--; while (*num>='0' && *num<='9');}	/* Fractional part? */
+	if (*num>='1' && *num<='9')	do	{if (digits<19) m=m*10+(*num-'0'),digits++; else exact=0,scale++;} while (*++num>='0' && *num<='9');	/* Number? */
+	if (*num=='.' && num[1]>='0' && num[1]<='9') {num++;		do	{if (digits<19) m=m*10+(*num-'0'),digits+=(m!=0),scale--; else if (*num!='0') exact=0;} while (*++num>='0' && *num<='9');}	/* Fractional part? */
 	if (*num=='e' || *num=='E')		/* Exponent? */
 	{	num++;if (*num=='+') num++;	else if (*num=='-') signsubscale=-1,num++;		/* With sign? */
-		while (*num>='0' && *num<='9') subscale=(subscale*10)+(*num++ - '0');	/* Number? */
+		while (*num>='0' && *num<='9') {if (subscale<100000) subscale=(subscale*10)+(*num-'0'); num++;}	/* Number? */
 	}
+	scale+=subscale*signsubscale;
+
+	if (exact && m<=CJSON_EXACT_MAX && scale>=-22 && scale<=22)
+		n=sign*(scale<0 ? (double)m/cJSON_pow10[-scale] : (double)m*cJSON_pow10[scale]);
+	else
+		n=strtod(start,0);
 
-	n=sign*n*pow(10.0,(scale+subscale*signsubscale));	/* number = +/- number.fraction * 10^+/- exponent */
-	
 	item->valuedouble=n;
 	item->valueint=(int)n;
 	item->type=cJSON_Number;
 	return num;
 }
 
-/* Render the number nicely from the given item into a string. */
-static char *print_number(cJSON *item)
+/* Writes d into buf, at least CJSON_NUMBER_LEN bytes, and returns the length. The
+   shortest text that reads back as the same double: integers as such, then the
+   fewest decimals that round trip, then %g with 15 to 17 digits. */
+#define CJSON_NUMBER_LEN 32
+static int print_double(double d,char *buf)
 {
-	char *str;
-	double d=item->valuedouble;
-	if (fabs(((double)item->valueint)-d)<=DBL_EPSILON && d<=INT_MAX && d>=INT_MIN)
+	char digits[24],*p=buf;unsigned long long u;double r;int i,len,prec;
+
+	if (d!=d || d-d!=0) {memcpy(buf,"null",5);return 4;}	/* NaN and infinities aren't JSON */
+	for (i=0;i<=15;i++)
 	{
-		str=(char*)cJSON_malloc(21);	/* 2^64+1 can be represented in 21 chars. */
-		if (str) sprintf(str,"%d",item->valueint);
+		r=d*cJSON_pow10[i];
+		if (fabs(r)>=CJSON_EXACT_MAX) break;
+		r=floor(r+0.5);
+		if (r/cJSON_pow10[i]!=d) continue;
+		if (r<0) *p++='-',r=-r;
+		u=(unsigned long long)r;len=0;
+		do digits[len++]='0'+u%10,u/=10; while (u || len<=i);
+		while (len>i) *p++=digits[--len];
+		if (i) {*p++='.';while (len) *p++=digits[--len];}
+		*p=0;
+		return p-buf;
 	}
-	else
+	for (prec=15;prec<17;prec++)
 	{
-		str=(char*)cJSON_malloc(64);	/* This is a nice tradeoff. */
-		if (str)
-		{
-			if (fabs(floor(d)-d)<=DBL_EPSILON && fabs(d)<1.0e60)sprintf(str,"%.0f",d);
-			else if (fabs(d)<1.0e-6 || fabs(d)>1.0e9)			sprintf(str,"%e",d);
-			else												sprintf(str,"%f",d);
-		}
+		len=snprintf(buf,CJSON_NUMBER_LEN,"%.*g",prec,d);
+		if (strtod(buf,0)==d) return len;
 	}
-	return str;
+	return snprintf(buf,CJSON_NUMBER_LEN,"%.17g",d);
+}
+
+/* Output for the printer: grows through the hooks, or fails once a fixed buffer is full. */
+typedef struct {char *buffer;int length,offset,fixed,fail;} printbuffer;
+
+/* Room for needed more bytes and the terminator at p->offset, or 0 with p->fail set. */
+static char *ensure(printbuffer *p,int needed)
+{
+	char *newbuffer;int newsize;
+	if (p->fail) return 0;
+	needed+=p->offset+1;
+	if (needed<=p->length) return p->buffer+p->offset;
+	if (p->fixed) {p->fail=1;return 0;}
+	newsize=p->length>0?p->length:64;
+	while (newsize<needed) newsize*=2;
+	newbuffer=(char*)cJSON_malloc(newsize);
+	if (!newbuffer) {p->fail=1;return 0;}
+	if (p->offset) memcpy(newbuffer,p->buffer,p->offset);
+	if (p->buffer) cJSON_free(p->buffer);
+	p->buffer=newbuffer;p->length=newsize;
+	return p->buffer+p->offset;
+}
+static void print_put(printbuffer *p,const char *str,int len)	{char *out=ensure(p,len);if (out) {memcpy(out,str,len);p->offset+=len;}}
+static void print_tabs(printbuffer *p,int depth)				{char *out=ensure(p,depth);if (out && depth>0) {memset(out,'\t',depth);p->offset+=depth;}}
+
+/* Render the number nicely from the given item. */
+static void print_number(cJSON *item,printbuffer *p)
+{
+	char buf[CJSON_NUMBER_LEN];
+	print_put(p,buf,print_double(item->valuedouble,buf));
 }
 
 static unsigned parse_hex4(const char *str)
@@ -150,14 +271,76 @@ static unsigned parse_hex4(const char *str)
 	return h;
 }
 
+/* Bytes from s, before end, that are neither a quote, a backslash nor a control character (NUL included).
+   32 at a time with AVX2, picked at run time, 16 with SSE2 or NEON, a word of 8 otherwise; never reads at or past end. */
+static size_t scan_plain(const char *s,const char *end);
+
+#if defined(CJSON_AVX2)
+__attribute__((target("avx2"))) static size_t scan_plain_avx2(const char *s,const char *end)
+{
+	const char *p=s;
+	const __m256i quote=_mm256_set1_epi8('\"'),slash=_mm256_set1_epi8('\\'),high=_mm256_set1_epi8((char)0xE0),zero=_mm256_setzero_si256();
+	__m256i v;unsigned int mask;
+	for (;end-p>=32;p+=32)
+	{
+		v=_mm256_loadu_si256((const __m256i*)p);
+		mask=(unsigned int)_mm256_movemask_epi8(_mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v,quote),_mm256_cmpeq_epi8(v,slash)),_mm256_cmpeq_epi8(_mm256_and_si256(v,high),zero)));
+		if (mask) return p-s+__builtin_ctz(mask);
+	}
+	return p-s+scan_plain(p,end);	/* The tail, under 32 bytes */
+}
+#endif
+
+static size_t scan_plain(const char *s,const char *end)
+{
+	const char *p=s;
+#if defined(CJSON_AVX2)
+	if (end-p>=32 && __builtin_cpu_supports("avx2")) return scan_plain_avx2(s,end);
+#endif
+#if defined(__SSE2__)
+	const __m128i quote=_mm_set1_epi8('\"'),slash=_mm_set1_epi8('\\'),high=_mm_set1_epi8((char)0xE0),zero=_mm_setzero_si128();
+	__m128i v;int mask;
+	for (;end-p>=16;p+=16)
+	{
+		v=_mm_loadu_si128((const __m128i*)p);
+		mask=_mm_movemask_epi8(_mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v,quote),_mm_cmpeq_epi8(v,slash)),_mm_cmpeq_epi8(_mm_and_si128(v,high),zero)));
+		if (mask) return p-s+__builtin_ctz(mask);
+	}
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+	const uint8x16_t quote=vdupq_n_u8('\"'),slash=vdupq_n_u8('\\'),space=vdupq_n_u8(32);
+	uint8x16_t v;
+	for (;end-p>=16;p+=16)
+	{
+		v=vld1q_u8((const uint8_t*)p);
+		if (vmaxvq_u8(vorrq_u8(vorrq_u8(vceqq_u8(v,quote),vceqq_u8(v,slash)),vcltq_u8(v,space)))) break;
+	}
+#else
+	const unsigned long long ones=0x0101010101010101ULL,highs=0x8080808080808080ULL;
+	unsigned long long w;
+	for (;end-p>=8;p+=8)
+	{
+		memcpy(&w,p,8);	/* a byte is flagged when it borrows: zero after the xor, or below 32 */
+		if ((((w^(ones*'\"'))-ones) | ((w^(ones*'\\'))-ones) | (w-ones*32)) & ~w & highs) break;
+	}
+#endif
+	while (p<end && (unsigned char)*p>31 && *p!='\"' && *p!='\\') p++;
+	return p-s;
+}
+
 /* Parse the input text into an unescaped cstring, and populate item. */
 static const unsigned char firstByteMark[7] = { 0x00, 0x00, 0xC0, 0xE0, 0xF0, 0xF8, 0xFC };
 static const char *parse_string(cJSON *item,const char *str)
 {
-	const char *ptr=str+1;char *ptr2;char *out;int len=0;unsigned uc,uc2;
+	const char *ptr=str+1;char *ptr2;char *out;int len=0;size_t n;unsigned uc,uc2;
 	if (*str!='\"') {ep=str;return 0;}	/* not a string! */
 	
-	while (*ptr!='\"' && *ptr && ++len) if (*ptr++ == '\\') ptr++;	/* Skip escaped quotes. */
+	for (;;)
+	{
+		n=scan_plain(ptr,pe);ptr+=n;len+=n;
+		if (*ptr=='\"' || !*ptr) break;
+		if (*ptr++ == '\\' && *ptr) ptr++;	/* Skip escaped quotes. */
+		len++;
+	}
 	
 	out=(char*)cJSON_malloc(len+1);	/* This is how long we need for the string, roughly. */
 	if (!out) return 0;
@@ -165,10 +348,13 @@ static const char *parse_string(cJSON *item,const char *str)
 	ptr=str+1;ptr2=out;
 	while (*ptr!='\"' && *ptr)
 	{
+		n=scan_plain(ptr,pe);memcpy(ptr2,ptr,n);ptr+=n;ptr2+=n;
+		if (*ptr=='\"' || !*ptr) break;
 		if (*ptr!='\\') *ptr2++=*ptr++;
 		else
 		{
 			ptr++;
+			if (!*ptr) break;	/* a backslash ending the text */
 			switch (*ptr)
 			{
 				case 'b': *ptr2++='\b';	break;
@@ -212,22 +398,24 @@ static const char *parse_string(cJSON *item,const char *str)
 }
 
 /* Render the cstring provided to an escaped version that can be printed. */
-static char *print_string_ptr(const char *str)
+static void print_string_ptr(const char *str,printbuffer *p)
 {
-	const char *ptr;char *ptr2,*out;int len=0;unsigned char token;
+	const char *ptr,*end;char *ptr2;int len;size_t n;unsigned char token;
 	
-	if (!str) return cJSON_strdup("");
-	ptr=str;while ((token=*ptr) && ++len) {if (strchr("\"\\\b\f\n\r\t",token)) len++; else if (token<32) len+=5;ptr++;}
+	if (!str) str="";
+	end=str+strlen(str);len=end-str;
+	for (ptr=str;(ptr+=scan_plain(ptr,end))<end;ptr++) {token=*ptr;if (strchr("\"\\\b\f\n\r\t",token)) len++; else len+=5;}
 	
-	out=(char*)cJSON_malloc(len+3);
-	if (!out) return 0;
+	ptr2=ensure(p,len+2);
+	if (!ptr2) return;
+	p->offset+=len+2;
 
-	ptr2=out;ptr=str;
+	ptr=str;
 	*ptr2++='\"';
-	while (*ptr)
+	while (ptr<end)
 	{
-		if ((unsigned char)*ptr>31 && *ptr!='\"' && *ptr!='\\') *ptr2++=*ptr++;
-		else
+		n=scan_plain(ptr,end);memcpy(ptr2,ptr,n);ptr+=n;ptr2+=n;
+		if (ptr<end)
 		{
 			*ptr2++='\\';
 			switch (token=*ptr++)
@@ -243,21 +431,20 @@ static char *print_string_ptr(const char *str)
 			}
 		}
 	}
-	*ptr2++='\"';*ptr2++=0;
-	return out;
+	*ptr2++='\"';*ptr2=0;
 }
 /* Invote print_string_ptr (which is useful) on an item. */
-static char *print_string(cJSON *item)	{return print_string_ptr(item->valuestring);}
+static void print_string(cJSON *item,printbuffer *p)	{print_string_ptr(item->valuestring,p);}
 
 /* Predeclare these prototypes. */
 static const char *parse_value(cJSON *item,const char *value);
-static char *print_value(cJSON *item,int depth,int fmt);
+static void print_value(cJSON *item,int depth,int fmt,printbuffer *p);
 static const char *parse_array(cJSON *item,const char *value);
-static char *print_array(cJSON *item,int depth,int fmt);
+static void print_array(cJSON *item,int depth,int fmt,printbuffer *p);
 static const char *parse_object(cJSON *item,const char *value);
-static char *print_object(cJSON *item,int depth,int fmt);
+static void print_object(cJSON *item,int depth,int fmt,printbuffer *p);
 
-/* Utility to jump whitespace and cr/lf */
+/* Utility to jump whitespace and cr/lf. Left bytewise: compact JSON has no run of whitespace worth a block scan. */
 static const char *skip(const char *in) {while (in && *in && (unsigned char)*in<=32) in++; return in;}
 
 /* Parse an object - create a new root, and populate. */
@@ -267,6 +454,7 @@ cJSON *cJSON_ParseWithOpts(const char *value,const char **return_parse_end,int r
 	cJSON *c=cJSON_New_Item();
 	ep=0;
 	if (!c) return 0;       /* memory fail */
+	pe=value?value+strlen(value):0;
 
 	end=parse_value(c,skip(value));
 	if (!end)	{cJSON_Delete(c);return 0;}	/* parse failure. ep is set. */
@@ -280,8 +468,33 @@ cJSON *cJSON_ParseWithOpts(const char *value,const char **return_parse_end,int r
 cJSON *cJSON_Parse(const char *value) {return cJSON_ParseWithOpts(value,0,0);}
 
 /* Render a cJSON item/entity/structure to text. */
-char *cJSON_Print(cJSON *item)				{return print_value(item,0,1);}
-char *cJSON_PrintUnformatted(cJSON *item)	{return print_value(item,0,0);}
+static int print_finish(cJSON *item,int fmt,printbuffer *p)
+{
+	char *out;
+	if (!item) return 0;
+	print_value(item,0,fmt,p);
+	out=ensure(p,0);
+	if (out) *out=0;
+	return !p->fail;
+}
+char *cJSON_Print(cJSON *item)				{return cJSON_PrintBuffered(item,256,1);}
+char *cJSON_PrintUnformatted(cJSON *item)	{return cJSON_PrintBuffered(item,256,0);}
+char *cJSON_PrintBuffered(cJSON *item,int prebuffer,int fmt)
+{
+	printbuffer p={0,0,0,0,0};
+	p.length=prebuffer>0?prebuffer:1;
+	p.buffer=(char*)cJSON_malloc(p.length);
+	if (!p.buffer) return 0;
+	if (!print_finish(item,fmt,&p)) {cJSON_free(p.buffer);return 0;}
+	return p.buffer;
+}
+int cJSON_PrintPreallocated(cJSON *item,char *buf,int len,int fmt)
+{
+	printbuffer p={0,0,0,1,0};
+	if (!buf || len<1) return 0;
+	p.buffer=buf;p.length=len;
+	return print_finish(item,fmt,&p);
+}
 
 /* Parser core - when encountering text, process appropriately. */
 static const char *parse_value(cJSON *item,const char *value)
@@ -299,21 +512,18 @@ static const char *parse_value(cJSON *item,const char *value)
 }
 
 /* Render a value to text. */
-static char *print_value(cJSON *item,int depth,int fmt)
+static void print_value(cJSON *item,int depth,int fmt,printbuffer *p)
 {
-	char *out=0;
-	if (!item) return 0;
 	switch ((item->type)&255)
 	{
-		case cJSON_NULL:	out=cJSON_strdup("null");	break;
-		case cJSON_False:	out=cJSON_strdup("false");break;
-		case cJSON_True:	out=cJSON_strdup("true"); break;
-		case cJSON_Number:	out=print_number(item);break;
-		case cJSON_String:	out=print_string(item);break;
-		case cJSON_Array:	out=print_array(item,depth,fmt);break;
-		case cJSON_Object:	out=print_object(item,depth,fmt);break;
+		case cJSON_NULL:	print_put(p,"null",4);	break;
+		case cJSON_False:	print_put(p,"false",5);break;
+		case cJSON_True:	print_put(p,"true",4); break;
+		case cJSON_Number:	print_number(item,p);break;
+		case cJSON_String:	print_string(item,p);break;
+		case cJSON_Array:	print_array(item,depth,fmt,p);break;
+		case cJSON_Object:	print_object(item,depth,fmt,p);break;
 	}
-	return out;
 }
 
 /* Build an array from input text. */
@@ -345,67 +555,24 @@ static const char *parse_array(cJSON *item,const char *value)
 }
 
 /* Render an array to text */
-static char *print_array(cJSON *item,int depth,int fmt)
+static void print_array(cJSON *item,int depth,int fmt,printbuffer *p)
 {
-	char **entries;
-	char *out=0,*ptr,*ret;int len=5;
 	cJSON *child=item->child;
-	int numentries=0,i=0,fail=0;
 	
-	/* How many entries in the array? */
-	while (child) numentries++,child=child->next;
-	/* Explicitly handle numentries==0 */
-	if (!numentries)
-	{
-		out=(char*)cJSON_malloc(3);
-		if (out) strcpy(out,"[]");
-		return out;
-	}
-	/* Allocate an array to hold the values for each */
-	entries=(char**)cJSON_malloc(numentries*sizeof(char*));
-	if (!entries) return 0;
-	memset(entries,0,numentries*sizeof(char*));
-	/* Retrieve all the results: */
-	child=item->child;
-	while (child && !fail)
+	print_put(p,"[",1);
+	while (child && !p->fail)
 	{
-		ret=print_value(child,depth+1,fmt);
-		entries[i++]=ret;
-		if (ret) len+=strlen(ret)+2+(fmt?1:0); else fail=1;
+		print_value(child,depth+1,fmt,p);
+		if (child->next) print_put(p,", ",fmt?2:1);
 		child=child->next;
 	}
-	
-	/* If we didn't fail, try to malloc the output string */
-	if (!fail) out=(char*)cJSON_malloc(len);
-	/* If that fails, we fail. */
-	if (!out) fail=1;
-
-	/* Handle failure. */
-	if (fail)
-	{
-		for (i=0;i<numentries;i++) if (entries[i]) cJSON_free(entries[i]);
-		cJSON_free(entries);
-		return 0;
-	}
-	
-	/* Compose the output array. */
-	*out='[';
-	ptr=out+1;*ptr=0;
-	for (i=0;i<numentries;i++)
-	{
-		strcpy(ptr,entries[i]);ptr+=strlen(entries[i]);
-		if (i!=numentries-1) {*ptr++=',';if(fmt)*ptr++=' ';*ptr=0;}
-		cJSON_free(entries[i]);
-	}
-	cJSON_free(entries);
-	*ptr++=']';*ptr++=0;
-	return out;	
+	print_put(p,"]",1);
 }
 
 /* Build an object from the text. */
 static const char *parse_object(cJSON *item,const char *value)
 {
-	cJSON *child;
+	cJSON *child;int count=1;
 	if (*value!='{')	{ep=value;return 0;}	/* not an object! */
 	
 	item->type=cJSON_Object;
@@ -425,7 +592,7 @@ static const char *parse_object(cJSON *item,const char *value)
 	{
 		cJSON *new_item;
 		if (!(new_item=cJSON_New_Item()))	return 0; /* memory fail */
-		child->next=new_item;new_item->prev=child;child=new_item;
+		child->next=new_item;new_item->prev=child;child=new_item;count++;
 		value=skip(parse_string(child,skip(value+1)));
 		if (!value) return 0;
 		child->string=child->valuestring;child->valuestring=0;
@@ -434,102 +601,69 @@ static const char *parse_object(cJSON *item,const char *value)
 		if (!value) return 0;
 	}
 	
-	if (*value=='}') return value+1;	/* end of array */
+	if (*value=='}')	/* end of array */
+	{
+		if (cJSON_index_min && count>=cJSON_index_min) cJSON_BuildIndex(item,count);
+		return value+1;
+	}
 	ep=value;return 0;	/* malformed. */
 }
 
 /* Render an object to text. */
-static char *print_object(cJSON *item,int depth,int fmt)
+static void print_object(cJSON *item,int depth,int fmt,printbuffer *p)
 {
-	char **entries=0,**names=0;
-	char *out=0,*ptr,*ret,*str;int len=7,i=0,j;
 	cJSON *child=item->child;
-	int numentries=0,fail=0;
-	/* Count the number of entries. */
-	while (child) numentries++,child=child->next;
-	/* Explicitly handle empty object case */
-	if (!numentries)
-	{
-		out=(char*)cJSON_malloc(fmt?depth+4:3);
-		if (!out)	return 0;
-		ptr=out;*ptr++='{';
-		if (fmt) {*ptr++='\n';for (i=0;i<depth-1;i++) *ptr++='\t';}
-		*ptr++='}';*ptr++=0;
-		return out;
-	}
-	/* Allocate space for the names and the objects */
-	entries=(char**)cJSON_malloc(numentries*sizeof(char*));
-	if (!entries) return 0;
-	names=(char**)cJSON_malloc(numentries*sizeof(char*));
-	if (!names) {cJSON_free(entries);return 0;}
-	memset(entries,0,sizeof(char*)*numentries);
-	memset(names,0,sizeof(char*)*numentries);
-
-	/* Collect all the results into our arrays: */
-	child=item->child;depth++;if (fmt) len+=depth;
-	while (child)
-	{
-		names[i]=str=print_string_ptr(child->string);
-		entries[i++]=ret=print_value(child,depth,fmt);
-		if (str && ret) len+=strlen(ret)+strlen(str)+2+(fmt?2+depth:0); else fail=1;
-		child=child->next;
-	}
 	
-	/* Try to allocate the output string */
-	if (!fail) out=(char*)cJSON_malloc(len);
-	if (!out) fail=1;
-
-	/* Handle failure */
-	if (fail)
+	/* Explicitly handle empty object case */
+	if (!child)
 	{
-		for (i=0;i<numentries;i++) {if (names[i]) cJSON_free(names[i]);if (entries[i]) cJSON_free(entries[i]);}
-		cJSON_free(names);cJSON_free(entries);
-		return 0;
+		print_put(p,"{\n",fmt?2:1);
+		if (fmt) print_tabs(p,depth-1);
+		print_put(p,"}",1);
+		return;
 	}
-	
 	/* Compose the output: */
-	*out='{';ptr=out+1;if (fmt)*ptr++='\n';*ptr=0;
-	for (i=0;i<numentries;i++)
+	print_put(p,"{\n",fmt?2:1);
+	depth++;
+	while (child && !p->fail)
 	{
-		if (fmt) for (j=0;j<depth;j++) *ptr++='\t';
-		strcpy(ptr,names[i]);ptr+=strlen(names[i]);
-		*ptr++=':';if (fmt) *ptr++='\t';
-		strcpy(ptr,entries[i]);ptr+=strlen(entries[i]);
-		if (i!=numentries-1) *ptr++=',';
-		if (fmt) *ptr++='\n';*ptr=0;
-		cJSON_free(names[i]);cJSON_free(entries[i]);
+		if (fmt) print_tabs(p,depth);
+		print_string_ptr(child->string,p);
+		print_put(p,":\t",fmt?2:1);
+		print_value(child,depth,fmt,p);
+		if (child->next) print_put(p,",",1);
+		if (fmt) print_put(p,"\n",1);
+		child=child->next;
 	}
-	
-	cJSON_free(names);cJSON_free(entries);
-	if (fmt) for (i=0;i<depth-1;i++) *ptr++='\t';
-	*ptr++='}';*ptr++=0;
-	return out;	
+	if (fmt) print_tabs(p,depth-1);
+	print_put(p,"}",1);
 }
 
 /* Get Array size/item / object item. */
 int    cJSON_GetArraySize(cJSON *array)							{cJSON *c=array->child;int i=0;while(c)i++,c=c->next;return i;}
 cJSON *cJSON_GetArrayItem(cJSON *array,int item)				{cJSON *c=array->child;  while (c && item>0) item--,c=c->next; return c;}
-cJSON *cJSON_GetObjectItem(cJSON *object,const char *string)	{cJSON *c=object->child; while (c && cJSON_strcasecmp(c->string,string)) c=c->next; return c;}
+cJSON *cJSON_GetObjectItem(cJSON *object,const char *string)	{return cJSON_Lookup(object,string,cJSON_strcasecmp);}
+cJSON *cJSON_GetObjectItemCS(cJSON *object,const char *string)	{return cJSON_Lookup(object,string,cJSON_strcmp);}
 
 /* Utility for array list handling. */
 static void suffix_object(cJSON *prev,cJSON *item) {prev->next=item;item->prev=prev;}
 /* Utility for handling references. */
-static cJSON *create_reference(cJSON *item) {cJSON *ref=cJSON_New_Item();if (!ref) return 0;memcpy(ref,item,sizeof(cJSON));ref->string=0;ref->type|=cJSON_IsReference;ref->next=ref->prev=0;return ref;}
+static cJSON *create_reference(cJSON *item) {cJSON *ref=cJSON_New_Item();if (!ref) return 0;memcpy(ref,item,sizeof(cJSON));ref->string=0;ref->index=0;ref->type|=cJSON_IsReference;ref->next=ref->prev=0;return ref;}
 
 /* Add item to array/object. */
-void   cJSON_AddItemToArray(cJSON *array, cJSON *item)						{cJSON *c=array->child;if (!item) return; if (!c) {array->child=item;} else {while (c && c->next) c=c->next; suffix_object(c,item);}}
+void   cJSON_AddItemToArray(cJSON *array, cJSON *item)						{cJSON *c=array->child;if (!item) return; cJSON_DropIndex(array); if (!c) {array->child=item;} else {while (c && c->next) c=c->next; suffix_object(c,item);}}
 void   cJSON_AddItemToObject(cJSON *object,const char *string,cJSON *item)	{if (!item) return; if (item->string) cJSON_free(item->string);item->string=cJSON_strdup(string);cJSON_AddItemToArray(object,item);}
 void	cJSON_AddItemReferenceToArray(cJSON *array, cJSON *item)						{cJSON_AddItemToArray(array,create_reference(item));}
 void	cJSON_AddItemReferenceToObject(cJSON *object,const char *string,cJSON *item)	{cJSON_AddItemToObject(object,string,create_reference(item));}
 
-cJSON *cJSON_DetachItemFromArray(cJSON *array,int which)			{cJSON *c=array->child;while (c && which>0) c=c->next,which--;if (!c) return 0;
+cJSON *cJSON_DetachItemFromArray(cJSON *array,int which)			{cJSON *c=array->child;while (c && which>0) c=c->next,which--;if (!c) return 0;cJSON_DropIndex(array);
 	if (c->prev) c->prev->next=c->next;if (c->next) c->next->prev=c->prev;if (c==array->child) array->child=c->next;c->prev=c->next=0;return c;}
 void   cJSON_DeleteItemFromArray(cJSON *array,int which)			{cJSON_Delete(cJSON_DetachItemFromArray(array,which));}
 cJSON *cJSON_DetachItemFromObject(cJSON *object,const char *string) {int i=0;cJSON *c=object->child;while (c && cJSON_strcasecmp(c->string,string)) i++,c=c->next;if (c) return cJSON_DetachItemFromArray(object,i);return 0;}
 void   cJSON_DeleteItemFromObject(cJSON *object,const char *string) {cJSON_Delete(cJSON_DetachItemFromObject(object,string));}
 
 /* Replace array/object items with new ones. */
-void   cJSON_ReplaceItemInArray(cJSON *array,int which,cJSON *newitem)		{cJSON *c=array->child;while (c && which>0) c=c->next,which--;if (!c) return;
+void   cJSON_ReplaceItemInArray(cJSON *array,int which,cJSON *newitem)		{cJSON *c=array->child;while (c && which>0) c=c->next,which--;if (!c) return;cJSON_DropIndex(array);
 	newitem->next=c->next;newitem->prev=c->prev;if (newitem->next) newitem->next->prev=newitem;
 	if (c==array->child) array->child=newitem; else newitem->prev->next=newitem;c->next=c->prev=0;cJSON_Delete(c);}
 void   cJSON_ReplaceItemInObject(cJSON *object,const char *string,cJSON *newitem){int i=0;cJSON *c=object->child;while(c && cJSON_strcasecmp(c->string,string))i++,c=c->next;if(c){newitem->string=cJSON_strdup(string);cJSON_ReplaceItemInArray(object,i,newitem);}}
@@ -541,6 +675,7 @@ cJSON *cJSON_CreateFalse(void)					{cJSON *item=cJSON_New_Item();if(item)item->t
 cJSON *cJSON_CreateBool(int b)					{cJSON *item=cJSON_New_Item();if(item)item->type=b?cJSON_True:cJSON_False;return item;}
 cJSON *cJSON_CreateNumber(double num)			{cJSON *item=cJSON_New_Item();if(item){item->type=cJSON_Number;item->valuedouble=num;item->valueint=(int)num;}return item;}
 cJSON *cJSON_CreateString(const char *string)	{cJSON *item=cJSON_New_Item();if(item){item->type=cJSON_String;item->valuestring=cJSON_strdup(string);}return item;}
+cJSON *cJSON_CreateStringLen(const char *string,int len)	{cJSON *item=cJSON_New_Item();if(item){item->type=cJSON_String;item->valuestring=(char*)cJSON_malloc(len+1);if(!item->valuestring){cJSON_Delete(item);return 0;}memcpy(item->valuestring,string,len);item->valuestring[len]=0;}return item;}
 cJSON *cJSON_CreateArray(void)					{cJSON *item=cJSON_New_Item();if(item)item->type=cJSON_Array;return item;}
 cJSON *cJSON_CreateObject(void)					{cJSON *item=cJSON_New_Item();if(item)item->type=cJSON_Object;return item;}
 
@@ -39,6 +39,8 @@ extern "C"
 	
 #define cJSON_IsReference 256
 
+struct cJSON_Index;
+
 /* The cJSON structure: */
 typedef struct cJSON {
 	struct cJSON *next,*prev;	/* next/prev allow you to walk array/object chains. Alternatively, use GetArraySize/GetArrayItem/GetObjectItem */
@@ -51,6 +53,8 @@ typedef struct cJSON {
 	double valuedouble;			/* The item's number, if type==cJSON_Number */
 
 	char *string;				/* The item's name string, if this item is the child of, or is in the list of subitems of an object. */
+
+	struct cJSON_Index *index;	/* Children by key hash, objects parsed with cJSON_IndexObjects() on. Dropped when the object changes. */
 } cJSON;
 
 typedef struct cJSON_Hooks {
@@ -62,14 +66,23 @@ typedef struct cJSON_Hooks {
 extern void cJSON_InitHooks(cJSON_Hooks* hooks);
 
 
+/* Objects of at least min items get a key index when parsed, 0 (default) for none. */
+extern void cJSON_IndexObjects(int min);
+
 /* Supply a block of JSON, and this returns a cJSON object you can interrogate. Call cJSON_Delete when finished. */
 extern cJSON *cJSON_Parse(const char *value);
 /* Render a cJSON entity to text for transfer/storage. Free the char* when finished. */
 extern char  *cJSON_Print(cJSON *item);
 /* Render a cJSON entity to text for transfer/storage without any formatting. Free the char* when finished. */
 extern char  *cJSON_PrintUnformatted(cJSON *item);
+/* Render a cJSON entity to text in one buffer, starting at prebuffer bytes and growing as needed. fmt=0 gives unformatted, =1 gives formatted. Free the char* when finished. */
+extern char  *cJSON_PrintBuffered(cJSON *item,int prebuffer,int fmt);
+/* Render a cJSON entity into buf, len bytes including the terminator, with no allocation. Returns 1 on success, 0 if it didn't fit (buf then holds a partial render). */
+extern int    cJSON_PrintPreallocated(cJSON *item,char *buf,int len,int fmt);
 /* Delete a cJSON entity and all subentities. */
 extern void   cJSON_Delete(cJSON *c);
+/* Frees memory cJSON handed out, such as the cJSON_Print output, through the hooks. */
+extern void   cJSON_Free(void *ptr);
 
 /* Returns the number of items in an array (or object). */
 extern int	  cJSON_GetArraySize(cJSON *array);
@@ -77,6 +90,8 @@ extern int	  cJSON_GetArraySize(cJSON *array);
 extern cJSON *cJSON_GetArrayItem(cJSON *array,int item);
 /* Get item "string" from object. Case insensitive. */
 extern cJSON *cJSON_GetObjectItem(cJSON *object,const char *string);
+/* Same, case sensitive. */
+extern cJSON *cJSON_GetObjectItemCS(cJSON *object,const char *string);
 
 /* For analysing failed parses. This returns a pointer to the parse error. You'll probably need to look a few chars back to make sense of it. Defined when cJSON_Parse() returns 0. 0 when cJSON_Parse() succeeds. */
 extern const char *cJSON_GetErrorPtr(void);
@@ -88,6 +103,8 @@ extern cJSON *cJSON_CreateFalse(void);
 extern cJSON *cJSON_CreateBool(int b);
 extern cJSON *cJSON_CreateNumber(double num);
 extern cJSON *cJSON_CreateString(const char *string);
+/* Same, from len bytes that need no terminator. */
+extern cJSON *cJSON_CreateStringLen(const char *string,int len);
 extern cJSON *cJSON_CreateArray(void);
 extern cJSON *cJSON_CreateObject(void);
 
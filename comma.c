@@ -0,0 +1,193 @@
+/*
+* The MIT License (MIT)
+*
+* Copyright (c) 2013, Marcelo Aquino, https://github.com/mapnull
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+* THE SOFTWARE.
+*/
+
+#include "comma.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Splits len bytes of "<value>,<value>,..." into vals, all in one pass. Returns
+// the number of values, empty ones included, or -1 when one isn't a number or
+// there are more than max.
+int comma_parse(const char *s, int len, struct comma_value *vals, int max)
+{
+	const char *end = s + len;
+	int64_t m;
+	int count = 0, digits, point;
+	bool neg, sign;
+
+	for (;;) {
+		if (count == max)
+			return -1;
+		m = 0;
+		digits = 0;
+		point = -1;
+		sign = s < end && (*s == '-' || *s == '+');
+		neg = sign && *s++ == '-';
+		for (; s < end && *s != ','; s++) {
+			if ((unsigned)(*s - '0') < 10) {
+				if (++digits > COMMA_DIGITS_MAX)
+					return -1;
+				m = m * 10 + (*s - '0');
+			} else if (*s == '.' && point < 0) {
+				point = digits;
+			} else {
+				return -1;
+			}
+		}
+		if (digits) {
+			vals[count].mantissa = neg ? -m : m;
+			vals[count].decimals = point < 0 ? 0 : digits - point;
+		} else if (sign || point >= 0) {
+			return -1;						// A lone sign or point
+		} else {
+			vals[count].decimals = COMMA_EMPTY;
+		}
+		count++;
+		if (s == end)
+			return count;
+		s++;								// The comma
+	}
+}
+
+// "<name>[:<decimals>],..." Returns -1 for an invalid list.
+int comma_template_parse(struct comma_template *tpl, const char *list)
+{
+	const char *p = list;
+	char *num;
+	size_t len, i;
+	long scale;
+
+	tpl->count = 0;
+	for (;;) {
+		len = strcspn(p, ",:");
+		if (!len || len >= COMMA_NAME_LEN || tpl->count == COMMA_FIELDS_MAX)
+			return -1;
+		for (i = 0; i < len; i++)
+			if ((unsigned char)p[i] <= ' ' || p[i] == '"' || p[i] == '\\')
+				return -1;					// Names go into JSON as they are
+		memcpy(tpl->names[tpl->count], p, len);
+		tpl->names[tpl->count][len] = 0;
+		p += len;
+
+		scale = 0;
+		if (*p == ':') {
+			scale = strtol(p + 1, &num, 10);
+			if (num == p + 1 || scale < 0 || scale > COMMA_SCALE_MAX)
+				return -1;
+			p = num;
+		}
+		tpl->scale[tpl->count++] = scale;
+
+		if (!*p)
+			return 0;
+		if (*p++ != ',')
+			return -1;
+	}
+}
+
+const struct comma_template *comma_find(const struct comma_template *tpls, int count, const char *uuid)
+{
+	const struct comma_template *any = NULL;
+	int i;
+
+	for (i = 0; i < count; i++) {
+		if (!strcmp(tpls[i].uuid, uuid))
+			return &tpls[i];
+		if (!strcmp(tpls[i].uuid, COMMA_ANY))
+			any = &tpls[i];
+	}
+	return any;
+}
+
+// mantissa / 10^decimals as exact text, without the trailing zeros of the fraction
+static int comma_number(char *out, int64_t mantissa, int decimals)
+{
+	char digits[COMMA_VALUE_LEN], *p = out;
+	uint64_t u;
+	int n = 0;
+
+	u = mantissa < 0 ? -(uint64_t)mantissa : (uint64_t)mantissa;
+	while (decimals > 0 && u % 10 == 0) {
+		u /= 10;
+		decimals--;
+	}
+	if (!u) {
+		*p++ = '0';
+		return 1;
+	}
+	if (mantissa < 0)
+		*p++ = '-';
+	do {
+		digits[n++] = '0' + u % 10;
+		u /= 10;
+	} while (u);
+	while (n <= decimals)
+		digits[n++] = '0';
+	while (n > decimals)
+		*p++ = digits[--n];
+	if (decimals) {
+		*p++ = '.';
+		while (n)
+			*p++ = digits[--n];
+	}
+	return p - out;
+}
+
+// Renders the values as a JSON object into out. Returns its length, or -1 when
+// size is short of it; COMMA_JSON_MAX always fits.
+int comma_json(const struct comma_template *tpl, const struct comma_value *vals, int count, char *out, int size)
+{
+	char *p = out, *end = out + size;
+	int i, len, scale;
+
+	if (size < 3)
+		return -1;
+	*p++ = '{';
+	for (i = 0; i < count; i++) {
+		if (vals[i].decimals == COMMA_EMPTY)
+			continue;
+		if (end - p < COMMA_NAME_LEN + 4 + COMMA_VALUE_LEN + 2)
+			return -1;						// Room for the value, '}' and the terminator
+		if (p > out + 1)
+			*p++ = ',';
+		*p++ = '"';
+		if (tpl && i < tpl->count) {
+			len = strlen(tpl->names[i]);
+			memcpy(p, tpl->names[i], len);
+			p += len;
+			scale = tpl->scale[i];
+		} else {
+			p += sprintf(p, "%d", i);
+			scale = 0;
+		}
+		*p++ = '"';
+		*p++ = ':';
+		p += comma_number(p, vals[i].mantissa, vals[i].decimals + scale);
+	}
+	*p++ = '}';
+	*p = 0;
+	return p - out;
+}
@@ -0,0 +1,68 @@
+/*
+* The MIT License (MIT)
+*
+* Copyright (c) 2013, Marcelo Aquino, https://github.com/mapnull
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+* THE SOFTWARE.
+*/
+
+#ifndef COMMA_H
+#define COMMA_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "device.h"
+
+/*
+* Comma frames, "@C#<value>,<value>,..." from a single device or
+* "@c#<id>,<value>,..." on a multi-drop port, for boards that can't
+* spare the bytes of JSON keys. Values are integers or decimals with an
+* optional sign, an empty one is left out. A template from the config
+* names them in order, with the decimals implied in fixed point ones;
+* values past the template are keyed by their position.
+*/
+
+#define COMMA_FIELDS_MAX 32					// Values in one frame
+#define COMMA_NAME_LEN 32
+#define COMMA_SCALE_MAX 9					// Implied decimals
+#define COMMA_DIGITS_MAX 18					// Digits that still fit a value exactly
+#define COMMA_VALUE_LEN 32					// Longest value as text
+#define COMMA_JSON_MAX (2 + COMMA_FIELDS_MAX * (COMMA_NAME_LEN + 4 + COMMA_VALUE_LEN))
+#define COMMA_ANY "*"						// Template for the devices without one
+#define COMMA_EMPTY -1						// decimals of a value left out
+
+struct comma_value {
+	int64_t mantissa;						// value * 10^decimals
+	int decimals;
+};
+
+struct comma_template {
+	char uuid[DEVICE_UUID_LEN + 1];			// Device, or COMMA_ANY
+	char names[COMMA_FIELDS_MAX][COMMA_NAME_LEN];
+	int scale[COMMA_FIELDS_MAX];			// Implied decimals of each value
+	int count;
+};
+
+int comma_parse(const char *, int, struct comma_value *, int);
+int comma_template_parse(struct comma_template *, const char *);
+const struct comma_template *comma_find(const struct comma_template *, int, const char *);
+int comma_json(const struct comma_template *, const struct comma_value *, int, char *, int);
+
+#endif
@@ -1,3 +1,20 @@
 #!/bin/bash
 rm -rf mqtt_bridge
-gcc -Wall -lmosquitto mqtt_bridge.c utils.c conf.c bridge.c arduino-serial-lib.c cJSON.c -o mqtt_bridge -lm
+gcc -Wall -lmosquitto mqtt_bridge.c utils.c conf.c bridge.c arduino-serial-lib.c cJSON.c event.c frame.c wheel.c registry.c ring.c pipeline.c spool.c batch.c pack.c filter.c outbox.c jscan.c pool.c arena.c comma.c -o mqtt_bridge -lm -lpthread
+
+# "./compile.sh bench" also builds the microbenchmarks, run them from here
+if [ "$1" == "bench" ]; then
+	gcc -O2 -Wall bench/bench_serial.c arduino-serial-lib.c frame.c pool.c -o bench/bench_serial -Wl,--wrap=read,--wrap=readv -lpthread
+	gcc -O2 -Wall bench/bench_ports.c arduino-serial-lib.c event.c frame.c pool.c -o bench/bench_ports -lpthread
+	gcc -O2 -Wall bench/bench_devices.c bridge.c wheel.c utils.c arduino-serial-lib.c frame.c pool.c -o bench/bench_devices
+	gcc -O2 -Wall bench/bench_topics.c bridge.c wheel.c utils.c arduino-serial-lib.c frame.c pool.c -o bench/bench_topics
+	gcc -O2 -Wall bench/bench_subscribe.c -o bench/bench_subscribe -lmosquitto
+	gcc -O2 -Wall bench/bench_pipeline.c pipeline.c ring.c pool.c frame.c arduino-serial-lib.c bridge.c wheel.c utils.c cJSON.c -o bench/bench_pipeline -lm -lpthread
+	gcc -O2 -Wall bench/bench_batch.c batch.c -o bench/bench_batch
+	gcc -O2 -Wall bench/bench_pack.c pack.c jscan.c cJSON.c frame.c arduino-serial-lib.c pool.c -o bench/bench_pack -lm
+	gcc -O2 -Wall bench/bench_v5.c -o bench/bench_v5
+	gcc -O2 -Wall bench/bench_jscan.c jscan.c cJSON.c -o bench/bench_jscan -lm
+	gcc -O2 -Wall bench/bench_index.c cJSON.c -o bench/bench_index -lm
+	gcc -O2 -Wall bench/bench_numbers.c -o bench/bench_numbers -lm
+	gcc -O2 -Wall bench/bench_scan.c -o bench/bench_scan -lm
+fi
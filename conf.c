@@ -34,15 +34,26 @@ POSSIBILITY OF SUCH DAMAGE.
 
 #include "mqtt_bridge.h"
 #include "bridge.h"
+#include "serial.h"
+#include "spool.h"
+#include "batch.h"
+#include "pack.h"
+#include "filter.h"
+#include "outbox.h"
+#include "comma.h"
 
 static int _conf_parse_int(char *token, const char *name, int *value);
 static int _conf_parse_string(char *token, const char *name, char **value);
+static struct bridge_serial *_conf_add_serial(struct bridge_config *config);
+static int _conf_add_deadband(struct bridge_config *config, char *token);
+static int _conf_add_comma(struct bridge_config *config, char *token);
 
 int config_parse(const char *config_file, struct bridge_config *config)
 {
 	FILE *fptr;
 	char buf[1024];
 	struct bridge_serial *current_serial = NULL;
+	int i, j;
 
 	fptr = fopen(config_file, "rt");
 	if(!fptr){
@@ -55,9 +66,32 @@ int config_parse(const char *config_file, struct bridge_config *config)
 	config->mqtt_host = NULL;
 	config->mqtt_port = 1883;
 	config->mqtt_qos = 0;
-	config->serial.port = NULL;
+	config->mqtt_subscribe = MQTT_SUBSCRIBE_DEVICE;
+	config->mqtt_version = MQTT_VERSION_311;
+	config->topic_aliases = 64;
+	config->message_expiry = 0;
+	config->mqtt_inflight = 0;
+	config->mqtt_queue = 100;
+	config->mqtt_queue_policy = OUTBOX_DROP_OLDEST;
+	config->pipeline = 0;
+	config->serial = NULL;
+	config->serial_count = 0;
 	config->scripts_folder = NULL;
 	config->interface = NULL;
+	config->registry_file = NULL;
+	config->spool_dir = NULL;
+	config->spool_max = 1024;
+	config->spool_policy = SPOOL_DROP_OLDEST;
+	config->spool_rate = 20;
+	config->aggregate = BATCH_OFF;
+	config->aggregate_window = 1000;
+	config->aggregate_size = 1024;
+	config->payload_encoding = PACK_JSON;
+	config->deadbands = NULL;
+	config->deadband_count = 0;
+	config->deadband_silence = 60;
+	config->comma_templates = NULL;
+	config->comma_count = 0;
 	config->usr1_remap_uuid = NULL;
 	config->usr2_remap_uuid = NULL;
 	config->usr1_json = NULL;
@@ -111,16 +145,95 @@ int config_parse(const char *config_file, struct bridge_config *config)
 						return 1;
 					}
 				}
+			} else if (!strncmp(buf, "mqtt_subscribe ", 15)) {
+				if (!strcmp(&(buf[15]), "device")) {
+					config->mqtt_subscribe = MQTT_SUBSCRIBE_DEVICE;
+				} else if (!strcmp(&(buf[15]), "wildcard")) {
+					config->mqtt_subscribe = MQTT_SUBSCRIBE_WILDCARD;
+				} else {
+					fprintf(stderr, "Error: invalid mqtt_subscribe, use device or wildcard.\n");
+					fclose(fptr);
+					return 1;
+				}
+			} else if (!strncmp(buf, "mqtt_version ", 13)) {
+				if (!strcmp(&(buf[13]), "311")) {
+					config->mqtt_version = MQTT_VERSION_311;
+				} else if (!strcmp(&(buf[13]), "5")) {
+					config->mqtt_version = MQTT_VERSION_5;
+				} else {
+					fprintf(stderr, "Error: invalid mqtt_version, use 311 or 5.\n");
+					fclose(fptr);
+					return 1;
+				}
+			} else if (!strncmp(buf, "topic_aliases ", 14)) {
+				if (_conf_parse_int(&(buf[14]), "topic_aliases", &config->topic_aliases)) {
+					fclose(fptr);
+					return 1;
+				} else if (config->topic_aliases < 0 || config->topic_aliases > 65535) {
+					fprintf(stderr, "Error: topic_aliases out of range in config.\n");
+					fclose(fptr);
+					return 1;
+				}
+			} else if (!strncmp(buf, "message_expiry ", 15)) {
+				if (_conf_parse_int(&(buf[15]), "message_expiry", &config->message_expiry)) {
+					fclose(fptr);
+					return 1;
+				} else if (config->message_expiry < 0) {
+					fprintf(stderr, "Error: message_expiry out of range in config.\n");
+					fclose(fptr);
+					return 1;
+				}
+			} else if (!strncmp(buf, "mqtt_inflight ", 14)) {
+				if (_conf_parse_int(&(buf[14]), "mqtt_inflight", &config->mqtt_inflight)) {
+					fclose(fptr);
+					return 1;
+				} else if (config->mqtt_inflight < 0 || config->mqtt_inflight > 65535) {
+					fprintf(stderr, "Error: mqtt_inflight out of range in config.\n");
+					fclose(fptr);
+					return 1;
+				}
+			} else if (!strncmp(buf, "mqtt_queue ", 11)) {
+				if (_conf_parse_int(&(buf[11]), "mqtt_queue", &config->mqtt_queue)) {
+					fclose(fptr);
+					return 1;
+				} else if (config->mqtt_queue < 1) {
+					fprintf(stderr, "Error: mqtt_queue out of range in config.\n");
+					fclose(fptr);
+					return 1;
+				}
+			} else if (!strncmp(buf, "mqtt_queue_policy ", 18)) {
+				if (!strcmp(&(buf[18]), "oldest")) {
+					config->mqtt_queue_policy = OUTBOX_DROP_OLDEST;
+				} else if (!strcmp(&(buf[18]), "newest")) {
+					config->mqtt_queue_policy = OUTBOX_DROP_NEWEST;
+				} else if (!strcmp(&(buf[18]), "fair")) {
+					config->mqtt_queue_policy = OUTBOX_DROP_FAIR;
+				} else {
+					fprintf(stderr, "Error: invalid mqtt_queue_policy, use oldest, newest or fair.\n");
+					fclose(fptr);
+					return 1;
+				}
+			} else if (!strncmp(buf, "pipeline ", 9)) {
+				if (!strcmp(&(buf[9]), "on")) {
+					config->pipeline = 1;
+				} else if (!strcmp(&(buf[9]), "off")) {
+					config->pipeline = 0;
+				} else {
+					fprintf(stderr, "Error: invalid pipeline, use on or off.\n");
+					fclose(fptr);
+					return 1;
+				}
 			} else if (!strncmp(buf, "scripts_folder ", 15)) {
 				if (_conf_parse_string(&(buf[15]), "scripts_folder", &config->scripts_folder)) {
 					fclose(fptr);
 					return 1;
 				}
 			} else if (!strncmp(buf, "port ", 5)) {
-				current_serial = &config->serial;
-				current_serial->baudrate = 9600;
-				current_serial->timeout = 100;
-				current_serial->qos = 0;
+				current_serial = _conf_add_serial(config);
+				if (!current_serial) {
+					fclose(fptr);
+					return 1;
+				}
 
 				if (_conf_parse_string(&(buf[5]), "port", &current_serial->port)) {
 					fclose(fptr);
@@ -135,7 +248,10 @@ int config_parse(const char *config_file, struct bridge_config *config)
 					if (current_serial->baudrate != 4800 && current_serial->baudrate != 9600
 					&& current_serial->baudrate != 14400 && current_serial->baudrate != 19200
 					&& current_serial->baudrate != 28800 && current_serial->baudrate != 38400
-					&& current_serial->baudrate != 57600 && current_serial->baudrate != 115200) {
+					&& current_serial->baudrate != 57600 && current_serial->baudrate != 115200
+					&& current_serial->baudrate != 230400 && current_serial->baudrate != 460800
+					&& current_serial->baudrate != 500000 && current_serial->baudrate != 576000
+					&& current_serial->baudrate != 921600 && current_serial->baudrate != 1000000) {
 						fprintf(stderr, "Error: invalid baudrate.\n");
 						fclose(fptr);
 						return 1;
@@ -156,11 +272,176 @@ int config_parse(const char *config_file, struct bridge_config *config)
 					fclose(fptr);
 					return 1;
 				}
+			} else if(!strncmp(buf, "qos ", 4)) {
+				if (current_serial){
+					if (_conf_parse_int(&(buf[4]), "qos", &current_serial->qos)) {
+						fclose(fptr);
+						return 1;
+					}
+					if (current_serial->qos < 0 || current_serial->qos > 2) {
+						fprintf(stderr, "Error: qos out of range in config.\n");
+						fclose(fptr);
+						return 1;
+					}
+				} else {
+					fprintf(stderr, "Error: qos keyword without serial_port in config.\n");
+					fclose(fptr);
+					return 1;
+				}
+			} else if(!strncmp(buf, "pacing ", 7)) {
+				if (current_serial){
+					if (_conf_parse_int(&(buf[7]), "pacing", &current_serial->pacing)) {
+						fclose(fptr);
+						return 1;
+					}
+					if (current_serial->pacing < 0) {
+						fprintf(stderr, "Error: pacing out of range in config.\n");
+						fclose(fptr);
+						return 1;
+					}
+				} else {
+					fprintf(stderr, "Error: pacing keyword without serial_port in config.\n");
+					fclose(fptr);
+					return 1;
+				}
+			} else if(!strncmp(buf, "framing ", 8)) {
+				if (current_serial){
+					if (!strcmp(&(buf[8]), "text")) {
+						current_serial->framing = SERIAL_FRAMING_TEXT;
+					} else if (!strcmp(&(buf[8]), "binary")) {
+						current_serial->framing = SERIAL_FRAMING_BINARY;
+					} else if (!strcmp(&(buf[8]), "packed")) {
+						current_serial->framing = SERIAL_FRAMING_PACKED;
+					} else {
+						fprintf(stderr, "Error: invalid framing, use text, binary or packed.\n");
+						fclose(fptr);
+						return 1;
+					}
+				} else {
+					fprintf(stderr, "Error: framing keyword without serial_port in config.\n");
+					fclose(fptr);
+					return 1;
+				}
+			} else if(!strncmp(buf, "max_frame ", 10)) {
+				if (current_serial){
+					if (_conf_parse_int(&(buf[10]), "max_frame", &current_serial->max_frame)) {
+						fclose(fptr);
+						return 1;
+					}
+					if (current_serial->max_frame < SERIAL_MAX_BUF || current_serial->max_frame > SERIAL_MAX_FRAME) {
+						fprintf(stderr, "Error: max_frame out of range in config.\n");
+						fclose(fptr);
+						return 1;
+					}
+				} else {
+					fprintf(stderr, "Error: max_frame keyword without serial_port in config.\n");
+					fclose(fptr);
+					return 1;
+				}
 			} else if (!strncmp(buf, "interface ", 10)) {
 				if (_conf_parse_string(&(buf[10]), "interface", &config->interface)) {
 					fclose(fptr);
 					return 1;
 				}
+			} else if (!strncmp(buf, "registry_file ", 14)) {
+				if (_conf_parse_string(&(buf[14]), "registry_file", &config->registry_file)) {
+					fclose(fptr);
+					return 1;
+				}
+			} else if (!strncmp(buf, "spool_dir ", 10)) {
+				if (_conf_parse_string(&(buf[10]), "spool_dir", &config->spool_dir)) {
+					fclose(fptr);
+					return 1;
+				}
+			} else if (!strncmp(buf, "spool_max ", 10)) {
+				if (_conf_parse_int(&(buf[10]), "spool_max", &config->spool_max)) {
+					fclose(fptr);
+					return 1;
+				} else if (config->spool_max < 1) {
+					fprintf(stderr, "Error: spool_max out of range in config.\n");
+					fclose(fptr);
+					return 1;
+				}
+			} else if (!strncmp(buf, "spool_policy ", 13)) {
+				if (!strcmp(&(buf[13]), "oldest")) {
+					config->spool_policy = SPOOL_DROP_OLDEST;
+				} else if (!strcmp(&(buf[13]), "newest")) {
+					config->spool_policy = SPOOL_DROP_NEWEST;
+				} else {
+					fprintf(stderr, "Error: invalid spool_policy, use oldest or newest.\n");
+					fclose(fptr);
+					return 1;
+				}
+			} else if (!strncmp(buf, "spool_rate ", 11)) {
+				if (_conf_parse_int(&(buf[11]), "spool_rate", &config->spool_rate)) {
+					fclose(fptr);
+					return 1;
+				} else if (config->spool_rate < 1) {
+					fprintf(stderr, "Error: spool_rate out of range in config.\n");
+					fclose(fptr);
+					return 1;
+				}
+			} else if (!strncmp(buf, "aggregate ", 10)) {
+				if (!strcmp(&(buf[10]), "off")) {
+					config->aggregate = BATCH_OFF;
+				} else if (!strcmp(&(buf[10]), "device")) {
+					config->aggregate = BATCH_DEVICE;
+				} else if (!strcmp(&(buf[10]), "bridge")) {
+					config->aggregate = BATCH_BRIDGE;
+				} else {
+					fprintf(stderr, "Error: invalid aggregate, use off, device or bridge.\n");
+					fclose(fptr);
+					return 1;
+				}
+			} else if (!strncmp(buf, "aggregate_window ", 17)) {
+				if (_conf_parse_int(&(buf[17]), "aggregate_window", &config->aggregate_window)) {
+					fclose(fptr);
+					return 1;
+				} else if (config->aggregate_window < 1) {
+					fprintf(stderr, "Error: aggregate_window out of range in config.\n");
+					fclose(fptr);
+					return 1;
+				}
+			} else if (!strncmp(buf, "aggregate_size ", 15)) {
+				if (_conf_parse_int(&(buf[15]), "aggregate_size", &config->aggregate_size)) {
+					fclose(fptr);
+					return 1;
+				} else if (config->aggregate_size < BATCH_SIZE_MIN) {
+					fprintf(stderr, "Error: aggregate_size out of range in config.\n");
+					fclose(fptr);
+					return 1;
+				}
+			} else if (!strncmp(buf, "payload_encoding ", 17)) {
+				if (!strcmp(&(buf[17]), "json")) {
+					config->payload_encoding = PACK_JSON;
+				} else if (!strcmp(&(buf[17]), "cbor")) {
+					config->payload_encoding = PACK_CBOR;
+				} else if (!strcmp(&(buf[17]), "msgpack")) {
+					config->payload_encoding = PACK_MSGPACK;
+				} else {
+					fprintf(stderr, "Error: invalid payload_encoding, use json, cbor or msgpack.\n");
+					fclose(fptr);
+					return 1;
+				}
+			} else if (!strncmp(buf, "deadband ", 9)) {
+				if (_conf_add_deadband(config, &(buf[9]))) {
+					fclose(fptr);
+					return 1;
+				}
+			} else if (!strncmp(buf, "deadband_silence ", 17)) {
+				if (_conf_parse_int(&(buf[17]), "deadband_silence", &config->deadband_silence)) {
+					fclose(fptr);
+					return 1;
+				} else if (config->deadband_silence < 0) {
+					fprintf(stderr, "Error: deadband_silence out of range in config.\n");
+					fclose(fptr);
+					return 1;
+				}
+			} else if (!strncmp(buf, "comma_fields ", 13)) {
+				if (_conf_add_comma(config, &(buf[13]))) {
+					fclose(fptr);
+					return 1;
+				}
 			} else if (!strncmp(buf, "usr1_remap_uuid ", 16)) {
 				if (_conf_parse_string(&(buf[16]), "usr1_remap_uuid", &config->usr1_remap_uuid)) {
 					fclose(fptr);
@@ -210,6 +491,17 @@ int config_parse(const char *config_file, struct bridge_config *config)
 		return 1;
 	}
 
+	for (i = 0; i < config->serial_count; i++) {
+		if (config->serial[i].qos == -1)
+			config->serial[i].qos = config->mqtt_qos;
+		for (j = 0; j < i; j++) {
+			if (!strcmp(config->serial[i].port, config->serial[j].port)) {
+				fprintf(stderr, "Error: Duplicate port %s in config.\n", config->serial[i].port);
+				return 1;
+			}
+		}
+	}
+
 	if (config->usr1_remap_uuid) {
 		if (!bridge_isValid_uuid(config->usr1_remap_uuid)) {
 			fprintf(stderr, "Error: Invalid usr1_remap_uuid device uuid.\n");
@@ -254,14 +546,26 @@ int config_parse(const char *config_file, struct bridge_config *config)
 
 void config_cleanup(struct bridge_config *config)
 {
+	int i;
+
 	free(config->uuid);
 	free(config->mqtt_host);
-	if(config->serial.port != NULL)
-		free(config->serial.port);
+	for (i = 0; i < config->serial_count; i++)
+		free(config->serial[i].port);
+	if (config->serial != NULL)
+		free(config->serial);
 	if (config->scripts_folder != NULL)
 		free(config->scripts_folder);
 	if (config->interface != NULL)
 		free(config->interface);
+	if (config->registry_file != NULL)
+		free(config->registry_file);
+	if (config->spool_dir != NULL)
+		free(config->spool_dir);
+	if (config->deadbands != NULL)
+		free(config->deadbands);
+	if (config->comma_templates != NULL)
+		free(config->comma_templates);
 	if (config->usr1_remap_uuid != NULL)
 		free(config->usr1_remap_uuid);
 	if (config->usr2_remap_uuid != NULL)
@@ -304,3 +608,83 @@ static int _conf_parse_string(char *token, const char *name, char **value)
 	}
 	return 0;
 }
+
+static struct bridge_serial *_conf_add_serial(struct bridge_config *config)
+{
+	struct bridge_serial *serial;
+
+	serial = realloc(config->serial, (config->serial_count + 1) * sizeof(struct bridge_serial));
+	if (!serial) {
+		fprintf(stderr, "Error: Out of memory.\n");
+		return NULL;
+	}
+	config->serial = serial;
+
+	serial = &config->serial[config->serial_count++];
+	serial->port = NULL;
+	serial->baudrate = 9600;
+	serial->timeout = 100;
+	serial->qos = -1;			// Defaults to mqtt_qos
+	serial->pacing = 50;
+	serial->framing = SERIAL_FRAMING_TEXT;
+	serial->max_frame = SERIAL_MAX_BUF;
+
+	return serial;
+}
+
+// <field> <band>, the band ending in % for a relative one
+static int _conf_add_deadband(struct bridge_config *config, char *token)
+{
+	struct filter_rule *rule;
+	char field[FILTER_FIELD_LEN], unit = 0;
+	double band;
+
+	if (sscanf(token, "%31s %lf%c", field, &band, &unit) < 2 || (unit && unit != '%') || band < 0) {
+		fprintf(stderr, "Error: Invalid deadband in configuration: %s\n", token);
+		return 1;
+	}
+
+	rule = realloc(config->deadbands, (config->deadband_count + 1) * sizeof(struct filter_rule));
+	if (!rule) {
+		fprintf(stderr, "Error: Out of memory.\n");
+		return 1;
+	}
+	config->deadbands = rule;
+
+	rule = &config->deadbands[config->deadband_count++];
+	strcpy(rule->field, field);
+	rule->band = band;
+	rule->relative = unit == '%';
+
+	return 0;
+}
+
+// <uuid|*> <name>[:<decimals>],...
+static int _conf_add_comma(struct bridge_config *config, char *token)
+{
+	struct comma_template *tpl;
+	char uuid[DEVICE_UUID_LEN + 1];
+	int n = 0;
+
+	if (sscanf(token, "%36s%n", uuid, &n) < 1 || (token[n] != ' ' && token[n] != '\t')) {
+		fprintf(stderr, "Error: Invalid comma_fields in configuration: %s\n", token);
+		return 1;
+	}
+
+	tpl = realloc(config->comma_templates, (config->comma_count + 1) * sizeof(struct comma_template));
+	if (!tpl) {
+		fprintf(stderr, "Error: Out of memory.\n");
+		return 1;
+	}
+	config->comma_templates = tpl;
+
+	tpl = &config->comma_templates[config->comma_count];
+	strcpy(tpl->uuid, uuid);
+	if (comma_template_parse(tpl, token + n + strspn(token + n, " \t"))) {
+		fprintf(stderr, "Error: Invalid comma_fields in configuration: %s\n", token);
+		return 1;
+	}
+	config->comma_count++;
+
+	return 0;
+}
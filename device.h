@@ -25,12 +25,39 @@
 #ifndef DEVICE_H
 #define DEVICE_H
 
+#include <stdbool.h>
+#include <stdint.h>
+#include "wheel.h"
+
+#define DEVICE_UUID_LEN 36
+#define DEVICE_UUID_BIN 16
+#define DEVICE_TOPIC_LEN (DEVICE_UUID_LEN + 3)	// "b/<uuid>" or the server id
+#define DEVICE_PREFIX_LEN 16					// "@j#<id>"
+
+struct bridge_port;
+struct batch_t;
+struct filter_t;
+
 struct device_t {
-	char *uuid;
-	int id;
+	uint8_t uuid_bin[DEVICE_UUID_BIN];	// Registry key
+	char uuid[DEVICE_UUID_LEN + 1];
+	int id;								// Multi-drop id on its port, 0 for single devices
 	int server_id;
-	int alive;
-	struct device_t *next;
+	char topic[DEVICE_TOPIC_LEN];		// Rendered by the bridge on id changes
+	char json_prefix[DEVICE_PREFIX_LEN];
+	char comma_prefix[DEVICE_PREFIX_LEN];
+	int json_prefix_len;
+	int comma_prefix_len;
+	struct wheel_timer alive;			// Fires when the device goes quiet
+	struct batch_t *batch;				// Frames waiting for the aggregation window
+	struct filter_t *filter;			// Last published values, with deadbands
+	int queued;							// Messages waiting in the outbox
+	uint16_t alias;						// MQTT v5 topic alias, 0 for none
+	unsigned int alias_gen;				// Connection the alias was set up on
+	bool alias_known;					// The broker maps the alias to topic
+	struct bridge_port *port;			// Serial port the device answers on
+	struct device_t *next;				// Live devices, or the free list
+	struct device_t *prev;
 };
 
 #endif
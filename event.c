@@ -0,0 +1,184 @@
+/*
+* The MIT License (MIT)
+*
+* Copyright (c) 2013, Marcelo Aquino, https://github.com/mapnull
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+* THE SOFTWARE.
+*/
+
+#include "event.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+
+#define EVENT_MAX 16
+
+static int epfd = -1;
+
+int event_init(void)
+{
+	epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (epfd == -1) {
+		perror("epoll_create1");
+		return -1;
+	}
+	return 0;
+}
+
+void event_cleanup(void)
+{
+	if (epfd != -1) {
+		close(epfd);
+		epfd = -1;
+	}
+}
+
+int event_add(struct event_t *ev, int fd, uint32_t events, event_cb cb, void *data)
+{
+	struct epoll_event epev;
+
+	ev->fd = fd;
+	ev->events = events;
+	ev->cb = cb;
+	ev->data = data;
+
+	epev.events = events;
+	epev.data.ptr = ev;
+	if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &epev) == -1) {
+		perror("epoll_ctl add");
+		ev->fd = -1;
+		return -1;
+	}
+	return 0;
+}
+
+int event_mod(struct event_t *ev, uint32_t events)
+{
+	struct epoll_event epev;
+
+	if (ev->fd == -1)
+		return -1;
+	if (ev->events == events)
+		return 0;
+
+	epev.events = events;
+	epev.data.ptr = ev;
+	if (epoll_ctl(epfd, EPOLL_CTL_MOD, ev->fd, &epev) == -1) {
+		perror("epoll_ctl mod");
+		return -1;
+	}
+	ev->events = events;
+	return 0;
+}
+
+int event_del(struct event_t *ev)
+{
+	int rc = 0;
+
+	if (ev->fd == -1)
+		return 0;
+
+	// A closed fd has already left the epoll set
+	if (epoll_ctl(epfd, EPOLL_CTL_DEL, ev->fd, NULL) == -1 && errno != EBADF && errno != ENOENT) {
+		perror("epoll_ctl del");
+		rc = -1;
+	}
+	ev->fd = -1;
+	return rc;
+}
+
+// Waits up to timeout msecs (-1 forever) and dispatches the ready events.
+// returns the number of events dispatched or -1 on error
+int event_wait(int timeout)
+{
+	struct epoll_event epev[EVENT_MAX];
+	struct event_t *ev;
+	int i, n;
+
+	n = epoll_wait(epfd, epev, EVENT_MAX, timeout);
+	if (n == -1) {
+		if (errno == EINTR)
+			return 0;
+		perror("epoll_wait");
+		return -1;
+	}
+
+	for (i = 0; i < n; i++) {
+		ev = epev[i].data.ptr;
+		if (ev->fd != -1)
+			ev->cb(ev->fd, epev[i].events, ev->data);
+	}
+	return n;
+}
+
+// Creates a non-blocking timerfd firing every interval msecs, 0 leaves it disarmed
+int event_timerfd(int interval)
+{
+	int fd;
+
+	fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (fd == -1) {
+		perror("timerfd_create");
+		return -1;
+	}
+	if (interval && event_timerfd_set(fd, interval, interval)) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+// Arms the timer to expire in value msecs and then every interval msecs.
+// value 0 disarms it
+int event_timerfd_set(int fd, int value, int interval)
+{
+	struct itimerspec its;
+
+	its.it_value.tv_sec = value / 1000;
+	its.it_value.tv_nsec = (value % 1000) * 1000000L;
+	its.it_interval.tv_sec = interval / 1000;
+	its.it_interval.tv_nsec = (interval % 1000) * 1000000L;
+
+	if (timerfd_settime(fd, 0, &its, NULL) == -1) {
+		perror("timerfd_settime");
+		return -1;
+	}
+	return 0;
+}
+
+// Blocks the signals in mask and returns a signalfd delivering them
+int event_signalfd(sigset_t *mask)
+{
+	int fd;
+
+	if (sigprocmask(SIG_BLOCK, mask, NULL) == -1) {
+		perror("sigprocmask");
+		return -1;
+	}
+	fd = signalfd(-1, mask, SFD_NONBLOCK | SFD_CLOEXEC);
+	if (fd == -1) {
+		perror("signalfd");
+		return -1;
+	}
+	return fd;
+}
@@ -0,0 +1,51 @@
+/*
+* The MIT License (MIT)
+*
+* Copyright (c) 2013, Marcelo Aquino, https://github.com/mapnull
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+* THE SOFTWARE.
+*/
+
+#ifndef EVENT_H
+#define EVENT_H
+
+#include <stdint.h>
+#include <signal.h>
+#include <sys/epoll.h>
+
+typedef void (*event_cb)(int fd, uint32_t events, void *data);
+
+struct event_t {
+	int fd;
+	uint32_t events;
+	event_cb cb;
+	void *data;
+};
+
+int event_init(void);
+void event_cleanup(void);
+int event_add(struct event_t *, int, uint32_t, event_cb, void *);
+int event_mod(struct event_t *, uint32_t);
+int event_del(struct event_t *);
+int event_wait(int);
+int event_timerfd(int);
+int event_timerfd_set(int, int, int);
+int event_signalfd(sigset_t *);
+
+#endif
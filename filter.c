@@ -0,0 +1,190 @@
+/*
+* The MIT License (MIT)
+*
+* Copyright (c) 2013, Marcelo Aquino, https://github.com/mapnull
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+* THE SOFTWARE.
+*/
+
+#include "filter.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct filter_t *filter_new(void)
+{
+	struct filter_t *filter;
+
+	filter = calloc(1, sizeof(struct filter_t));
+	if (!filter) {
+		fprintf(stderr, "Error: No memory left.\n");
+		exit(1);
+	}
+	return filter;
+}
+
+void filter_free(struct filter_t *filter)
+{
+	if (!filter)
+		return;
+	free(filter->fields);
+	free(filter);
+}
+
+// FNV-1a
+static uint32_t filter_hash(const char *s)
+{
+	uint32_t hash = 2166136261u;
+
+	while (*s)
+		hash = (hash ^ (uint8_t)*s++) * 16777619u;
+	return hash;
+}
+
+static uint32_t filter_hash_item(cJSON *item)
+{
+	uint32_t hash;
+	char buf[FILTER_PRINT_MAX], *out;
+
+	switch (item->type & 255) {
+		case cJSON_String:
+			return filter_hash(item->valuestring);
+		case cJSON_Array:
+		case cJSON_Object:
+			if (cJSON_PrintPreallocated(item, buf, sizeof(buf), 0))
+				return filter_hash(buf);
+			out = cJSON_PrintUnformatted(item);	// Too big for the stack
+			if (!out)
+				return 0;
+			hash = filter_hash(out);
+			cJSON_Free(out);
+			return hash;
+	}
+	return 0;								// The type says it all
+}
+
+static const struct filter_rule *filter_rule(const struct filter_rule *rules, int count, const char *name)
+{
+	const struct filter_rule *any = NULL;
+	int i;
+
+	for (i = 0; i < count; i++) {
+		if (!strcmp(rules[i].field, name))
+			return &rules[i];
+		if (!strcmp(rules[i].field, FILTER_ANY))
+			any = &rules[i];
+	}
+	return any;
+}
+
+// The frame's member for a recorded field, through the key index when the object has one
+static cJSON *filter_item(cJSON *json, const struct filter_field *field)
+{
+	cJSON *item;
+
+	if (strlen(field->name) < FILTER_FIELD_LEN - 1)
+		return cJSON_GetObjectItemCS(json, field->name);
+
+	for (item = json->child; item; item = item->next) {
+		if (!strncmp(item->string, field->name, FILTER_FIELD_LEN - 1))	// Long names are cut
+			return item;
+	}
+	return NULL;
+}
+
+static bool filter_changed(struct filter_t *filter, cJSON *json, const struct filter_rule *rules, int rule_count)
+{
+	const struct filter_rule *rule;
+	struct filter_field *field;
+	cJSON *item;
+	double band;
+	int i, count = 0;
+
+	for (item = json->child; item; item = item->next)
+		count++;
+	if (count != filter->count)
+		return true;						// A field came or went
+
+	for (i = 0, field = filter->fields; i < filter->count; i++, field++) {
+		item = filter_item(json, field);
+		if (!item || field->type != (item->type & 255))
+			return true;
+
+		if (field->type == cJSON_Number) {
+			band = 0;
+			if ((rule = filter_rule(rules, rule_count, item->string)))
+				band = rule->relative ? fabs(field->value) * rule->band / 100.0 : rule->band;
+			if (fabs(item->valuedouble - field->value) > band)
+				return true;
+		} else if (field->hash != filter_hash_item(item)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+static void filter_record(struct filter_t *filter, cJSON *json)
+{
+	struct filter_field *field;
+	cJSON *item;
+	int count = 0;
+
+	for (item = json->child; item; item = item->next)
+		count++;
+	if (count > filter->alloc) {
+		field = realloc(filter->fields, count * sizeof(struct filter_field));
+		if (!field) {
+			fprintf(stderr, "Error: No memory left.\n");
+			exit(1);
+		}
+		filter->fields = field;
+		filter->alloc = count;
+	}
+
+	field = filter->fields;
+	for (item = json->child; item; item = item->next, field++) {
+		snprintf(field->name, FILTER_FIELD_LEN, "%s", item->string);
+		field->type = item->type & 255;
+		field->value = item->valuedouble;
+		field->hash = filter_hash_item(item);
+	}
+	filter->count = count;
+}
+
+// Whether the frame is worth publishing, remembered as the last published
+// one when it is. silence is the longest a device is kept quiet, 0 for ever.
+bool filter_pass(struct filter_t *filter, cJSON *json, const struct filter_rule *rules, int rule_count,
+		int silence, time_t now)
+{
+	if ((json->type & 255) != cJSON_Object)
+		return true;
+
+	if (filter->published && (!silence || now - filter->last < silence) &&
+			!filter_changed(filter, json, rules, rule_count)) {
+		filter->suppressed++;
+		return false;
+	}
+
+	filter_record(filter, json);
+	filter->published = true;
+	filter->last = now;
+	return true;
+}
@@ -0,0 +1,71 @@
+/*
+* The MIT License (MIT)
+*
+* Copyright (c) 2013, Marcelo Aquino, https://github.com/mapnull
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+* THE SOFTWARE.
+*/
+
+#ifndef FILTER_H
+#define FILTER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <time.h>
+
+#include "cJSON.h"
+
+/*
+* Report by exception: a device frame is only published when a field
+* changed since the last published one, numbers by more than their
+* deadband, or when the device was kept quiet for too long.
+*/
+
+#define FILTER_FIELD_LEN 32
+#define FILTER_ANY "*"						// Rule for the fields without one
+#define FILTER_PRINT_MAX 256				// Nested values hashed from the stack up to this size
+
+struct filter_rule {
+	char field[FILTER_FIELD_LEN];
+	double band;
+	bool relative;							// band is a percentage of the last value
+};
+
+struct filter_field {
+	char name[FILTER_FIELD_LEN];
+	int type;								// cJSON type
+	double value;							// Numbers
+	uint32_t hash;							// Anything else
+};
+
+struct filter_t {
+	struct filter_field *fields;
+	int count;
+	int alloc;
+	bool published;							// fields hold the last published frame
+	time_t last;							// When, CLOCK_MONOTONIC secs
+	long suppressed;
+};
+
+struct filter_t *filter_new(void);
+void filter_free(struct filter_t *);
+bool filter_pass(struct filter_t *, cJSON *, const struct filter_rule *, int, int, time_t);
+
+#endif
@@ -0,0 +1,171 @@
+/*
+* The MIT License (MIT)
+*
+* Copyright (c) 2013, Marcelo Aquino, https://github.com/mapnull
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+* THE SOFTWARE.
+*/
+
+#include "frame.h"
+#include "serial.h"
+#include "mqtt_bridge.h"
+
+struct cobs_enc {
+	uint8_t *out;
+	int len;
+	int code_pos;
+	uint8_t code;
+};
+
+static uint16_t frame_crc16_update(uint16_t crc, const uint8_t *data, int len)
+{
+	int i;
+
+	for (i = 0; i < len; i++) {
+		crc = (crc >> 8) | (crc << 8);
+		crc ^= data[i];
+		crc ^= (crc & 0xff) >> 4;
+		crc ^= crc << 12;
+		crc ^= (crc & 0xff) << 5;
+	}
+	return crc;
+}
+
+// CRC-16/CCITT-FALSE, poly 0x1021, init 0xffff
+uint16_t frame_crc16(const uint8_t *data, int len)
+{
+	return frame_crc16_update(0xffff, data, len);
+}
+
+static void cobs_put(struct cobs_enc *c, uint8_t b)
+{
+	if (b) {
+		c->out[c->len++] = b;
+		c->code++;
+	}
+	if (!b || c->code == 0xff) {
+		c->out[c->code_pos] = c->code;
+		c->code_pos = c->len++;
+		c->code = 1;
+	}
+}
+
+// Encodes the text frame "@X#body" of len bytes into out.
+// returns the encoded length, without the delimiter, or -1 if it doesn't fit
+int frame_encode(const char *frame, int len, uint8_t *out, int out_max)
+{
+	struct cobs_enc c;
+	uint16_t crc;
+	int i;
+
+	if (len < SERIAL_INIT_LEN || frame[0] != SERIAL_INIT_0 || frame[2] != SERIAL_INIT_2)
+		return -1;
+	if (out_max < FRAME_ENCODED_MAX(len - 2))
+		return -1;
+
+	// Message type and body, the '@' and '#' markers are implied
+	crc = frame_crc16_update(0xffff, (const uint8_t *)&frame[1], 1);
+	crc = frame_crc16_update(crc, (const uint8_t *)&frame[SERIAL_INIT_LEN], len - SERIAL_INIT_LEN);
+
+	c.out = out;
+	c.len = 1;
+	c.code_pos = 0;
+	c.code = 1;
+
+	cobs_put(&c, frame[1]);
+	for (i = SERIAL_INIT_LEN; i < len; i++)
+		cobs_put(&c, frame[i]);
+	cobs_put(&c, crc >> 8);
+	cobs_put(&c, crc & 0xff);
+
+	out[c.code_pos] = c.code;
+	return c.len;
+}
+
+// Decodes a frame received without its delimiter back into a null terminated
+// "@X#body" text frame.
+// returns the text frame length or -1 on a malformed frame or crc mismatch
+int frame_decode(const uint8_t *in, int len, char *frame, int frame_max)
+{
+	uint8_t code;
+	uint16_t crc;
+	int i = 0, j, out = 2;		// Leave room for the '@' in front of the type
+
+	while (i < len) {
+		code = in[i++];
+		if (code == 0 || i + code - 1 > len)
+			return -1;
+		for (j = 1; j < code; j++) {
+			if (out >= frame_max)
+				return -1;
+			frame[out++] = in[i++];
+		}
+		if (code < 0xff && i < len) {
+			if (out >= frame_max)
+				return -1;
+			frame[out++] = 0;
+		}
+	}
+
+	// out - 2 decoded bytes: type, body and the crc
+	if (out - 2 < 1 + FRAME_CRC_LEN)
+		return -1;
+
+	crc = ((uint8_t)frame[out - 2] << 8) | (uint8_t)frame[out - 1];
+	out -= FRAME_CRC_LEN;
+	if (frame_crc16((const uint8_t *)&frame[2], out - 2) != crc)
+		return -1;
+
+	// Type is at frame[2], rebuild "@X#" in front of the body
+	frame[0] = SERIAL_INIT_0;
+	frame[1] = frame[2];
+	frame[2] = SERIAL_INIT_2;
+	if (out >= frame_max)
+		return -1;
+	frame[out] = 0;
+	return out;
+}
+
+// Takes the next message off rx, a text line or, for any framing but
+// SERIAL_FRAMING_TEXT, a binary frame decoded into buf, scratch holding the
+// encoded frame.
+// returns its length, 0 for an empty line, SERIALPORT_NO_FRAME,
+// SERIALPORT_OVERFLOW or FRAME_INVALID
+int frame_next(struct serialport_rx *rx, int framing, char *buf, int buf_max, char *scratch, int scratch_max)
+{
+	int len;
+
+	if (framing == SERIAL_FRAMING_TEXT)
+		return serialport_frame(rx, buf, buf_max, '\n');
+
+	len = serialport_frame(rx, scratch, scratch_max, FRAME_DELIM);
+	if (len <= 0)
+		return len;
+	len = frame_decode((uint8_t *)scratch, len, buf, buf_max);
+	return len == -1 ? FRAME_INVALID : len;
+}
+
+// The framing a port configured for framing settles on when the board sends
+// @B#<level>: the lower of the two, text when level isn't an offer
+int frame_agree(char level, int framing)
+{
+	if (level < '1' || level > '9')
+		return SERIAL_FRAMING_TEXT;
+	return level - '0' < framing ? level - '0' : framing;
+}
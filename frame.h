@@ -0,0 +1,49 @@
+/*
+* The MIT License (MIT)
+*
+* Copyright (c) 2013, Marcelo Aquino, https://github.com/mapnull
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+* THE SOFTWARE.
+*/
+
+#ifndef FRAME_H
+#define FRAME_H
+
+#include <stdint.h>
+#include "arduino-serial-lib.h"
+
+/*
+* Binary serial framing: the frame "@X#body" travels as X + body + crc16,
+* COBS encoded so the only zero byte on the wire is the delimiter. Packed
+* framing is the same, the bridge packs and unpacks the json bodies.
+*/
+
+#define FRAME_DELIM 0x00
+#define FRAME_CRC_LEN 2
+#define FRAME_INVALID -16					// Bad crc or encoding, see frame_next()
+// Worst case encoded size of a len bytes text frame, without the delimiter
+#define FRAME_ENCODED_MAX(len) ((len) + ((len) / 254) + 1 + FRAME_CRC_LEN)
+
+uint16_t frame_crc16(const uint8_t *, int);
+int frame_encode(const char *, int, uint8_t *, int);
+int frame_decode(const uint8_t *, int, char *, int);
+int frame_next(struct serialport_rx *, int, char *, int, char *, int);
+int frame_agree(char, int);
+
+#endif
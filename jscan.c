@@ -0,0 +1,374 @@
+/*
+* The MIT License (MIT)
+*
+* Copyright (c) 2013, Marcelo Aquino, https://github.com/mapnull
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+* THE SOFTWARE.
+*/
+
+#include "jscan.h"
+
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#define JSCAN_KEY_MAX 32					// Longest escaped key compared
+
+static const char *scan_value(const char *, const char *, int);
+
+static const char *skip_ws(const char *p, const char *end)
+{
+	while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r'))
+		p++;
+	return p;
+}
+
+static int hex4(const char *p)
+{
+	int i, v = 0;
+
+	for (i = 0; i < 4; i++, p++) {
+		v <<= 4;
+		if (*p >= '0' && *p <= '9')
+			v |= *p - '0';
+		else if (*p >= 'a' && *p <= 'f')
+			v |= *p - 'a' + 10;
+		else if (*p >= 'A' && *p <= 'F')
+			v |= *p - 'A' + 10;
+		else
+			return -1;
+	}
+	return v;
+}
+
+// p on the opening quote, returns past the closing one or NULL
+static const char *scan_string(const char *p, const char *end)
+{
+	for (p++; p < end; p++) {
+		if (*p == '"')
+			return p + 1;
+		if ((unsigned char)*p < 0x20)
+			return NULL;
+		if (*p != '\\')
+			continue;
+		if (++p >= end)
+			return NULL;
+		switch (*p) {
+			case '"': case '\\': case '/':
+			case 'b': case 'f': case 'n': case 'r': case 't':
+				break;
+			case 'u':
+				if (end - p < 5 || hex4(p + 1) < 0)
+					return NULL;
+				p += 4;
+				break;
+			default:
+				return NULL;
+		}
+	}
+	return NULL;
+}
+
+static const char *scan_digits(const char *p, const char *end)
+{
+	if (p >= end || *p < '0' || *p > '9')
+		return NULL;
+	while (p < end && *p >= '0' && *p <= '9')
+		p++;
+	return p;
+}
+
+static const char *scan_number(const char *p, const char *end)
+{
+	if (p < end && *p == '-')
+		p++;
+	if (p < end && *p == '0')
+		p++;
+	else if (!(p = scan_digits(p, end)))
+		return NULL;
+	if (p < end && *p == '.' && !(p = scan_digits(p + 1, end)))
+		return NULL;
+	if (p < end && (*p == 'e' || *p == 'E')) {
+		p++;
+		if (p < end && (*p == '+' || *p == '-'))
+			p++;
+		p = scan_digits(p, end);
+	}
+	return p;
+}
+
+static const char *scan_literal(const char *p, const char *end, const char *word, int len)
+{
+	if (end - p < len || memcmp(p, word, len))
+		return NULL;
+	return p + len;
+}
+
+// Object or array, p on the opening bracket
+static const char *scan_container(const char *p, const char *end, int depth)
+{
+	char close = *p == '{' ? '}' : ']';
+
+	if (depth >= JSCAN_DEPTH_MAX)
+		return NULL;
+
+	p = skip_ws(p + 1, end);
+	if (p < end && *p == close)
+		return p + 1;
+	for (;;) {
+		if (close == '}') {
+			if (p >= end || *p != '"' || !(p = scan_string(p, end)))
+				return NULL;
+			p = skip_ws(p, end);
+			if (p >= end || *p != ':')
+				return NULL;
+			p = skip_ws(p + 1, end);
+		}
+		if (!(p = scan_value(p, end, depth + 1)))
+			return NULL;
+		p = skip_ws(p, end);
+		if (p >= end)
+			return NULL;
+		if (*p == close)
+			return p + 1;
+		if (*p != ',')
+			return NULL;
+		p = skip_ws(p + 1, end);
+	}
+}
+
+static int value_type(char c)
+{
+	switch (c) {
+		case '"': return JSCAN_STRING;
+		case '{': return JSCAN_OBJECT;
+		case '[': return JSCAN_ARRAY;
+		case 't': return JSCAN_TRUE;
+		case 'f': return JSCAN_FALSE;
+		case 'n': return JSCAN_NULL;
+		default: return JSCAN_NUMBER;
+	}
+}
+
+// p on the first character of the value, returns past its last one or NULL
+static const char *scan_value(const char *p, const char *end, int depth)
+{
+	if (p >= end)
+		return NULL;
+	switch (value_type(*p)) {
+		case JSCAN_STRING: return scan_string(p, end);
+		case JSCAN_OBJECT:
+		case JSCAN_ARRAY: return scan_container(p, end, depth);
+		case JSCAN_TRUE: return scan_literal(p, end, "true", 4);
+		case JSCAN_FALSE: return scan_literal(p, end, "false", 5);
+		case JSCAN_NULL: return scan_literal(p, end, "null", 4);
+		default: return scan_number(p, end);
+	}
+}
+
+bool jscan_validate(const char *json, int len)
+{
+	const char *end = json + len;
+	const char *p;
+
+	p = scan_value(skip_ws(json, end), end, 0);
+	return p && skip_ws(p, end) == end;
+}
+
+// Case insensitive, as cJSON_GetObjectItem(). key is past the opening quote.
+static bool key_match(const char *key, int len, bool escaped, const char *want)
+{
+	char buf[JSCAN_KEY_MAX];
+	const char *end;
+	int n;
+
+	if (!escaped) {
+		// Folds letters to lower case, cheap enough to try every key with
+		if (!len || (key[0] | 0x20) != (want[0] | 0x20))
+			return len == 0 && want[0] == 0;
+		return (int)strlen(want) == len && !strncasecmp(key, want, len);
+	}
+
+	n = jscan_unescape(key, NULL, &end);
+	if (n < 0 || n >= JSCAN_KEY_MAX)
+		return false;
+	jscan_unescape(key, (uint8_t *)buf, &end);
+	buf[n] = 0;
+	return !strcasecmp(buf, want);
+}
+
+// Validates an object and finds the top level keys[], the first of duplicates wins.
+// Keys not present get JSCAN_NONE.
+bool jscan_keys(const char *json, int len, const char **keys, struct jscan_val *vals, int n)
+{
+	const char *end = json + len;
+	const char *p, *key, *val;
+	int i, key_len;
+	bool escaped;
+
+	for (i = 0; i < n; i++)
+		vals[i].type = JSCAN_NONE;
+
+	p = skip_ws(json, end);
+	if (p >= end || *p != '{')
+		return false;
+	p = skip_ws(p + 1, end);
+	if (p < end && *p == '}')
+		return skip_ws(p + 1, end) == end;
+
+	for (;;) {
+		if (p >= end || *p != '"' || !(val = scan_string(p, end)))
+			return false;
+		key = p + 1;
+		key_len = val - key - 1;
+		p = skip_ws(val, end);
+		if (p >= end || *p != ':')
+			return false;
+		val = skip_ws(p + 1, end);
+		if (!(p = scan_value(val, end, 1)))
+			return false;
+
+		escaped = memchr(key, '\\', key_len) != NULL;
+		for (i = 0; i < n; i++) {
+			if (vals[i].type == JSCAN_NONE && key_match(key, key_len, escaped, keys[i])) {
+				vals[i].start = val;
+				vals[i].len = p - val;
+				vals[i].type = value_type(*val);
+				break;
+			}
+		}
+
+		p = skip_ws(p, end);
+		if (p >= end)
+			return false;
+		if (*p == '}')
+			return skip_ws(p + 1, end) == end;
+		if (*p != ',')
+			return false;
+		p = skip_ws(p + 1, end);
+	}
+}
+
+// Truncated toward zero and clamped, as cJSON valueint
+bool jscan_int(const struct jscan_val *val, int *out)
+{
+	double d;
+
+	if (val->type != JSCAN_NUMBER)
+		return false;
+	d = strtod(val->start, NULL);
+	if (d >= INT_MAX)
+		*out = INT_MAX;
+	else if (d <= INT_MIN)
+		*out = INT_MIN;
+	else
+		*out = (int)d;
+	return true;
+}
+
+// Unescapes a string value into buf, NUL terminated. Returns its length or -1
+// when it is not a string or does not fit.
+int jscan_string(const struct jscan_val *val, char *buf, int size)
+{
+	const char *end;
+	int n;
+
+	if (val->type != JSCAN_STRING)
+		return -1;
+	n = jscan_unescape(val->start + 1, NULL, &end);
+	if (n < 0 || n >= size)
+		return -1;
+	jscan_unescape(val->start + 1, (uint8_t *)buf, &end);
+	buf[n] = 0;
+	return n;
+}
+
+// Decodes a JSON string, p past the opening quote, into dst when not NULL.
+// Returns the decoded length or -1, end is set past the closing quote.
+int jscan_unescape(const char *p, uint8_t *dst, const char **end)
+{
+	uint8_t utf[4];
+	int c, c2, n = 0, len;
+
+	while (*p != '"') {
+		if (!*p)
+			return -1;
+		if (*p != '\\') {
+			if (dst)
+				dst[n] = *p;
+			n++;
+			p++;
+			continue;
+		}
+		p++;
+		len = 1;
+		switch (*p) {
+			case '"':
+			case '\\':
+			case '/':
+				utf[0] = *p;
+				break;
+			case 'b': utf[0] = '\b'; break;
+			case 'f': utf[0] = '\f'; break;
+			case 'n': utf[0] = '\n'; break;
+			case 'r': utf[0] = '\r'; break;
+			case 't': utf[0] = '\t'; break;
+			case 'u':
+				if ((c = hex4(p + 1)) < 0)
+					return -1;
+				p += 4;
+				if (c >= 0xd800 && c < 0xdc00) {		// Surrogate pair
+					if (p[1] != '\\' || p[2] != 'u' || (c2 = hex4(p + 3)) < 0xdc00 || c2 > 0xdfff)
+						return -1;
+					c = 0x10000 + ((c - 0xd800) << 10) + (c2 - 0xdc00);
+					p += 6;
+				} else if (c >= 0xdc00 && c <= 0xdfff) {
+					return -1;
+				}
+				if (c < 0x80) {
+					utf[0] = c;
+				} else if (c < 0x800) {
+					utf[0] = 0xc0 | c >> 6;
+					utf[1] = 0x80 | (c & 0x3f);
+					len = 2;
+				} else if (c < 0x10000) {
+					utf[0] = 0xe0 | c >> 12;
+					utf[1] = 0x80 | (c >> 6 & 0x3f);
+					utf[2] = 0x80 | (c & 0x3f);
+					len = 3;
+				} else {
+					utf[0] = 0xf0 | c >> 18;
+					utf[1] = 0x80 | (c >> 12 & 0x3f);
+					utf[2] = 0x80 | (c >> 6 & 0x3f);
+					utf[3] = 0x80 | (c & 0x3f);
+					len = 4;
+				}
+				break;
+			default:
+				return -1;
+		}
+		if (dst)
+			memcpy(dst + n, utf, len);
+		n += len;
+		p++;
+	}
+	*end = p + 1;
+	return n;
+}
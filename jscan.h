@@ -0,0 +1,61 @@
+/*
+* The MIT License (MIT)
+*
+* Copyright (c) 2013, Marcelo Aquino, https://github.com/mapnull
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+* THE SOFTWARE.
+*/
+
+#ifndef JSCAN_H
+#define JSCAN_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+* Single pass JSON scanner, no allocation. jscan_validate() checks a whole
+* document against RFC 8259; jscan_keys() also records where the wanted
+* top level members of an object are, so a few values can be read without
+* building a cJSON tree. Input must be NUL terminated at len or later.
+*/
+
+#define JSCAN_NONE 0						// Key not found
+#define JSCAN_STRING 1
+#define JSCAN_NUMBER 2
+#define JSCAN_OBJECT 3
+#define JSCAN_ARRAY 4
+#define JSCAN_TRUE 5
+#define JSCAN_FALSE 6
+#define JSCAN_NULL 7
+
+#define JSCAN_DEPTH_MAX 32
+
+struct jscan_val {
+	const char *start;						// First character, the quote for strings
+	int len;
+	int type;
+};
+
+bool jscan_validate(const char *, int);
+bool jscan_keys(const char *, int, const char **, struct jscan_val *, int);
+bool jscan_int(const struct jscan_val *, int *);
+int jscan_string(const struct jscan_val *, char *, int);
+int jscan_unescape(const char *, uint8_t *, const char **);
+
+#endif
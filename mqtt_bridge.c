@@ -24,6 +24,7 @@
 
 #include <errno.h>
 #include <signal.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -31,6 +32,7 @@
 
 #include <time.h>
 #include <sys/time.h>
+#include <sys/signalfd.h>
 
 #include <mosquitto.h>
 
@@ -43,11 +45,40 @@
 #include "serial.h"
 #include "netdev.c"
 #include "cJSON.h"
+#include "event.h"
+#include "frame.h"
+#include "registry.h"
+#include "pipeline.h"
+#include "spool.h"
+#include "batch.h"
+#include "pack.h"
+#include "jscan.h"
+#include "pool.h"
+#include "arena.h"
+#include "filter.h"
+#include "outbox.h"
+#include "comma.h"
 
 #define MICRO_PER_SECOND	1000000.0
-#define SERIAL_MAX_BUF 100
-#define MAX_OUTPUT 256
 #define GBUF_SIZE 100
+#define JSON_ARENA_SIZE 4096			// Grows to the largest message seen
+#define JSON_INDEX_MIN 16				// Parsed objects this wide get a key index
+#define JSON_STATS_SIZE 1024			// First guess for the stats text, grows if short
+#define MQTT_SUB_BATCH 64			// Topics per SUBSCRIBE packet
+#define MQTT_RING_SLOTS 256			// Callbacks on their way from the mosquitto thread
+#define SERIAL_TX_RETRY 10			// msecs, pipeline mode polls a full port with the tx timer
+
+#define MQTT_EV_CONNECT 0
+#define MQTT_EV_DISCONNECT 1
+#define MQTT_EV_MESSAGE 2
+#define MQTT_EV_SUBSCRIBE 3
+#define MQTT_EV_PUBLISH 4
+
+struct mqtt_event {
+	int kind;
+	int rc;								// Connect result, disconnect reason or mid
+	struct mosquitto_message *msg;
+};
 
 const char version[] = "0.3.2";
 
@@ -57,31 +88,68 @@ const char eolchar = '\n';
 
 static int run = 1;
 static int user_signal = false;
+static struct mosquitto *mosq;
 static bool bandwidth = false;
 struct bridge_config config;
 static double downspeed, upspeed;
 static unsigned long seconds = 0;
 static bool quiet = false;
 static bool connected = true;
+static bool mqtt_reconnect = false;
 
 char gbuf[GBUF_SIZE];
 
-void handle_signal(int signum)
+static struct event_t mqtt_ev, timer_ev, signal_ev, pipe_ev, batch_ev;
+static struct ring_t mqtt_ring;
+static struct spool_t spool;
+static int spool_budget = 0;			// Replays left until the next tick
+static int spool_live = 0;				// Messages spooled while connected, this tick
+static struct batch_t *batch_bridge;
+static struct batch_t *batch_pending;	// Batches with frames, flushed by batch_ev
+static uint8_t *pack_buf;				// Payloads in the payload_encoding
+static int pack_size = 0;
+static atomic_int broker_aliases;		// Topic Alias Maximum of the last CONNACK
+static struct device_t **alias_map;		// Device holding each topic alias
+static int alias_count = 0;
+static int alias_next = 1;
+static int alias_free = 0;				// Aliases given back by removed devices
+static unsigned int alias_gen = 0;		// Bumped on every connect
+static long filter_passed = 0;
+static struct outbox_t outbox;			// With mqtt_inflight
+static bool outbox_sending = false;		// Inside mqtt_send()
+static long filter_suppressed = 0;
+static struct arena_t json_arena;		// cJSON memory between json_begin() and json_end()
+static int json_depth = 0;
+
+static char sub_topics[MQTT_SUB_BATCH][UUID_LEN + 3];	// Longest is "<bridge uuid>/+"
+static int sub_count = 0;
+static int sub_mid = 0;				// Last SUBSCRIBE sent
+static int sub_last_mid = 0;			// SUBACK that completes the connect
+static struct timespec connect_start;
+
+void signal_usr(struct mosquitto *mosq);
+void serial_send(struct bridge_port *port, char *str);
+void serial_send_prefixed(struct bridge_port *port, const char *prefix, int prefix_len, const char *body);
+int serial_process_frame(struct bridge_port *port, struct mosquitto *mosq, char *frame, int len);
+
+void handle_signal(int fd, uint32_t events, void *data)
 {
-	if (config.debug > 1) printf("Signal: %d\n", signum);
+	struct signalfd_siginfo si;
 
-	if (signum == SIGUSR1) {
-		user_signal = SIGUSR1;
-		return;
-	}
-	else if(signum == SIGUSR2) {
-		user_signal = SIGUSR2;
-		return;
+	while (read(fd, &si, sizeof(si)) == sizeof(si)) {
+		if (config.debug > 1) printf("Signal: %d\n", si.ssi_signo);
+
+		if (si.ssi_signo == SIGUSR1 || si.ssi_signo == SIGUSR2) {
+			user_signal = si.ssi_signo;
+			if (config.debug > 2) printf("Signal - SIGUSR: %d\n", user_signal);
+			signal_usr(mosq);
+		} else {
+			run = 0;
+		}
 	}
-    run = 0;
 }
 
-void each_sec(int x)
+void each_sec(void)
 {
 	static struct timeval t1, t2;
 	double drift;
@@ -121,22 +189,402 @@ void each_sec(int x)
 		}
 		cnt++;
 	}
+}
 
-	alarm(1);
+// Aliases only last one connection, start over with the broker's limit
+void mqtt_alias_reset(void)
+{
+	alias_count = atomic_load(&broker_aliases);
+	if (alias_count > config.topic_aliases)
+		alias_count = config.topic_aliases;
+
+	alias_map = realloc(alias_map, (alias_count + 1) * sizeof(struct device_t *));
+	if (!alias_map) {
+		fprintf(stderr, "Error: No memory left.\n");
+		exit(1);
+	}
+	memset(alias_map, 0, (alias_count + 1) * sizeof(struct device_t *));
+	alias_next = 1;
+	alias_free = 0;
+	alias_gen++;
+	if (config.debug > 1 && alias_count) printf("MQTT - %d topic aliases.\n", alias_count);
 }
 
-int mqtt_publish(struct mosquitto *mosq, char *topic, char *payload)
+// Topic alias of the device, 0 for none. known is false when the alias is
+// new and has to be sent along with the topic to set it up.
+int mqtt_alias(struct device_t *device, bool *known)
 {
-	int rc;
+	int alias;
+
+	*known = false;
+	if (device->alias && device->alias_gen == alias_gen && alias_map[device->alias] == device) {
+		*known = device->alias_known;
+		return device->alias;
+	}
+
+	// First come first served until the next connect. Taking mappings
+	// over would have every publish carry its topic again once there are
+	// more devices than aliases.
+	if (alias_next <= alias_count) {
+		alias = alias_next++;
+	} else if (alias_free) {
+		for (alias = 1; alias_map[alias]; alias++);
+		alias_free--;
+	} else {
+		return 0;
+	}
+	device->alias = alias;
+	device->alias_gen = alias_gen;
+	device->alias_known = false;
+	alias_map[alias] = device;
+	return alias;
+}
+
+// Gives the alias of a device going away to the next one that asks
+void mqtt_alias_forget(struct device_t *device)
+{
+	if (device->alias && device->alias_gen == alias_gen && alias_map[device->alias] == device) {
+		alias_map[device->alias] = NULL;
+		alias_free++;
+	}
+	device->alias = 0;
+}
+
+long long mqtt_clock(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000LL + now.tv_nsec / 1000000;
+}
+
+// Hands the message to mosquitto. Device topics carry telemetry, MAIN_TOPIC
+// the bridge's own messages.
+int mqtt_send(struct mosquitto *mosq, char *topic, struct device_t *device, void *payload, int len, int qos)
+{
+	mosquitto_property *props = NULL;
+	bool telemetry, known = false;
+	int rc, mid, alias = 0;
+
+	telemetry = strcmp(topic, MAIN_TOPIC);
+
+	if (config.mqtt_version == MQTT_VERSION_5) {
+		if (device && (alias = mqtt_alias(device, &known)))
+			mosquitto_property_add_int16(&props, MQTT_PROP_TOPIC_ALIAS, alias);
+		if (telemetry && config.message_expiry)
+			mosquitto_property_add_int32(&props, MQTT_PROP_MESSAGE_EXPIRY_INTERVAL, config.message_expiry);
+	}
 
-	rc = mosquitto_publish(mosq, NULL, topic, strlen(payload), payload, config.mqtt_qos, false);
+	outbox_sending = true;
+	rc = mosquitto_publish_v5(mosq, &mid, known ? NULL : topic, len, payload, qos, false, props);
+	outbox_sending = false;
+	mosquitto_property_free_all(&props);
 	if (rc) {
+		if (alias)
+			device->alias_known = false;	// Same alias, the topic goes along again
 		fprintf(stderr, "Error: MQTT publish returned: %s\n", mosquitto_strerror(rc));
 		return 0;
 	}
+	if (alias)
+		device->alias_known = true;
+	if (config.mqtt_inflight)
+		outbox_sent(&outbox, mid, qos, mqtt_clock());
 	return 1;
 }
 
+int mqtt_publish_raw(struct mosquitto *mosq, char *topic, struct device_t *device, void *payload, int len, int qos)
+{
+	// Offline, or still replaying: keep the order. Bridge replies don't
+	// wait behind the backlog.
+	if (config.spool_dir && (!connected || (spool.count && strcmp(topic, MAIN_TOPIC)))) {
+		if (spool_push(&spool, topic, payload, len, qos | (strcmp(topic, MAIN_TOPIC) ? SPOOL_EXPIRES : 0)) &&
+				config.debug > 1)
+			printf("Spool - Dropped message for %s\n", topic);
+		else if (connected)
+			spool_live++;
+		return 1;
+	}
+
+	// In-flight window full, or others already waiting
+	if (config.mqtt_inflight && !outbox_ready(&outbox)) {
+		if (outbox_push(&outbox, topic, device, payload, len, qos, mqtt_clock()) && config.debug > 1)
+			printf("MQTT - Outbox full, dropped message for %s\n", topic);
+		return 1;
+	}
+
+	return mqtt_send(mosq, topic, device, payload, len, qos);
+}
+
+// Sends what waits in the outbox, as far as the in-flight window goes
+void mqtt_outbox_drain(struct mosquitto *mosq)
+{
+	struct outbox_msg *msg;
+
+	while (connected && (msg = outbox_peek(&outbox))) {
+		mqtt_send(mosq, msg->topic, msg->device, msg->payload, msg->len, msg->qos);
+		outbox_pop(&outbox, mqtt_clock());
+	}
+}
+
+void on_mqtt_publish(struct mosquitto *mosq, void *obj, int mid)
+{
+	outbox_acked(&outbox, mid, mqtt_clock());
+	if (!outbox_sending)
+		mqtt_outbox_drain(mosq);
+}
+
+// Packs JSON text, or the cJSON tree when text is NULL, into pack_buf
+int mqtt_pack(char *text, cJSON *json)
+{
+	int len;
+
+	for (;;) {
+		if (text)
+			len = pack_json(config.payload_encoding, text, pack_buf, pack_size);
+		else
+			len = pack_cjson(config.payload_encoding, json, pack_buf, pack_size);
+		if (len != PACK_NO_ROOM)
+			return len;
+
+		pack_size = pack_size ? pack_size * 2 : GBUF_SIZE;
+		pack_buf = realloc(pack_buf, pack_size);
+		if (!pack_buf) {
+			fprintf(stderr, "Error: No memory left.\n");
+			exit(1);
+		}
+	}
+}
+
+int mqtt_publish_text(struct mosquitto *mosq, char *topic, struct device_t *device, char *payload, int qos)
+{
+	int len;
+
+	if (config.payload_encoding != PACK_JSON) {
+		len = mqtt_pack(payload, NULL);
+		if (len > 0)
+			return mqtt_publish_raw(mosq, topic, device, pack_buf, len, qos);
+		if (config.debug > 1) printf("MQTT - Not JSON, published as text on %s\n", topic);
+	}
+	return mqtt_publish_raw(mosq, topic, device, payload, strlen(payload), qos);
+}
+
+int mqtt_publish_qos(struct mosquitto *mosq, char *topic, char *payload, int qos)
+{
+	return mqtt_publish_text(mosq, topic, NULL, payload, qos);
+}
+
+int mqtt_publish_device(struct mosquitto *mosq, struct device_t *device, char *payload, int qos)
+{
+	return mqtt_publish_text(mosq, device->topic, device, payload, qos);
+}
+
+int mqtt_publish(struct mosquitto *mosq, char *topic, char *payload)
+{
+	return mqtt_publish_qos(mosq, topic, payload, config.mqtt_qos);
+}
+
+// Sends spooled messages while the tick's budget and the in-flight window
+// allow, called from the event loop
+void spool_replay(struct mosquitto *mosq)
+{
+	mosquitto_property *props;
+	struct spool_msg msg;
+	int rc, mid;
+	long age;
+
+	while (spool_budget > 0 && spool_peek(&spool, &msg)) {
+		if (config.mqtt_inflight && outbox.inflight >= outbox.max)
+			return;
+
+		props = NULL;
+		age = time(NULL) - msg.time;
+		if (config.mqtt_version == MQTT_VERSION_5 && config.message_expiry && msg.expires) {
+			if (age >= config.message_expiry) {
+				if (config.debug > 2) printf("Spool - Expired %s, %lds old\n", msg.topic, age);
+				spool_pop(&spool);
+				continue;
+			}
+			mosquitto_property_add_int32(&props, MQTT_PROP_MESSAGE_EXPIRY_INTERVAL, config.message_expiry - age);
+		}
+		outbox_sending = true;
+		rc = mosquitto_publish_v5(mosq, &mid, msg.topic, msg.len, msg.payload, msg.qos, false, props);
+		outbox_sending = false;
+		mosquitto_property_free_all(&props);
+		if (rc) {
+			if (config.debug > 1) printf("Spool - Replay: %s\n", mosquitto_strerror(rc));
+			return;
+		}
+		if (config.mqtt_inflight)
+			outbox_sent(&outbox, mid, msg.qos, mqtt_clock());
+		if (config.debug > 2) printf("Spool - Replayed %s, %lds old\n", msg.topic, age);
+		spool_pop(&spool);
+		spool_budget--;
+	}
+}
+
+void batch_flush(struct mosquitto *mosq, struct batch_t *batch)
+{
+	if (batch->pending) {
+		if (batch->prev)
+			batch->prev->next = batch->next;
+		else
+			batch_pending = batch->next;
+		if (batch->next)
+			batch->next->prev = batch->prev;
+		batch->pending = false;
+	}
+	if (!batch->count)
+		return;
+
+	mqtt_publish_qos(mosq, batch->topic, batch_finish(batch), batch->qos);
+	batch_reset(batch);
+}
+
+static void *json_malloc(size_t size)
+{
+	return arena_alloc(&json_arena, size);
+}
+
+static void json_free(void *ptr)
+{
+	if (!arena_owns(&json_arena, ptr))
+		free(ptr);							// From before json_begin()
+}
+
+// cJSON allocates from json_arena until the matching json_end(), main thread only
+void json_begin(void)
+{
+	cJSON_Hooks hooks = { json_malloc, json_free };
+
+	if (json_depth++ == 0)
+		cJSON_InitHooks(&hooks);
+}
+
+// Everything cJSON allocated since json_begin() is gone, no cJSON_Delete() needed
+void json_end(void)
+{
+	if (--json_depth > 0)
+		return;
+	cJSON_InitHooks(NULL);
+	arena_reset(&json_arena);
+}
+
+// Report by exception, false when the frame adds nothing to the last published one
+bool device_filter(struct device_t *device, char *payload)
+{
+	struct timespec now;
+	cJSON *json;
+	bool pass;
+
+	json_begin();
+	json = cJSON_Parse(payload);
+	if (!json) {
+		json_end();
+		return true;
+	}
+	if (!device->filter)
+		device->filter = filter_new();
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	pass = filter_pass(device->filter, json, config.deadbands, config.deadband_count, config.deadband_silence, now.tv_sec);
+	json_end();
+
+	if (pass) {
+		filter_passed++;
+	} else {
+		filter_suppressed++;
+		if (config.debug > 2) printf("Device: %s - Suppressed, %ld so far.\n", device->uuid, device->filter->suppressed);
+	}
+	return pass;
+}
+
+// Publishes a device message, straight or through its aggregation window
+void device_publish(struct mosquitto *mosq, struct device_t *device, char *payload, int qos)
+{
+	struct batch_t *batch;
+	struct timespec now;
+	const char *topic = NULL;
+	long long ts;
+
+	if (!jscan_validate(payload, strlen(payload))) {
+		device->port->bad_json++;
+		if (config.debug > 1) printf("Device: %s - Invalid JSON: %s\n", device->uuid, payload);
+		return;
+	}
+
+	if (config.deadband_count && !device_filter(device, payload))
+		return;
+
+	if (config.aggregate == BATCH_OFF) {
+		mqtt_publish_device(mosq, device, payload, qos);
+		return;
+	}
+
+	if (config.aggregate == BATCH_BRIDGE) {
+		batch = batch_bridge;
+		topic = device->topic;
+	} else {
+		if (!device->batch)
+			device->batch = batch_new(config.aggregate_size);
+		batch = device->batch;
+		if (!batch->count)
+			snprintf(batch->topic, BATCH_TOPIC_LEN, "%s/batch", device->topic);
+	}
+
+	clock_gettime(CLOCK_REALTIME, &now);
+	ts = now.tv_sec * 1000LL + now.tv_nsec / 1000000;
+	if (batch_add(batch, topic, payload, ts, qos)) {
+		batch_flush(mosq, batch);
+		if (batch_add(batch, topic, payload, ts, qos)) {
+			mqtt_publish_device(mosq, device, payload, qos);		// Bigger than a batch
+			return;
+		}
+	}
+
+	if (!batch->pending) {
+		batch->pending = true;
+		batch->prev = NULL;
+		batch->next = batch_pending;
+		if (batch->next)
+			batch->next->prev = batch;
+		batch_pending = batch;
+	}
+}
+
+// Names the values of a comma frame with the device's template and publishes them as JSON
+void device_publish_comma(struct mosquitto *mosq, struct device_t *device, const char *values, int len, int qos)
+{
+	struct comma_value vals[COMMA_FIELDS_MAX];
+	const struct comma_template *tpl;
+	char *json;
+	int count;
+
+	count = len ? comma_parse(values, len, vals, COMMA_FIELDS_MAX) : -1;
+	if (count < 0) {
+		device->port->bad_comma++;
+		if (config.debug > 1) printf("Device: %s - Invalid comma data: %.*s\n", device->uuid, len, values);
+		return;
+	}
+
+	tpl = comma_find(config.comma_templates, config.comma_count, device->uuid);
+	json = pool_get(COMMA_JSON_MAX);
+	if (json && comma_json(tpl, vals, count, json, COMMA_JSON_MAX) > 0)
+		device_publish(mosq, device, json, qos);
+	pool_put(json);
+}
+
+void handle_batch(int fd, uint32_t events, void *data)
+{
+	struct mosquitto *mosq = data;
+	uint64_t expirations;
+
+	if (read(fd, &expirations, sizeof(expirations)) != sizeof(expirations))
+		return;
+
+	while (batch_pending)
+		batch_flush(mosq, batch_pending);
+}
+
 void send_alive(struct mosquitto *mosq) {
 	static unsigned int beacon_num = 1;
 
@@ -145,33 +593,171 @@ void send_alive(struct mosquitto *mosq) {
 		beacon_num++;
 }
 
+void send_stats(struct mosquitto *mosq, int tid)
+{
+	struct bridge_port *port;
+	struct pool_stats pool;
+	cJSON *json, *serial, *item;
+	char *out;
+	int i, len;
+
+	json_begin();
+	json = cJSON_CreateObject();
+	cJSON_AddNumberToObject(json, "tid", tid);
+
+	serial = cJSON_CreateArray();
+	for (i = 0; i < bridge.port_count; i++) {
+		port = &bridge.ports[i];
+		item = cJSON_CreateObject();
+		cJSON_AddNumberToObject(item, "port", port->index);
+		cJSON_AddNumberToObject(item, "queue", port->txq.depth);
+		cJSON_AddNumberToObject(item, "queue_max", port->txq.max_depth);
+		cJSON_AddNumberToObject(item, "sent", port->txq.sent);
+		cJSON_AddNumberToObject(item, "dropped", port->txq.dropped);
+		cJSON_AddNumberToObject(item, "wait_avg", port->txq.sent ? port->txq.wait_total / port->txq.sent : 0);
+		cJSON_AddNumberToObject(item, "wait_max", port->txq.wait_max);
+		cJSON_AddStringToObject(item, "framing", port->framing == SERIAL_FRAMING_PACKED ? "packed" :
+			port->framing == SERIAL_FRAMING_BINARY ? "binary" : "text");
+		cJSON_AddNumberToObject(item, "bad_frames", port->bad_frames);
+		cJSON_AddNumberToObject(item, "bad_json", port->bad_json);
+		cJSON_AddNumberToObject(item, "bad_comma", port->bad_comma);
+		cJSON_AddItemToArray(serial, item);
+	}
+	cJSON_AddItemToObject(json, "serial", serial);
+
+	if (config.spool_dir) {
+		item = cJSON_CreateObject();
+		cJSON_AddNumberToObject(item, "queued", spool.count);
+		cJSON_AddNumberToObject(item, "size", spool.size);
+		cJSON_AddNumberToObject(item, "dropped", spool.dropped);
+		cJSON_AddNumberToObject(item, "replayed", spool.replayed);
+		cJSON_AddItemToObject(json, "spool", item);
+	}
+
+	if (config.mqtt_inflight) {
+		item = cJSON_CreateObject();
+		cJSON_AddNumberToObject(item, "inflight", outbox.inflight);
+		cJSON_AddNumberToObject(item, "queued", outbox.count);
+		cJSON_AddNumberToObject(item, "sent", outbox.sent);
+		cJSON_AddNumberToObject(item, "dropped", outbox.dropped);
+		cJSON_AddNumberToObject(item, "wait_avg", outbox.waited ? outbox.wait_total / outbox.waited : 0);
+		cJSON_AddNumberToObject(item, "wait_max", outbox.wait_max);
+		cJSON_AddNumberToObject(item, "ack_avg", outbox.acked ? outbox.ack_total / outbox.acked : 0);
+		cJSON_AddNumberToObject(item, "ack_max", outbox.ack_max);
+		cJSON_AddItemToObject(json, "mqtt", item);
+	}
+
+	if (config.deadband_count) {
+		item = cJSON_CreateObject();
+		cJSON_AddNumberToObject(item, "passed", filter_passed);
+		cJSON_AddNumberToObject(item, "suppressed", filter_suppressed);
+		cJSON_AddItemToObject(json, "filter", item);
+	}
+
+	pool_stats(&pool);
+	item = cJSON_CreateObject();
+	cJSON_AddNumberToObject(item, "gets", pool.gets);
+	cJSON_AddNumberToObject(item, "mallocs", pool.mallocs);
+	cJSON_AddNumberToObject(item, "cached", pool.cached);
+	cJSON_AddItemToObject(json, "pool", item);
+
+	item = cJSON_CreateObject();
+	cJSON_AddNumberToObject(item, "arena", json_arena.size);
+	cJSON_AddNumberToObject(item, "heap_calls", json_arena.heap_calls);
+	cJSON_AddItemToObject(json, "json", item);
+
+	if (config.payload_encoding != PACK_JSON) {
+		len = mqtt_pack(NULL, json);
+		if (len > 0)
+			mqtt_publish_raw(mosq, MAIN_TOPIC, NULL, pack_buf, len, config.mqtt_qos);
+	} else {
+		out = cJSON_PrintBuffered(json, JSON_STATS_SIZE, 0);
+		if (out)
+			mqtt_publish(mosq, MAIN_TOPIC, out);
+	}
+	json_end();
+}
+
+// Sends the queued topics in one SUBSCRIBE
+void mqtt_subscribe_flush(struct mosquitto *mosq)
+{
+	char *topics[MQTT_SUB_BATCH];
+	int rc, i;
+
+	if (!sub_count)
+		return;
+
+	for (i = 0; i < sub_count; i++)
+		topics[i] = sub_topics[i];
+	rc = mosquitto_subscribe_multiple(mosq, &sub_mid, sub_count, topics, config.mqtt_qos, 0, NULL);
+	if (rc) {
+		fprintf(stderr, "MQTT - Subscribe ERROR: %s\n", mosquitto_strerror(rc));
+		run = 0;
+	} else if (config.debug > 1) {
+		printf("Subscribed to %d topics.\n", sub_count);
+	}
+	sub_count = 0;
+}
+
+// Queues a topic for the next SUBSCRIBE, the batch goes out when full or
+// when the event loop comes around
+void mqtt_subscribe(struct mosquitto *mosq, const char *topic)
+{
+	size_t len = strlen(topic);
+
+	if (len >= sizeof(sub_topics[0])) {
+		fprintf(stderr, "MQTT - Subscribe ERROR: topic too long: %s\n", topic);
+		return;
+	}
+	memcpy(sub_topics[sub_count++], topic, len + 1);
+	if (sub_count == MQTT_SUB_BATCH)
+		mqtt_subscribe_flush(mosq);
+}
+
+void on_mqtt_subscribe(struct mosquitto *mosq, void *obj, int mid, int qos_count, const int *granted_qos)
+{
+	struct timespec now;
+
+	if (mid != sub_last_mid)
+		return;
+
+	sub_last_mid = 0;
+	if (config.debug) {
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		printf("MQTT ready in %.1f ms, %d devices.\n",
+			(now.tv_sec - connect_start.tv_sec) * 1000.0 + (now.tv_nsec - connect_start.tv_nsec) / 1000000.0,
+			bridge.devices);
+	}
+}
+
 void on_mqtt_connect(struct mosquitto *mosq, void *obj, int result)
 {
 	struct device_t *device;
-	int rc;
 
 	if (!result) {
 		connected = true;
 		if(config.debug) printf("MQTT Connected.\n");
+		mqtt_alias_reset();
 
-		rc = mosquitto_subscribe(mosq, NULL, bridge.uuid, config.mqtt_qos);
-		if (rc) {
-			fprintf(stderr, "MQTT - Subscribe ERROR: %s\n", mosquitto_strerror(rc));
-			run = 0;
-			return;
+		sub_count = 0;
+		mqtt_subscribe(mosq, bridge.uuid);
+		if (config.mqtt_subscribe == MQTT_SUBSCRIBE_WILDCARD) {
+			snprintf(gbuf, GBUF_SIZE, "%s/+", bridge.uuid);
+			mqtt_subscribe(mosq, gbuf);
 		}
 
 		for (device = bridge.device_list; device != NULL; device = device->next) {
-			device->server_id = 0;
-			rc = mosquitto_subscribe(mosq, NULL, device->uuid, config.mqtt_qos);
-			if (rc) {
-				fprintf(stderr, "MQTT - Subscribe ERROR: %s\n", mosquitto_strerror(rc));
-				run = 0;
-				return;
-			}
-			if (config.debug > 1) printf("Subscribed to uuid: %s\n", device->uuid);
+			bridge_set_device_server_id(&bridge, device, 0);
+			if (config.mqtt_subscribe == MQTT_SUBSCRIBE_DEVICE)
+				mqtt_subscribe(mosq, device->uuid);
 		}
+		mqtt_subscribe_flush(mosq);
+		sub_last_mid = sub_mid;
 
+		if (config.mqtt_inflight) {
+			outbox_reconnect(&outbox);
+			mqtt_outbox_drain(mosq);
+		}
 		send_alive(mosq);
 	} else {
 		fprintf(stderr, "MQTT - Failed to connect: %s\n", mosquitto_connack_string(result));
@@ -181,39 +767,61 @@ void on_mqtt_connect(struct mosquitto *mosq, void *obj, int result)
 void on_mqtt_disconnect(struct mosquitto *mosq, void *obj, int rc)
 {
 	connected = false;
+	if (config.pipeline)
+		clock_gettime(CLOCK_MONOTONIC, &connect_start);		// mosquitto reconnects on its own
 	if (config.debug != 0) printf("MQTT Disconnected: %s\n", mosquitto_strerror(rc));
 }
 
-void mqtt_to_bridge(struct mosquitto *mosq, cJSON *json, int tid)
+// Members of inbound messages, read in place by jscan_keys()
+#define MQTT_KEY_TID 0
+#define MQTT_KEY_COMMA 1
+#define MQTT_KEY_SET 2
+#define MQTT_KEY_GET 3
+#define MQTT_KEY_RUN 4
+#define MQTT_KEY_ID 5
+#define MQTT_KEY_UUID 6
+#define MQTT_KEYS 7
+
+static const char *mqtt_keys[MQTT_KEYS] = { "tid", "comma", "set", "get", "run", "id", "uuid" };
+
+void mqtt_to_bridge(struct mosquitto *mosq, struct jscan_val *vals, int tid)
 {
-	char *value;
+	char value[64];
 	int rc, id;
 	char script_output[20];
-	cJSON *json_item;
 	struct device_t *device;
 
-	if ((json_item = cJSON_GetObjectItem(json, "set")) && (value = json_item->valuestring)) {
+	if (jscan_string(&vals[MQTT_KEY_SET], value, sizeof(value)) >= 0) {
 		// Set operation
 		if (config.debug > 2) printf("MQTT - bridge options: set\n");
 		
 		if (!strcmp(value, "id")) {
-			if (!(json_item = cJSON_GetObjectItem(json, "id")) || (json_item->type != cJSON_Number)) {
+			if (!jscan_int(&vals[MQTT_KEY_ID], &id)) {
 				if (config.debug > 1) printf("Invalid or missing id.\n");
 				return;
 			}
-			id = json_item->valueint;
-			if (!(json_item = cJSON_GetObjectItem(json, "uuid")) || !(value = json_item->valuestring)) {
+			if (jscan_string(&vals[MQTT_KEY_UUID], value, sizeof(value)) < 0) {
 				if (config.debug > 1) printf("Invalid or missing uuid.\n");
 				return;
 			}
 			device = bridge_get_device(&bridge, value);
 			if (device) {
-				device->server_id = id;		// With the id set, we don't need to send the entire uuid
+				bridge_set_device_server_id(&bridge, device, id);		// With the id set, we don't need to send the entire uuid
 											// to distinguished the relay device 
 				if (config.debug > 2) printf("Device server id updated.\n");
 			}
 		}
-	} else if ((json_item = cJSON_GetObjectItem(json, "run")) && (value = json_item->valuestring)) {
+	} else if (jscan_string(&vals[MQTT_KEY_GET], value, sizeof(value)) >= 0) {
+		// Get operation
+		if (config.debug > 2) printf("MQTT - bridge options: get\n");
+
+		if (!strcmp(value, "stats")) {
+			send_stats(mosq, tid);
+		} else {
+			snprintf(gbuf, GBUF_SIZE, "{\"tid\":%d,\"error\":%d}", tid, ERROR_UNKNOWN_JSON_KEY);
+			mqtt_publish(mosq, MAIN_TOPIC, gbuf);
+		}
+	} else if (jscan_string(&vals[MQTT_KEY_RUN], value, sizeof(value)) >= 0) {
 		// Run operation
 		if (config.debug > 2) printf("MQTT - bridge options: run\n");
 
@@ -244,201 +852,256 @@ void mqtt_to_bridge(struct mosquitto *mosq, cJSON *json, int tid)
 	}
 }
 
-void on_mqtt_message(struct mosquitto *mosq, void *obj, const struct mosquitto_message *msg)
+void mqtt_message_in(struct mosquitto *mosq, const struct mosquitto_message *msg)
 {
 	char *payload, *topic;
-	int *sd;
 	struct device_t *device;
-	cJSON *json, *json_item;
-	char *value;
-	int tid;
+	struct jscan_val vals[MQTT_KEYS];
+	char *comma;
+	cJSON *json;
+	int tid, fmt, len;
 
-	sd = (int *)obj;
 	payload  = (char *)msg->payload;
+	len = msg->payloadlen;
 	topic = msg->topic;
 
-	if (config.debug > 2) printf("MQTT IN - topic: %s - payload: %s\n", msg->topic, payload);
+	fmt = pack_detect(msg->payload, msg->payloadlen);
+	if (fmt == PACK_JSON) {
+		if (config.debug > 2) printf("MQTT IN - topic: %s - payload: %s\n", msg->topic, payload);
+	} else {
+		json = pack_parse(fmt, msg->payload, msg->payloadlen);
+		if (!json) {
+			if (config.debug > 1) printf("MQTT: Invalid %s payload.\n", fmt == PACK_CBOR ? "CBOR" : "MessagePack");
+			return;
+		}
+		payload = cJSON_PrintBuffered(json, msg->payloadlen * 2 + 16, 0);	// Devices take JSON text
+		if (!payload)
+			return;
+		len = strlen(payload);
+		if (config.debug > 2) printf("MQTT IN - topic: %s - payload (%s): %s\n", msg->topic, fmt == PACK_CBOR ? "CBOR" : "MessagePack", payload);
+	}
 
-	json = cJSON_Parse(payload);
-	if (!json) {
-		if (config.debug > 1) printf("MQTT: Parse error - before: [%s]\n", cJSON_GetErrorPtr());
-		//TODO: free json?
+	// mosquitto NUL terminates payloads, jscan may read up to it
+	if (!jscan_keys(payload, len, mqtt_keys, vals, MQTT_KEYS)) {
+		if (config.debug > 1) printf("MQTT: Invalid JSON payload.\n");
 		return;
 	}
 
-	if (!(json_item = cJSON_GetObjectItem(json, "tid")) || (json_item->type != cJSON_Number)) {
+	if (!jscan_int(&vals[MQTT_KEY_TID], &tid)) {
 		if (config.debug > 1) printf("MQTT: Invalid or missing tid.\n");
-		cJSON_Delete(json);
 		return;
 	}
-	tid = json_item->valueint;
+
+	if (!strncmp(topic, bridge.uuid, UUID_LEN) && topic[UUID_LEN] == '/')
+		topic += UUID_LEN + 1;		// <bridge uuid>/<device uuid>, from the wildcard subscription
 
 	if (!strcmp(topic, bridge.uuid)) {
 		if (config.debug > 1) printf("Message for the bridge: %s\n", payload);
-		mqtt_to_bridge(mosq, json, tid);
+		mqtt_to_bridge(mosq, vals, tid);
 	} else {
 		device = bridge_get_device(&bridge, topic);
 		if (!device) {
 			fprintf(stderr, "MQTT - Error: Failed to get device: %s\n", topic);
+		} else if (!device->port->serial_ready) {
+			if (config.debug > 1) printf("MQTT - Serial port not ready: %s\n", device->port->serial->port);
+		} else if (vals[MQTT_KEY_COMMA].type == JSCAN_STRING) {
+			comma = pool_get(vals[MQTT_KEY_COMMA].len);		// Unescaped it only gets shorter
+			if (comma && jscan_string(&vals[MQTT_KEY_COMMA], comma, vals[MQTT_KEY_COMMA].len) >= 0)
+				serial_send_prefixed(device->port, device->comma_prefix, device->comma_prefix_len, comma);
+			pool_put(comma);
 		} else {
-			if ((json_item = cJSON_GetObjectItem(json, "comma")) && (value = json_item->valuestring)) {
-				if (device->id == 0) {
-					snprintf(gbuf, GBUF_SIZE, "%s%s", SERIAL_SINGLE_COMMA_STR, value);
-				} else {
-					snprintf(gbuf, GBUF_SIZE, "%s%d%s", SERIAL_MULTI_COMMA_STR, device->id, value);
-				}
-			} else {
-				if (device->id == 0) {
-					snprintf(gbuf, GBUF_SIZE, "%s%s", SERIAL_SINGLE_JSON_STR, payload);
-				} else {
-					snprintf(gbuf, GBUF_SIZE, "%s%d%s", SERIAL_SINGLE_JSON_STR, device->id, payload);
-				}
-			}
-			serialport_send(*sd, gbuf);
+			serial_send_prefixed(device->port, device->json_prefix, device->json_prefix_len, payload);
 		}
 	}
-	cJSON_Delete(json);
 }
 
-int serial_in(int sd, struct mosquitto *mosq)
+void on_mqtt_message(struct mosquitto *mosq, void *obj, const struct mosquitto_message *msg)
 {
-	static char serial_buf[SERIAL_MAX_BUF];
-	static int buf_len = 0;
-	char *serial_buf_ptr;
-	int id;
-	struct device_t *device;
-	int rc, sread;
+	json_begin();
+	mqtt_message_in(mosq, msg);
+	json_end();
+}
 
-	if (buf_len)
-		serial_buf_ptr = &serial_buf[buf_len - 1];
-	else
-		serial_buf_ptr = &serial_buf[0];
+// Falls back to text framing, the board probably reset
+void serial_text_mode(struct bridge_port *port)
+{
+	if (port->framing && config.debug) printf("Serial - Text framing: %s\n", port->serial->port);
+	port->framing = SERIAL_FRAMING_TEXT;
+	port->binary_offered = false;
+}
 
-	sread = serialport_read_until(sd, serial_buf_ptr, eolchar, SERIAL_MAX_BUF - buf_len, config.serial.timeout);
-	if (sread == -1) {
-		fprintf(stderr, "Serial - Read Error.\n");
-		return -1;
-	} 
-	if (sread == 0)
-		return 0;
+// The device behind a multi-drop id, asking the board for its uuid when unknown
+static struct device_t *serial_multi_device(struct bridge_port *port, int id)
+{
+	struct device_t *device;
 
-	buf_len += sread;
+	device = bridge_get_device_by_id(&bridge, port, id);
+	if (!device) {
+		port->uuid_request = id;
+		snprintf(gbuf, GBUF_SIZE, "%s%d", SERIAL_UUID_STR, id);
+		serial_send(port, gbuf);
+	}
+	return device;
+}
 
-	if (serial_buf[buf_len - 1] == eolchar) {
-		serial_buf[buf_len - 1] = 0;			// replace end of line
-		buf_len--;
-		if (buf_len > 0 && serial_buf[buf_len - 1] == '\r') {
-			serial_buf[buf_len - 1] = 0;		// replace carriage return
-			buf_len--;
-		}
-		if (buf_len == 0) return 0;
-		if (config.debug > 3) printf("Serial - size:%d, serial_buf:%s\n", buf_len, serial_buf);
+int serial_process(struct bridge_port *port, struct mosquitto *mosq, char *serial_buf, int buf_len)
+{
+	char *serial_buf_ptr;
+	int id, framing;
+	struct device_t *device;
 
-		if (buf_len < SERIAL_INIT_LEN || serial_buf[0] != SERIAL_INIT_0 || 
-				serial_buf[2] != SERIAL_INIT_2) {
-			if (config.debug > 1) printf("Invalid serial input.\n");
-			buf_len = 0;
-			return 0;
-		}
-		sread = buf_len;	// if this is a valid message we will return sread
-		buf_len = 0;		// resetting for the next input
+	if (config.debug > 3) printf("Serial - size:%d, serial_buf:%s\n", buf_len, serial_buf);
+
+	if (buf_len < SERIAL_INIT_LEN || serial_buf[0] != SERIAL_INIT_0 || 
+			serial_buf[2] != SERIAL_INIT_2) {
+		if (config.debug > 1) printf("Invalid serial input.\n");
+		return 0;
+	}
 
-		serial_buf_ptr = serial_buf + SERIAL_INIT_LEN;
+	serial_buf_ptr = serial_buf + SERIAL_INIT_LEN;
 
-		switch (serial_buf[1]) {
-			case SERIAL_DEBUG_C:
-				if (config.debug) printf("Serial - Debug: %s\n", serial_buf_ptr);
-				break;
-			case SERIAL_UUID_C:
-				if (!bridge_isValid_uuid(serial_buf_ptr)) {
-					if (config.debug > 1) printf("Serial - Invalid uuid.\n");
+	switch (serial_buf[1]) {
+		case SERIAL_DEBUG_C:
+			if (config.debug) printf("Serial - Debug: %s\n", serial_buf_ptr);
+			break;
+		case SERIAL_UUID_C:
+			if (!bridge_isValid_uuid(serial_buf_ptr)) {
+				if (config.debug > 1) printf("Serial - Invalid uuid.\n");
+				return 0;
+			}
+			device = bridge_get_device(&bridge, serial_buf_ptr);
+			if (device) {
+				bridge_set_device_port(&bridge, device, port);		// The device may have moved to another port
+			} else {
+				device = bridge_add_device(&bridge, port, serial_buf_ptr);
+				if (!device)
 					return 0;
+				if (connected && config.mqtt_subscribe == MQTT_SUBSCRIBE_DEVICE)
+					mqtt_subscribe(mosq, device->uuid);
+			}
+			if (port->uuid_request) {
+				// Answer to @U#<id>, from a multi-drop device
+				bridge_set_device_id(&bridge, device, port->uuid_request);
+				if (config.debug > 1) printf("Device %s id: %d\n", device->uuid, device->id);
+				port->uuid_request = 0;
+			} else if (!port->serial_uuid) {
+				port->serial_uuid = strdup(device->uuid);
+				if (!port->serial_uuid) {
+					fprintf(stderr, "Error: Out of memory.\n");
+					exit(1);
 				}
-				device = bridge_get_device(&bridge, serial_buf_ptr);
-				if (!device) {
-					device = bridge_add_device(&bridge, serial_buf_ptr);
-					if (connected) {
-						rc = mosquitto_subscribe(mosq, NULL, device->uuid, config.mqtt_qos);
-						if (rc) {
-							fprintf(stderr, "MQTT - Subscribe ERROR: %s\n", mosquitto_strerror(rc));
-							run = 0;
-							break;
-						}
-						if (config.debug > 1) printf("Subscribed to uuid: %s\n", device->uuid);
-					}
-				}
-				if (!bridge.serial_uuid) {
-					bridge.serial_uuid = strdup(device->uuid);
-					if (!bridge.serial_uuid) {
-						fprintf(stderr, "Error: Out of memory.\n");
-						exit(1);
-					}
-					if (config.debug > 1) printf("Bridge serial_uuid: %s\n", device->uuid);
-				}
+				if (config.debug > 1) printf("Port %s serial_uuid: %s\n", port->serial->port, device->uuid);
+			}
+			break;
+		case SERIAL_SINGLE_JSON_C:
+			if (!port->serial_uuid) {
+				serial_send(port, SERIAL_UUID_STR);
+				if (config.debug > 2) printf("Serial - Sent get uuid.\n");
 				break;
-			case SERIAL_SINGLE_JSON_C:
-				if (!bridge.serial_uuid) {
-					serialport_send(sd, SERIAL_UUID_STR);
-					if (config.debug > 2) printf("Serial - Sent get uuid.\n");
-					break;
-				}
-				device = bridge_get_device(&bridge, bridge.serial_uuid);
-				device->alive = BRIDGE_ALIVE_CNT;		// Reset alive count
-				if (device->server_id != 0)
-					snprintf(gbuf, GBUF_SIZE, "%d", device->server_id);
-				else
-					snprintf(gbuf, GBUF_SIZE, "b/%s", bridge.serial_uuid);
-				mqtt_publish(mosq, gbuf, serial_buf_ptr);
+			}
+			device = bridge_get_device(&bridge, port->serial_uuid);
+			bridge_touch_device(&bridge, device);
+			device_publish(mosq, device, serial_buf_ptr, port->serial->qos);
+			break;
+		case SERIAL_MULTI_JSON_C:
+			if (!utils_getInt_dlm(&serial_buf_ptr, &id, '{')) {
+				if (config.debug > 1) printf("Serial - Invalid id.\n");
+				return 0;
+			}
+			serial_buf_ptr--;		// Keep the '{' the delimiter consumed
+			device = serial_multi_device(port, id);
+			if (!device)
 				break;
-			case SERIAL_MULTI_JSON_C:
-				if (!utils_getInt_dlm(&serial_buf_ptr, &id, '{')) {
-					if (config.debug > 1) printf("Serial - Invalid id.\n");
-					return 0;
-				}
-				device = bridge_get_device_by_id(&bridge, id);
-				if (!device) {
-					snprintf(gbuf, GBUF_SIZE, "%s%d", SERIAL_UUID_STR, id);
-					serialport_send(sd, gbuf);
-					break;
-				}
-				device->alive = BRIDGE_ALIVE_CNT;		// Reset alive count
-				if (device->server_id != 0)
-					snprintf(gbuf, GBUF_SIZE, "%d", device->server_id);
+			bridge_touch_device(&bridge, device);
+			device_publish(mosq, device, serial_buf_ptr, port->serial->qos);
+			break;
+		case SERIAL_BINARY_C:
+			framing = frame_agree(serial_buf_ptr[0], port->serial->framing);
+			if (framing == SERIAL_FRAMING_TEXT) {
+				if (serial_buf_ptr[0] >= '1' && serial_buf_ptr[0] <= '9')
+					serial_send(port, SERIAL_BINARY_STR "0");		// Configured for text
 				else
-					snprintf(gbuf, GBUF_SIZE, "b/%s", device->uuid);
-				mqtt_publish(mosq, gbuf, serial_buf_ptr);
+					serial_text_mode(port);
 				break;
-			case SERIAL_SINGLE_COMMA_C:
-			case SERIAL_MULTI_COMMA_C:
-				//TODO
+			}
+			// Queued in the old framing, before the switch
+			if (!port->binary_offered || framing != serial_buf_ptr[0] - '0')
+				serial_send(port, framing == SERIAL_FRAMING_PACKED ? SERIAL_BINARY_STR "2" : SERIAL_BINARY_STR "1");
+			port->binary_offered = false;
+			port->framing = framing;
+			if (config.debug) printf("Serial - %s framing: %s\n", framing == SERIAL_FRAMING_PACKED ? "Packed" : "Binary", port->serial->port);
+			break;
+		case SERIAL_SINGLE_COMMA_C:
+			if (!port->serial_uuid) {
+				serial_send(port, SERIAL_UUID_STR);
+				if (config.debug > 2) printf("Serial - Sent get uuid.\n");
 				break;
-			default:
-				if (config.debug > 1) printf("Unknown serial data.\n");
-		}
-		return sread;
-	} else if (buf_len == SERIAL_MAX_BUF) {
-		if (config.debug > 1) printf("Serial buffer full.\n");
-		buf_len = 0;
-	} else {
-		if (config.debug > 1) printf("Serial chunked.\n");
+			}
+			device = bridge_get_device(&bridge, port->serial_uuid);
+			bridge_touch_device(&bridge, device);
+			device_publish_comma(mosq, device, serial_buf_ptr, buf_len - SERIAL_INIT_LEN, port->serial->qos);
+			break;
+		case SERIAL_MULTI_COMMA_C:
+			if (!utils_getInt_dlm(&serial_buf_ptr, &id, ',')) {
+				if (config.debug > 1) printf("Serial - Invalid id.\n");
+				return 0;
+			}
+			device = serial_multi_device(port, id);
+			if (!device)
+				break;
+			bridge_touch_device(&bridge, device);
+			device_publish_comma(mosq, device, serial_buf_ptr, buf_len - (serial_buf_ptr - serial_buf), port->serial->qos);
+			break;
+		default:
+			if (config.debug > 1) printf("Unknown serial data.\n");
 	}
-	return 0;
+	return buf_len;
 }
 
-void signal_usr(int sd, struct mosquitto *mosq)
+int serial_in(struct bridge_port *port, struct mosquitto *mosq)
 {
-	struct device_t *device;
-	
-	if (user_signal == SIGUSR1) {
+	int rc, len, frames = 0, max = port->serial->max_frame;
+
+	// One read per readiness event, epoll calls back while there is more
+	rc = serialport_fill(port->sd, &port->rx);
+	if (rc == -1) {
+		fprintf(stderr, "Serial - Read Error.\n");
+		return -1;
+	}
+
+	for (;;) {
+		len = frame_next(&port->rx, port->framing, port->frame, max + 1, port->scratch, FRAME_ENCODED_MAX(max) + 1);
+		if (len == SERIALPORT_NO_FRAME)
+			break;
+		if (len == SERIALPORT_OVERFLOW) {
+			if (config.debug > 1) printf("Serial buffer full.\n");
+			if (port->framing)
+				serial_text_mode(port);		// Text lines never carry the delimiter
+			continue;
+		}
+		if (len == FRAME_INVALID) {
+			port->bad_frames++;
+			if (config.debug > 1) printf("Serial - Bad frame.\n");
+			continue;
+		}
+		if (len == 0)
+			continue;
+		if (serial_process_frame(port, mosq, port->frame, len) > 0)
+			frames++;
+	}
+
+	return frames;
+}
+
+void signal_usr(struct mosquitto *mosq)
+{
+	struct device_t *device;
+	
+	if (user_signal == SIGUSR1) {
 		if (config.usr1_remap_uuid) {
 			device = bridge_get_device(&bridge, config.usr1_remap_uuid);
-			if (device) {
-				if (device->id == 0)
-					snprintf(gbuf, GBUF_SIZE, "%s%s", SERIAL_SINGLE_JSON_STR, config.usr1_json);
-				else
-					snprintf(gbuf, GBUF_SIZE, "%s%d%s", SERIAL_MULTI_JSON_STR, device->id, config.usr1_json);
-				serialport_send(sd, gbuf);
-			}
+			if (device && device->port->serial_ready)
+				serial_send_prefixed(device->port, device->json_prefix, device->json_prefix_len, config.usr1_json);
 		} else if (connected) {
 			snprintf(gbuf, GBUF_SIZE, "{\"push\":\"signal\",\"signal\":\"usr1\"}");
 			mqtt_publish(mosq, MAIN_TOPIC, gbuf);
@@ -448,13 +1111,8 @@ void signal_usr(int sd, struct mosquitto *mosq)
 	if (user_signal == SIGUSR2) {
 		if (config.usr2_remap_uuid) {
 			device = bridge_get_device(&bridge, config.usr2_remap_uuid);
-			if (device) {
-				if (device->id == 0)
-					snprintf(gbuf, GBUF_SIZE, "%s%s", SERIAL_SINGLE_JSON_STR, config.usr1_json);
-				else
-					snprintf(gbuf, GBUF_SIZE, "%s%d%s", SERIAL_MULTI_JSON_STR, device->id, config.usr1_json);
-				serialport_send(sd, gbuf);
-			}
+			if (device && device->port->serial_ready)
+				serial_send_prefixed(device->port, device->json_prefix, device->json_prefix_len, config.usr2_json);
 		} else if (connected) {
 			snprintf(gbuf, GBUF_SIZE, "{\"push\":\"signal\",\"signal\":\"usr2\"}");
 			mqtt_publish(mosq, MAIN_TOPIC, gbuf);
@@ -464,13 +1122,551 @@ void signal_usr(int sd, struct mosquitto *mosq)
 	user_signal = 0;
 }
 
-void serial_hang(struct mosquitto *mosq)
+void serial_hang(struct bridge_port *port, struct mosquitto *mosq)
 {
-	bridge.serial_ready = false;
-	bridge.serial_alive = 0;
+	port->serial_ready = false;
+	port->serial_alive = 0;
+	event_del(&port->ev);
+	pipeline_stop(port);
+	serial_text_mode(port);
+
+	serialport_txq_clear(&port->txq);
+	if (port->tx_armed) {
+		event_timerfd_set(port->tx_ev.fd, 0, 0);
+		port->tx_armed = false;
+	}
 
 	if (connected) {
-		mqtt_publish(mosq, MAIN_TOPIC, "{\"error\":\"serial\"}");
+		snprintf(gbuf, GBUF_SIZE, "{\"error\":\"serial\",\"port\":%d}", port->index);
+		mqtt_publish(mosq, MAIN_TOPIC, gbuf);
+	}
+}
+
+// Writes what the pacing allows and waits on the tx timer, or on EPOLLOUT
+// when the port is full, for the rest
+void serial_tx(struct bridge_port *port)
+{
+	int rc;
+
+	rc = serialport_drain(port->sd, &port->txq);
+	if (rc == -1) {
+		serial_hang(port, mosq);
+		return;
+	}
+
+	if (port->reader) {
+		if (rc == SERIALPORT_TX_BLOCKED)
+			rc = SERIAL_TX_RETRY;		// No EPOLLOUT, the reader owns the port
+	} else {
+		event_mod(&port->ev, rc == SERIALPORT_TX_BLOCKED ? EPOLLIN | EPOLLOUT : EPOLLIN);
+	}
+
+	if (rc > 0) {
+		event_timerfd_set(port->tx_ev.fd, rc, 0);
+		port->tx_armed = true;
+	} else if (port->tx_armed) {
+		event_timerfd_set(port->tx_ev.fd, 0, 0);
+		port->tx_armed = false;
+	}
+}
+
+// Where the json body of a @J# or @j#<id> frame starts, 0 for other frames
+static int serial_json_at(const char *frame, int len)
+{
+	int at = SERIAL_INIT_LEN;
+
+	if (len < SERIAL_INIT_LEN || (frame[1] != SERIAL_SINGLE_JSON_C && frame[1] != SERIAL_MULTI_JSON_C))
+		return 0;
+	if (frame[1] == SERIAL_MULTI_JSON_C)
+		while (at < len && frame[at] >= '0' && frame[at] <= '9')
+			at++;
+	return at;
+}
+
+// Packs the json body of frame as CBOR into out, for a packed port
+// returns the packed frame length or -1
+static int serial_pack(const char *frame, int len, char *out, int out_max)
+{
+	int at = serial_json_at(frame, len), n;
+
+	if (!at || at >= out_max)
+		return -1;
+	memcpy(out, frame, at);
+	n = pack_json(PACK_CBOR, frame + at, (uint8_t *)out + at, out_max - at);
+	return n < 0 ? -1 : at + n;
+}
+
+// Turns the CBOR body of a packed frame back into json text, NUL terminated
+// returns the text frame length or -1
+static int serial_unpack(const char *frame, int len, char *out, int out_max)
+{
+	int at = serial_json_at(frame, len), rc = -1;
+	cJSON *json;
+
+	if (!at || at >= out_max)
+		return -1;
+	memcpy(out, frame, at);
+	json_begin();
+	json = pack_parse(PACK_CBOR, (const uint8_t *)frame + at, len - at);
+	if (json && cJSON_PrintPreallocated(json, out + at, out_max - at, 0))
+		rc = at + strlen(out + at);
+	json_end();
+	return rc;
+}
+
+// serial_process() for a decoded frame, unpacking it first on a packed port
+int serial_process_frame(struct bridge_port *port, struct mosquitto *mosq, char *frame, int len)
+{
+	char *text;
+	int rc = 0;
+
+	if (port->framing != SERIAL_FRAMING_PACKED || !serial_json_at(frame, len))
+		return serial_process(port, mosq, frame, len);
+
+	text = pool_get(port->serial->max_frame + 1);
+	if (!text)
+		return 0;
+	len = serial_unpack(frame, len, text, port->serial->max_frame + 1);
+	if (len == -1) {
+		port->bad_frames++;
+		if (config.debug > 1) printf("Serial - Bad packed frame.\n");
+	} else {
+		rc = serial_process(port, mosq, text, len);
+	}
+	pool_put(text);
+	return rc;
+}
+
+void serial_send(struct bridge_port *port, char *str)
+{
+	uint8_t *frame_buf;
+	char *frame = str, *packed = NULL;
+	int rc, len;
+
+	if (!port->serial_ready)
+		return;
+
+	len = strlen(str);
+	if (port->framing) {
+		if (port->framing == SERIAL_FRAMING_PACKED && serial_json_at(str, len)) {
+			frame = packed = pool_get(port->serial->max_frame);
+			len = packed ? serial_pack(str, len, packed, port->serial->max_frame) : -1;
+		}
+		frame_buf = len == -1 ? NULL : pool_get(FRAME_ENCODED_MAX(len));
+		if (frame_buf)
+			len = frame_encode(frame, len, frame_buf, FRAME_ENCODED_MAX(len));
+		pool_put(packed);
+		if (!frame_buf || len == -1) {
+			if (config.debug > 1) printf("Serial - Can't frame: %s\n", str);
+			pool_put(frame_buf);
+			return;
+		}
+		rc = serialport_queue(&port->txq, (char *)frame_buf, len, FRAME_DELIM);
+		pool_put(frame_buf);
+	} else {
+		rc = serialport_queue(&port->txq, str, len, eolchar);
+	}
+
+	if (rc == -1) {
+		if (config.debug > 1) printf("Serial - Queue full: %s\n", port->serial->port);
+		return;
+	}
+	if (config.debug > 3) printf("Serial - Queued: %s\n", str);
+
+	// Otherwise the timer or EPOLLOUT will get to it
+	if (!port->tx_armed && !(port->ev.events & EPOLLOUT))
+		serial_tx(port);
+}
+
+// Sends a device command, prefix being one the bridge rendered for it
+void serial_send_prefixed(struct bridge_port *port, const char *prefix, int prefix_len, const char *body)
+{
+	char *line;
+	int len;
+
+	len = strlen(body);
+	if (prefix_len + len > port->serial->max_frame) {
+		if (config.debug > 1) printf("Serial - Command too long: %s%s\n", prefix, body);
+		return;
+	}
+	line = pool_get(prefix_len + len + 1);
+	if (!line)
+		return;
+	memcpy(line, prefix, prefix_len);
+	memcpy(line + prefix_len, body, len + 1);
+	serial_send(port, line);
+	pool_put(line);
+}
+
+void handle_serial_tx(int fd, uint32_t events, void *data)
+{
+	struct bridge_port *port = data;
+	uint64_t expirations;
+
+	if (read(fd, &expirations, sizeof(expirations)) != sizeof(expirations))
+		return;
+
+	port->tx_armed = false;
+	if (port->serial_ready)
+		serial_tx(port);
+}
+
+void handle_serial(int fd, uint32_t events, void *data)
+{
+	struct bridge_port *port = data;
+	int rc;
+
+	if (events & EPOLLOUT) {
+		serial_tx(port);
+		if (!port->serial_ready)
+			return;
+	}
+
+	rc = serial_in(port, mosq);
+	if (rc == -1) {
+		serial_hang(port, mosq);
+	} else if (rc > 0) {
+		port->serial_alive = BRIDGE_ALIVE_CNT;
+	} else if (events & (EPOLLHUP | EPOLLERR)) {
+		if (config.debug > 1) printf("Serial - Hang up: %s\n", port->serial->port);
+		serial_hang(port, mosq);
+	}
+}
+
+// Starts reading the port, from the event loop or from a reader thread
+int serial_listen(struct bridge_port *port)
+{
+	if (config.pipeline)
+		return pipeline_start(port);
+	return event_add(&port->ev, port->sd, EPOLLIN, handle_serial, port);
+}
+
+// Opens the port and starts reading it. Without flush the caller must
+// discard the stale input itself and then call serial_listen(), see main()
+int serial_open(struct bridge_port *port, bool flush)
+{
+	port->sd = serialport_init(port->serial->port, port->serial->baudrate);
+	if (port->sd == -1) {
+		fprintf(stderr, "Couldn't open serial port %s.\n", port->serial->port);
+		return -1;
+	}
+
+	serialport_rx_init(&port->rx);
+	if (flush) {
+		serialport_flush(port->sd);
+		if (serial_listen(port)) {
+			serialport_close(port->sd);
+			port->sd = -1;
+			return -1;
+		}
+	}
+	port->serial_ready = true;
+	return 0;
+}
+
+// Offers binary or packed framing to the board, once its input has been flushed
+void serial_negotiate(struct bridge_port *port)
+{
+	if (port->serial->framing == SERIAL_FRAMING_TEXT)
+		return;
+
+	port->binary_offered = true;
+	serial_send(port, port->serial->framing == SERIAL_FRAMING_PACKED ? SERIAL_BINARY_STR "2" : SERIAL_BINARY_STR "1");
+}
+
+void mqtt_lost(struct mosquitto *mosq, int rc)
+{
+	if (config.debug > 2) printf("MQTT loop: %s\n", mosquitto_strerror(rc));
+	connected = false;
+	event_del(&mqtt_ev);
+	mqtt_reconnect = true;		// Retried by the timer, once a second
+}
+
+void handle_mqtt(int fd, uint32_t events, void *data)
+{
+	struct mosquitto *mosq = data;
+	int rc;
+
+	if (events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+		rc = mosquitto_loop_read(mosq, 1);
+		if (rc) {
+			mqtt_lost(mosq, rc);
+			return;
+		}
+	}
+	if (events & EPOLLOUT) {
+		rc = mosquitto_loop_write(mosq, 1);
+		if (rc) {
+			mqtt_lost(mosq, rc);
+			return;
+		}
+	}
+}
+
+// Keeps the epoll registration in step with the mosquitto socket, which changes
+// on reconnect, and asks for EPOLLOUT only while there is something to write
+void mqtt_sync_events(struct mosquitto *mosq)
+{
+	uint32_t events;
+	int fd;
+
+	if (mqtt_reconnect)
+		return;
+
+	fd = mosquitto_socket(mosq);
+	if (fd != mqtt_ev.fd)
+		event_del(&mqtt_ev);
+	if (fd == -1)
+		return;
+
+	events = EPOLLIN;
+	if (mosquitto_want_write(mosq))
+		events |= EPOLLOUT;
+
+	if (mqtt_ev.fd == -1)
+		event_add(&mqtt_ev, fd, events, handle_mqtt, mosq);
+	else
+		event_mod(&mqtt_ev, events);
+}
+
+void device_timeout(struct wheel_timer *timer, void *data)
+{
+	struct device_t *device = wheel_entry(timer, struct device_t, alive);
+
+	if (device->batch) {
+		batch_flush(mosq, device->batch);
+		batch_free(device->batch);
+		device->batch = NULL;
+	}
+	filter_free(device->filter);
+	device->filter = NULL;
+	if (connected || config.spool_dir)
+		mqtt_publish_device(mosq, device, "{\"timeout\":1}", device->port->serial->qos);
+	if (config.mqtt_inflight)
+		outbox_forget(&outbox, device);		// After the last publish, which may queue too
+	if (config.debug) printf("Device: %s - Timeout.\n", device->uuid);
+	mqtt_alias_forget(device);
+	bridge_remove_device(&bridge, device->uuid);
+}
+
+void handle_timer(int fd, uint32_t events, void *data)
+{
+	struct bridge_port *port;
+	uint64_t expirations;
+	int rc, i;
+
+	if (read(fd, &expirations, sizeof(expirations)) != sizeof(expirations))
+		return;
+
+	while (expirations--) {
+		each_sec();
+
+		for (i = 0; i < bridge.port_count; i++) {
+			port = &bridge.ports[i];
+			if (port->serial_alive) {
+				port->serial_alive--;
+				if (!port->serial_alive) {
+					if (config.debug > 1) printf("Serial timeout: %s\n", port->serial->port);
+					serial_hang(port, mosq);
+				}
+			}
+		}
+
+		wheel_advance(&bridge.wheel, seconds, device_timeout, NULL);
+
+		if (bridge.dirty && config.registry_file)
+			registry_save(config.registry_file, &bridge);
+
+		if (config.mqtt_inflight) {
+			outbox_expire(&outbox, mqtt_clock());
+			mqtt_outbox_drain(mosq);
+		}
+
+		// What came in live since the last tick and spool_rate more, so
+		// the backlog shrinks however busy the gateway is
+		spool_budget = config.spool_rate + spool_live;
+		spool_live = 0;
+
+		if (seconds % 30 != 0)
+			continue;
+
+		if (connected)
+			send_alive(mosq);
+		else if (config.debug)
+			printf("MQTT Offline.\n");
+
+		if (bandwidth && (connected || config.spool_dir)) {
+			snprintf(gbuf, GBUF_SIZE, "{\"push\":\"bandwidth\",\"up\":%.0f,\"down\":%.0f}", upspeed, downspeed);
+			mqtt_publish(mosq, MAIN_TOPIC, gbuf);
+			if (config.debug > 2) printf("down: %f - up: %f\n", downspeed, upspeed);
+		}
+
+		for (i = 0; i < bridge.port_count; i++) {
+			port = &bridge.ports[i];
+			if (port->serial_alive || port->serial_ready)
+				continue;
+
+			if (config.debug > 1) printf("Trying to reconnect serial port %s.\n", port->serial->port);
+			if (port->sd != -1) {
+				serialport_close(port->sd);
+				port->sd = -1;
+			}
+			if (!serial_open(port, true)) {
+				serial_negotiate(port);
+				if (connected) {
+					snprintf(gbuf, GBUF_SIZE, "{\"trig\":\"serial\",\"serial\":\"open\",\"port\":%d}", port->index);
+					mqtt_publish(mosq, MAIN_TOPIC, gbuf);
+				}
+				if (config.debug) printf("Serial reopened: %s\n", port->serial->port);
+			}
+		}
+	}
+
+	if (config.pipeline)
+		return;		// The mosquitto thread keeps the connection
+
+	if (mqtt_reconnect) {
+		clock_gettime(CLOCK_MONOTONIC, &connect_start);
+		rc = mosquitto_reconnect(mosq);
+		if (rc) {
+			if (config.debug > 2) printf("MQTT reconnect: %s\n", mosquitto_strerror(rc));
+		} else {
+			mqtt_reconnect = false;
+		}
+	} else {
+		rc = mosquitto_loop_misc(mosq);		// Keepalive
+		if (rc)
+			mqtt_lost(mosq, rc);
+	}
+}
+
+// Pipeline mode, runs in the mosquitto thread and hands the callback over
+// to the event loop
+static void mqtt_forward(int kind, int rc, struct mosquitto_message *msg)
+{
+	struct mqtt_event *ev;
+
+	while (!(ev = ring_reserve(&mqtt_ring)))
+		usleep(1000);		// The event loop is behind, hold the broker back
+	ev->kind = kind;
+	ev->rc = rc;
+	ev->msg = msg;
+	ring_commit(&mqtt_ring);
+	pipeline_wake();
+}
+
+void pipe_on_connect(struct mosquitto *mosq, void *obj, int result)
+{
+	mqtt_forward(MQTT_EV_CONNECT, result, NULL);
+}
+
+void pipe_on_disconnect(struct mosquitto *mosq, void *obj, int rc)
+{
+	mqtt_forward(MQTT_EV_DISCONNECT, rc, NULL);
+}
+
+void pipe_on_message(struct mosquitto *mosq, void *obj, const struct mosquitto_message *msg)
+{
+	struct mosquitto_message *copy;
+
+	copy = calloc(1, sizeof(struct mosquitto_message));
+	if (!copy || mosquitto_message_copy(copy, msg)) {
+		fprintf(stderr, "Error: No memory left.\n");
+		free(copy);
+		return;
+	}
+	mqtt_forward(MQTT_EV_MESSAGE, 0, copy);
+}
+
+void pipe_on_subscribe(struct mosquitto *mosq, void *obj, int mid, int qos_count, const int *granted_qos)
+{
+	mqtt_forward(MQTT_EV_SUBSCRIBE, mid, NULL);
+}
+
+void pipe_on_publish(struct mosquitto *mosq, void *obj, int mid)
+{
+	mqtt_forward(MQTT_EV_PUBLISH, mid, NULL);
+}
+
+// MQTT v5, keeps the broker's topic alias limit from the CONNACK
+void on_mqtt_connect_v5(struct mosquitto *mosq, void *obj, int result, int flags, const mosquitto_property *props)
+{
+	uint16_t aliases = 0;
+
+	mosquitto_property_read_int16(props, MQTT_PROP_TOPIC_ALIAS_MAXIMUM, &aliases, false);
+	atomic_store(&broker_aliases, aliases);
+	if (config.pipeline)
+		pipe_on_connect(mosq, obj, result);
+	else
+		on_mqtt_connect(mosq, obj, result);
+}
+
+// Runs what the reader threads and the mosquitto thread queued
+void handle_pipeline(int fd, uint32_t events, void *data)
+{
+	struct mosquitto *mosq = data;
+	struct bridge_port *port;
+	struct pipeline_reader *reader;
+	struct pipeline_msg *msg;
+	struct mqtt_event *ev;
+	uint64_t count;
+	char *frame;
+	int i;
+
+	if (read(fd, &count, sizeof(count)) == -1 && errno != EAGAIN)
+		return;
+
+	while ((ev = ring_peek(&mqtt_ring))) {
+		switch (ev->kind) {
+			case MQTT_EV_CONNECT:
+				on_mqtt_connect(mosq, NULL, ev->rc);
+				break;
+			case MQTT_EV_DISCONNECT:
+				on_mqtt_disconnect(mosq, NULL, ev->rc);
+				break;
+			case MQTT_EV_MESSAGE:
+				on_mqtt_message(mosq, NULL, ev->msg);
+				mosquitto_message_free(&ev->msg);
+				break;
+			case MQTT_EV_SUBSCRIBE:
+				on_mqtt_subscribe(mosq, NULL, ev->rc, 0, NULL);
+				break;
+			case MQTT_EV_PUBLISH:
+				on_mqtt_publish(mosq, NULL, ev->rc);
+				break;
+		}
+		ring_release(&mqtt_ring);
+	}
+
+	for (i = 0; i < bridge.port_count; i++) {
+		port = &bridge.ports[i];
+		reader = port->reader;
+		while (reader && (msg = ring_peek(&reader->ring))) {
+			switch (msg->kind) {
+				case PIPELINE_FRAME:
+					frame = msg->data;
+					msg->data = NULL;		// Ours now, even if the port hangs up below
+					if (serial_process_frame(port, mosq, frame, msg->len) > 0)
+						port->serial_alive = BRIDGE_ALIVE_CNT;
+					pool_put(frame);
+					break;
+				case PIPELINE_TEXT_MODE:
+					if (config.debug > 1) printf("Serial buffer full.\n");
+					serial_text_mode(port);
+					break;
+				case PIPELINE_BAD_FRAME:
+					port->bad_frames++;
+					if (config.debug > 1) printf("Serial - Bad frame.\n");
+					break;
+				case PIPELINE_HANG:
+					fprintf(stderr, "Serial - Read Error.\n");
+					serial_hang(port, mosq);
+					break;
+			}
+			if (port->reader != reader)
+				break;		// Hung up meanwhile, the ring is gone
+			ring_release(&reader->ring);
+		}
 	}
 }
 
@@ -480,24 +1676,36 @@ void print_usage(char *prog_name)
 	printf(" -c : config file path.\n");
 }
 
+// Topic and payload of the longest message the bridge publishes, so the spool keeps them all
+static int spool_record_max(void)
+{
+	int i, max = COMMA_JSON_MAX;
+
+	for (i = 0; i < config.serial_count; i++)
+		if (config.serial[i].max_frame > max)
+			max = config.serial[i].max_frame;
+	if (config.aggregate != BATCH_OFF && config.aggregate_size > max)
+		max = config.aggregate_size;
+	return UINT8_MAX + max;
+}
+
 int main(int argc, char *argv[])
 {
-	int sd = -1;
 	char *conf_file = NULL;
-	struct mosquitto *mosq;
+	struct mqtt_event *mqtt_event;
 	struct device_t *device;
-	static unsigned long last_second = 0;
-	int rc, i;
+	sigset_t mask;
+	int rc, i, fd;
 	
 	gbuf[0] = 0;
 
 	if (!quiet) printf("Version: %s\n", version);
 
-    signal(SIGINT, handle_signal);
-    signal(SIGTERM, handle_signal);
-	signal(SIGUSR1, handle_signal);
-	signal(SIGUSR2, handle_signal);
-	signal(SIGALRM, each_sec);
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGINT);
+	sigaddset(&mask, SIGTERM);
+	sigaddset(&mask, SIGUSR1);
+	sigaddset(&mask, SIGUSR2);
 	
 	for (i=1; i<argc; i++) {
 		if(!strcmp(argv[i], "-c") || !strcmp(argv[i], "--config")){
@@ -529,12 +1737,27 @@ int main(int argc, char *argv[])
 	if (quiet) config.debug = 0;
 	if (config.debug != 0) printf("Debug: %d\n", config.debug);
 
-	rc = bridge_init(&bridge, config.uuid);
+	rc = bridge_init(&bridge, config.uuid, config.serial, config.serial_count);
 	if (rc) {
 		if (config.debug) printf("Error: Failed to initialize bridge: %d\n", rc);
 		return 1;
 	}
 
+	if (config.spool_dir) {
+		if (spool_open(&spool, config.spool_dir, config.spool_max * 1024L, config.spool_policy, spool_record_max()))
+			return 1;
+		if (spool.count && config.debug) printf("Spool: %d messages to replay.\n", spool.count);
+	}
+
+	if (config.registry_file) {
+		rc = registry_load(config.registry_file, &bridge);
+		if (rc != -1 && config.debug) printf("Registry: %d devices restored.\n", rc);
+	}
+
+	if (event_init())
+		return 1;
+	mqtt_ev.fd = timer_ev.fd = signal_ev.fd = pipe_ev.fd = batch_ev.fd = -1;
+
 	mosquitto_lib_init();
 	mosq = mosquitto_new(config.uuid, true, NULL);
 	if(!mosq){
@@ -550,10 +1773,33 @@ int main(int argc, char *argv[])
 		return 1;
 	}
 
-	mosquitto_connect_callback_set(mosq, on_mqtt_connect);
-	mosquitto_disconnect_callback_set(mosq, on_mqtt_disconnect);
-	mosquitto_message_callback_set(mosq, on_mqtt_message);
-	mosquitto_user_data_set(mosq, &sd);
+	if (config.pipeline) {
+		if (pipeline_init() || ring_init(&mqtt_ring, MQTT_RING_SLOTS, sizeof(struct mqtt_event)))
+			return 1;
+		if (event_add(&pipe_ev, pipeline_fd(), EPOLLIN, handle_pipeline, mosq))
+			return 1;
+		mosquitto_connect_callback_set(mosq, pipe_on_connect);
+		mosquitto_disconnect_callback_set(mosq, pipe_on_disconnect);
+		mosquitto_message_callback_set(mosq, pipe_on_message);
+		mosquitto_subscribe_callback_set(mosq, pipe_on_subscribe);
+	} else {
+		mosquitto_connect_callback_set(mosq, on_mqtt_connect);
+		mosquitto_disconnect_callback_set(mosq, on_mqtt_disconnect);
+		mosquitto_message_callback_set(mosq, on_mqtt_message);
+		mosquitto_subscribe_callback_set(mosq, on_mqtt_subscribe);
+	}
+	arena_init(&json_arena, JSON_ARENA_SIZE);
+	cJSON_IndexObjects(JSON_INDEX_MIN);
+	if (config.mqtt_inflight) {
+		outbox_init(&outbox, config.mqtt_inflight, config.mqtt_queue, config.mqtt_queue_policy);
+		mosquitto_publish_callback_set(mosq, config.pipeline ? pipe_on_publish : on_mqtt_publish);
+	}
+	if (config.mqtt_version == MQTT_VERSION_5) {
+		mosquitto_int_option(mosq, MOSQ_OPT_PROTOCOL_VERSION, MQTT_PROTOCOL_V5);
+		mosquitto_connect_callback_set(mosq, NULL);
+		mosquitto_connect_v5_callback_set(mosq, on_mqtt_connect_v5);
+	}
+	mosquitto_user_data_set(mosq, &bridge);
 
 	if (config.scripts_folder) {
 		if (access(config.scripts_folder, R_OK )) {
@@ -571,18 +1817,43 @@ int main(int argc, char *argv[])
 		bandwidth = true;
 	}
 
-	if (config.serial.port) {
-		sd = serialport_init(config.serial.port, config.serial.baudrate);
-		if( sd == -1 ) {
-			fprintf(stderr, "Couldn't open serial port.\n");
+	for (i = 0; i < bridge.port_count; i++) {
+		fd = event_timerfd(0);
+		if (fd == -1 || event_add(&bridge.ports[i].tx_ev, fd, EPOLLIN, handle_serial_tx, &bridge.ports[i]))
 			return 1;
-		} else {
-			serialport_flush(sd);
-			bridge.serial_ready = true;
-			if (config.debug) printf("Serial ready.\n");
+		if (serial_open(&bridge.ports[i], false))
+			return 1;
+	}
+	if (bridge.port_count) {
+		sleep(2);		// Let all the boards settle at once, see serialport_flush()
+		for (i = 0; i < bridge.port_count; i++) {
+			serialport_discard(bridge.ports[i].sd);
+			if (serial_listen(&bridge.ports[i]))
+				return 1;
+			serial_negotiate(&bridge.ports[i]);
+			if (config.debug) printf("Serial ready: %s\n", bridge.ports[i].serial->port);
 		}
 	}
 
+	fd = event_signalfd(&mask);
+	if (fd == -1 || event_add(&signal_ev, fd, EPOLLIN, handle_signal, mosq))
+		return 1;
+
+	fd = event_timerfd(1000);
+	if (fd == -1 || event_add(&timer_ev, fd, EPOLLIN, handle_timer, mosq))
+		return 1;
+
+	if (config.aggregate != BATCH_OFF) {
+		if (config.aggregate == BATCH_BRIDGE) {
+			batch_bridge = batch_new(config.aggregate_size);
+			snprintf(batch_bridge->topic, BATCH_TOPIC_LEN, "b/%s/batch", bridge.uuid);
+		}
+		fd = event_timerfd(config.aggregate_window);
+		if (fd == -1 || event_add(&batch_ev, fd, EPOLLIN, handle_batch, mosq))
+			return 1;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &connect_start);
 	rc = mosquitto_connect(mosq, config.mqtt_host, config.mqtt_port, 60);
 	if (rc) {
 		//TODO: ERROR: Error defined by errno.
@@ -590,92 +1861,73 @@ int main(int argc, char *argv[])
 		return -1;
 	}
 
-	alarm(1);
-
-	while (run) {
-		if (bridge.serial_ready) {
-			rc = serial_in(sd, mosq);
-			if (rc == -1) {
-				serial_hang(mosq);
-			} else if (rc > 0) {
-				bridge.serial_alive = BRIDGE_ALIVE_CNT;
-			}
+	if (config.pipeline) {
+		rc = mosquitto_loop_start(mosq);		// Inherits the signals blocked for the signalfd
+		if (rc) {
+			fprintf(stderr, "ERROR: %s\n", mosquitto_strerror(rc));
+			return -1;
 		}
+	}
 
-		if (user_signal) {
-			if (config.debug > 2) printf("Signal - SIGUSR: %d\n", user_signal);
-			signal_usr(sd, mosq);
-		}
+	while (run) {
+		if (connected)
+			mqtt_subscribe_flush(mosq);
+		if (connected && config.spool_dir && spool.count)
+			spool_replay(mosq);
+		if (!config.pipeline)
+			mqtt_sync_events(mosq);
+		if (event_wait(-1) == -1)
+			break;
+	}
 
-		rc = mosquitto_loop(mosq, 100, 1);
-		if (run && rc) {
-			if (config.debug > 2) printf("MQTT loop: %s\n", mosquitto_strerror(rc));
-			usleep(1000000);	// wait 100 msec
-			mosquitto_reconnect(mosq);
+	while (batch_pending)
+		batch_flush(mosq, batch_pending);
+
+	if (config.pipeline) {
+		mosquitto_disconnect(mosq);
+		mosquitto_loop_stop(mosq, false);
+		for (i = 0; i < bridge.port_count; i++)
+			pipeline_stop(&bridge.ports[i]);
+		while ((mqtt_event = ring_peek(&mqtt_ring))) {
+			if (mqtt_event->kind == MQTT_EV_MESSAGE)
+				mosquitto_message_free(&mqtt_event->msg);
+			ring_release(&mqtt_ring);
 		}
-		//usleep(20);
-		
-		if (seconds != last_second) {
-			last_second = seconds;
-			if (bridge.serial_alive) {
-				bridge.serial_alive--;
-				if (!bridge.serial_alive) {
-					if (config.debug > 1) printf("Serial timeout.\n");
-					serial_hang(mosq);
-				}
-			}
-
-			if (seconds % 30 == 0) {
-				if (connected) {
-					send_alive(mosq);
-
-					if (bandwidth) {
-						snprintf(gbuf, GBUF_SIZE, "{\"push\":\"bandwidth\",\"up\":%.0f,\"down\":%.0f}", upspeed, downspeed);
-						mqtt_publish(mosq, MAIN_TOPIC, gbuf);
-						if (config.debug > 2) printf("down: %f - up: %f\n", downspeed, upspeed);
-					}
-				} else {
-					if (config.debug) printf("MQTT Offline.\n");
-				}
-
-				for (device = bridge.device_list; device != NULL; device = device->next) {
-					device->alive -= 30;
-					if (device->alive < 0) {
-						if (connected) {
-							if (device->server_id != 0)
-								snprintf(gbuf, GBUF_SIZE, "%d", device->server_id);
-							else
-								snprintf(gbuf, GBUF_SIZE, "b/%s", bridge.serial_uuid);
-							mqtt_publish(mosq, gbuf, "{\"timeout\":1}");
-						}
-						if (config.debug) printf("Device: %s - Timeout.\n", device->uuid);
-						bridge_remove_device(&bridge, device->uuid);
-					}
-				}
+		ring_free(&mqtt_ring);
+		pipeline_cleanup();
+	}
 
-				if (!bridge.serial_alive) {
-					if (config.serial.port && !bridge.serial_ready) {
-						if (config.debug > 1) printf("Trying to reconnect serial port.\n");
-						serialport_close(sd);
-						sd = serialport_init(config.serial.port, config.serial.baudrate);
-						if( sd == -1 ) {
-							fprintf(stderr, "Couldn't open serial port.\n");
-						} else {
-							serialport_flush(sd);
-							bridge.serial_ready = true;
-							if (connected)
-								mqtt_publish(mosq, MAIN_TOPIC, "{\"trig\":\"serial\",\"serial\":\"open\"}");
-							if (config.debug) printf("Serial reopened.\n");
-						}
-					}
-				}
-			}
-		}
+	if (bridge.dirty && config.registry_file)
+		registry_save(config.registry_file, &bridge);
+	if (config.spool_dir)
+		spool_close(&spool);
+
+	for (i = 0; i < bridge.port_count; i++) {
+		if (bridge.ports[i].sd != -1)
+			serialport_close(bridge.ports[i].sd);
+		serialport_txq_clear(&bridge.ports[i].txq);
+		serialport_rx_free(&bridge.ports[i].rx);
+		free(bridge.ports[i].frame);
+		free(bridge.ports[i].scratch);
+		close(bridge.ports[i].tx_ev.fd);
 	}
 
-	if (bridge.serial_ready) {
-		serialport_close(sd);
+	close(timer_ev.fd);
+	close(signal_ev.fd);
+	if (batch_ev.fd != -1)
+		close(batch_ev.fd);
+	for (device = bridge.device_list; device; device = device->next) {
+		batch_free(device->batch);
+		filter_free(device->filter);
 	}
+	batch_free(batch_bridge);
+	free(pack_buf);
+	free(alias_map);
+	if (config.mqtt_inflight)
+		outbox_cleanup(&outbox);
+	pool_cleanup();
+	arena_cleanup(&json_arena);
+	event_cleanup();
 
 	mosquitto_destroy(mosq);
 
@@ -29,11 +29,27 @@
 #define MQTT_MAX_PAYLOAD_LEN 128
 #define UUID_LEN 36
 
+#define MQTT_SUBSCRIBE_DEVICE 0				// One topic per device uuid
+#define MQTT_SUBSCRIBE_WILDCARD 1			// <bridge uuid>/+, routed by the device index
+
+#define MQTT_VERSION_311 4					// Protocol levels, as MQTT_PROTOCOL_V311
+#define MQTT_VERSION_5 5					// and MQTT_PROTOCOL_V5
+
+#define SERIAL_FRAMING_TEXT 0				// Also the @B# levels
+#define SERIAL_FRAMING_BINARY 1				// Offered at open, text if the board declines
+#define SERIAL_FRAMING_PACKED 2				// Binary, json bodies as CBOR
+
+struct filter_rule;
+struct comma_template;
+
 struct bridge_serial{
 	char *port;
 	int baudrate;
 	int timeout;
 	int qos;
+	int pacing;
+	int framing;
+	int max_frame;							// Longest message either way, bytes
 };
 
 struct bridge_config{
@@ -42,9 +58,32 @@ struct bridge_config{
 	char *mqtt_host;
 	int mqtt_port;
 	int mqtt_qos;
-	struct bridge_serial serial;
+	int mqtt_subscribe;
+	int mqtt_version;
+	int topic_aliases;						// Most topic aliases used, MQTT v5
+	int message_expiry;						// secs, on device messages, MQTT v5
+	int mqtt_inflight;						// In-flight window, 0 for none
+	int mqtt_queue;							// Messages waiting for the window
+	int mqtt_queue_policy;
+	int pipeline;
+	struct bridge_serial *serial;
+	int serial_count;
 	char *scripts_folder;
 	char *interface;
+	char *registry_file;
+	char *spool_dir;
+	int spool_max;							// KB
+	int spool_policy;
+	int spool_rate;							// Replayed per second beyond the live rate
+	int aggregate;
+	int aggregate_window;					// msecs
+	int aggregate_size;						// Longest batch payload
+	int payload_encoding;
+	struct filter_rule *deadbands;			// Report by exception when any
+	int deadband_count;
+	int deadband_silence;					// secs
+	struct comma_template *comma_templates;	// Names of the comma frame values
+	int comma_count;
 	char *usr1_remap_uuid;
 	char *usr2_remap_uuid;
 	char *usr1_json;
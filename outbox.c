@@ -0,0 +1,271 @@
+/*
+* The MIT License (MIT)
+*
+* Copyright (c) 2013, Marcelo Aquino, https://github.com/mapnull
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+* THE SOFTWARE.
+*/
+
+#include "outbox.h"
+#include "device.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// max messages in flight, limit waiting behind them
+void outbox_init(struct outbox_t *outbox, int max, int limit, int policy)
+{
+	memset(outbox, 0, sizeof(struct outbox_t));
+	outbox->slots = calloc(max, sizeof(struct outbox_slot));
+	if (!outbox->slots) {
+		fprintf(stderr, "Error: No memory left.\n");
+		exit(1);
+	}
+	outbox->max = max;
+	outbox->limit = limit;
+	outbox->policy = policy;
+}
+
+static void outbox_free_msg(struct outbox_t *outbox, struct outbox_msg *msg)
+{
+	if (msg->device)
+		msg->device->queued--;
+	else
+		outbox->bridge_queued--;
+	outbox->count--;
+	free(msg->topic);
+	free(msg->payload);
+	free(msg);
+}
+
+void outbox_cleanup(struct outbox_t *outbox)
+{
+	struct outbox_msg *msg;
+
+	while ((msg = outbox->head)) {
+		outbox->head = msg->next;
+		outbox_free_msg(outbox, msg);
+	}
+	free(outbox->slots);
+	outbox->slots = NULL;
+}
+
+// Room in the window and nothing waiting: send right away
+bool outbox_ready(struct outbox_t *outbox)
+{
+	return outbox->inflight < outbox->max && !outbox->count;
+}
+
+static int outbox_group(struct outbox_t *outbox, struct device_t *device)
+{
+	return device ? device->queued : outbox->bridge_queued;
+}
+
+// Makes room by the policy, the queue is one over its limit
+static void outbox_evict(struct outbox_t *outbox)
+{
+	struct outbox_msg *msg, *prev = NULL, *victim_prev = NULL;
+	struct device_t *victim = NULL;
+	int most = -1;
+
+	if (!outbox->head)
+		return;
+
+	if (outbox->policy == OUTBOX_DROP_FAIR) {
+		for (msg = outbox->head; msg; msg = msg->next) {
+			if (outbox_group(outbox, msg->device) > most) {
+				most = outbox_group(outbox, msg->device);
+				victim = msg->device;
+			}
+		}
+		// Oldest message of the busiest device
+		for (msg = outbox->head; msg && msg->device != victim; msg = msg->next)
+			victim_prev = msg;
+		prev = victim_prev;
+	}
+
+	msg = prev ? prev->next : outbox->head;
+	if (prev)
+		prev->next = msg->next;
+	else
+		outbox->head = msg->next;
+	if (outbox->tail == msg)
+		outbox->tail = prev;
+	outbox_free_msg(outbox, msg);
+	outbox->dropped++;
+}
+
+// Queues a copy of the message, returns -1 when the policy dropped it
+int outbox_push(struct outbox_t *outbox, const char *topic, struct device_t *device,
+		const void *payload, int len, int qos, long long now)
+{
+	struct outbox_msg *msg;
+
+	if (outbox->count >= outbox->limit && outbox->policy == OUTBOX_DROP_NEWEST) {
+		outbox->dropped++;
+		return -1;
+	}
+
+	msg = malloc(sizeof(struct outbox_msg));
+	if (msg) {
+		msg->topic = strdup(topic);
+		msg->payload = malloc(len ? len : 1);
+	}
+	if (!msg || !msg->topic || !msg->payload) {
+		fprintf(stderr, "Error: No memory left.\n");
+		exit(1);
+	}
+	memcpy(msg->payload, payload, len);
+	msg->len = len;
+	msg->qos = qos;
+	msg->device = device;
+	msg->queued = now;
+	msg->next = NULL;
+
+	if (outbox->tail)
+		outbox->tail->next = msg;
+	else
+		outbox->head = msg;
+	outbox->tail = msg;
+	outbox->count++;
+	if (device)
+		device->queued++;
+	else
+		outbox->bridge_queued++;
+
+	if (outbox->count > outbox->limit)
+		outbox_evict(outbox);
+	return 0;
+}
+
+// Next message to send, NULL when none or the window is full
+struct outbox_msg *outbox_peek(struct outbox_t *outbox)
+{
+	if (outbox->inflight >= outbox->max)
+		return NULL;
+	return outbox->head;
+}
+
+// Done with the message outbox_peek() returned
+void outbox_pop(struct outbox_t *outbox, long long now)
+{
+	struct outbox_msg *msg = outbox->head;
+	long long wait = now - msg->queued;
+
+	outbox->head = msg->next;
+	if (!outbox->head)
+		outbox->tail = NULL;
+	outbox_free_msg(outbox, msg);
+
+	outbox->waited++;
+	outbox->wait_total += wait;
+	if (wait > outbox->wait_max)
+		outbox->wait_max = wait;
+}
+
+static void outbox_ack_stats(struct outbox_t *outbox, long long latency)
+{
+	outbox->acked++;
+	outbox->ack_total += latency;
+	if (latency > outbox->ack_max)
+		outbox->ack_max = latency;
+}
+
+// mosquitto took the message as mid
+void outbox_sent(struct outbox_t *outbox, int mid, int qos, long long now)
+{
+	int i;
+
+	outbox->sent++;
+	if (mid == outbox->early_mid) {
+		// Written and acknowledged from inside the publish call
+		outbox->early_mid = 0;
+		outbox_ack_stats(outbox, 0);
+		return;
+	}
+
+	for (i = 0; i < outbox->max; i++) {
+		if (!outbox->slots[i].mid) {
+			outbox->slots[i].mid = mid;
+			outbox->slots[i].qos = qos;
+			outbox->slots[i].sent = now;
+			outbox->inflight++;
+			return;
+		}
+	}
+}
+
+// Publish callback for mid
+void outbox_acked(struct outbox_t *outbox, int mid, long long now)
+{
+	int i;
+
+	for (i = 0; i < outbox->max; i++) {
+		if (outbox->slots[i].mid == mid) {
+			outbox_ack_stats(outbox, now - outbox->slots[i].sent);
+			outbox->slots[i].mid = 0;
+			outbox->inflight--;
+			return;
+		}
+	}
+	outbox->early_mid = mid;
+}
+
+// The device is going away, its queued messages are sent without it
+void outbox_forget(struct outbox_t *outbox, struct device_t *device)
+{
+	struct outbox_msg *msg;
+
+	for (msg = outbox->head; msg && device->queued; msg = msg->next) {
+		if (msg->device == device) {
+			msg->device = NULL;
+			device->queued--;
+			outbox->bridge_queued++;
+		}
+	}
+}
+
+// mosquitto resends qos 1 and 2 after a reconnect, qos 0 is gone
+void outbox_reconnect(struct outbox_t *outbox)
+{
+	int i;
+
+	for (i = 0; i < outbox->max; i++) {
+		if (outbox->slots[i].mid && !outbox->slots[i].qos) {
+			outbox->slots[i].mid = 0;
+			outbox->inflight--;
+		}
+	}
+	outbox->early_mid = 0;
+}
+
+// Lets go of the mids that never got their callback
+void outbox_expire(struct outbox_t *outbox, long long now)
+{
+	int i;
+
+	for (i = 0; i < outbox->max; i++) {
+		if (outbox->slots[i].mid && now - outbox->slots[i].sent > OUTBOX_ACK_TIMEOUT) {
+			outbox->slots[i].mid = 0;
+			outbox->inflight--;
+			outbox->dropped++;
+		}
+	}
+}
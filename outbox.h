@@ -0,0 +1,95 @@
+/*
+* The MIT License (MIT)
+*
+* Copyright (c) 2013, Marcelo Aquino, https://github.com/mapnull
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+* THE SOFTWARE.
+*/
+
+#ifndef OUTBOX_H
+#define OUTBOX_H
+
+#include <stdbool.h>
+
+/*
+* Bounded in-flight window for outbound MQTT messages. Every message handed
+* to mosquitto is tracked by mid until its publish callback, beyond the
+* window they wait in a bounded queue, the policy picks what goes when it
+* is full.
+*/
+
+#define OUTBOX_DROP_OLDEST 0
+#define OUTBOX_DROP_NEWEST 1
+#define OUTBOX_DROP_FAIR 2					// Oldest of the device with the most queued
+
+#define OUTBOX_ACK_TIMEOUT 300000			// msecs, a mid never acknowledged is let go
+
+struct device_t;
+
+struct outbox_slot {
+	int mid;								// 0 when free
+	int qos;
+	long long sent;							// msecs
+};
+
+struct outbox_msg {
+	char *topic;
+	void *payload;
+	int len;
+	int qos;
+	struct device_t *device;				// NULL once the device is gone
+	long long queued;						// msecs
+	struct outbox_msg *next;
+};
+
+struct outbox_t {
+	struct outbox_slot *slots;
+	int max;								// In-flight window
+	int inflight;
+	int early_mid;							// Acknowledged before outbox_sent()
+	struct outbox_msg *head;
+	struct outbox_msg *tail;
+	int count;
+	int limit;								// Queue length
+	int policy;
+	int bridge_queued;						// Queued without a device
+	// Stats
+	long sent;
+	long dropped;
+	long waited;
+	long long wait_total;
+	long long wait_max;
+	long acked;
+	long long ack_total;
+	long long ack_max;
+};
+
+void outbox_init(struct outbox_t *, int, int, int);
+void outbox_cleanup(struct outbox_t *);
+bool outbox_ready(struct outbox_t *);
+int outbox_push(struct outbox_t *, const char *, struct device_t *, const void *, int, int, long long);
+struct outbox_msg *outbox_peek(struct outbox_t *);
+void outbox_pop(struct outbox_t *, long long);
+void outbox_sent(struct outbox_t *, int, int, long long);
+void outbox_acked(struct outbox_t *, int, long long);
+void outbox_forget(struct outbox_t *, struct device_t *);
+void outbox_reconnect(struct outbox_t *);
+void outbox_expire(struct outbox_t *, long long);
+
+#endif
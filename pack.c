@@ -0,0 +1,627 @@
+/*
+* The MIT License (MIT)
+*
+* Copyright (c) 2013, Marcelo Aquino, https://github.com/mapnull
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+* THE SOFTWARE.
+*/
+
+#include "pack.h"
+#include "jscan.h"
+
+#include <errno.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct pack_out {
+	uint8_t *buf;
+	int len;
+	int max;
+	int fmt;
+	bool full;								// Ran out of room
+};
+
+struct pack_in {
+	const uint8_t *p;
+	const uint8_t *end;
+};
+
+static void put_bytes(struct pack_out *out, const void *data, int n)
+{
+	if (out->full || out->max - out->len < n) {
+		out->full = true;
+		return;
+	}
+	memcpy(out->buf + out->len, data, n);
+	out->len += n;
+}
+
+static void put_byte(struct pack_out *out, uint8_t b)
+{
+	put_bytes(out, &b, 1);
+}
+
+// Byte, then the value big endian in n bytes
+static void put_be(struct pack_out *out, uint8_t b, uint64_t v, int n)
+{
+	uint8_t tmp[9];
+	int i;
+
+	tmp[0] = b;
+	for (i = n; i > 0; i--, v >>= 8)
+		tmp[i] = v & 0xff;
+	put_bytes(out, tmp, n + 1);
+}
+
+// CBOR initial byte and argument
+static void cbor_head(struct pack_out *out, uint8_t major, uint64_t v)
+{
+	if (v < 24)
+		put_byte(out, major | v);
+	else if (v <= 0xff)
+		put_be(out, major | 24, v, 1);
+	else if (v <= 0xffff)
+		put_be(out, major | 25, v, 2);
+	else if (v <= 0xffffffff)
+		put_be(out, major | 26, v, 4);
+	else
+		put_be(out, major | 27, v, 8);
+}
+
+static void enc_container(struct pack_out *out, bool map, uint32_t n)
+{
+	if (out->fmt == PACK_CBOR)
+		cbor_head(out, map ? 0xa0 : 0x80, n);
+	else if (n < 16)
+		put_byte(out, (map ? 0x80 : 0x90) | n);
+	else if (n <= 0xffff)
+		put_be(out, map ? 0xde : 0xdc, n, 2);
+	else
+		put_be(out, map ? 0xdf : 0xdd, n, 4);
+}
+
+static void enc_str_head(struct pack_out *out, uint32_t n)
+{
+	if (out->fmt == PACK_CBOR)
+		cbor_head(out, 0x60, n);
+	else if (n < 32)
+		put_byte(out, 0xa0 | n);
+	else if (n <= 0xff)
+		put_be(out, 0xd9, n, 1);
+	else if (n <= 0xffff)
+		put_be(out, 0xda, n, 2);
+	else
+		put_be(out, 0xdb, n, 4);
+}
+
+static void enc_str(struct pack_out *out, const char *s, int n)
+{
+	enc_str_head(out, n);
+	put_bytes(out, s, n);
+}
+
+static void enc_int(struct pack_out *out, int64_t v)
+{
+	if (out->fmt == PACK_CBOR) {
+		if (v >= 0)
+			cbor_head(out, 0x00, v);
+		else
+			cbor_head(out, 0x20, -1 - v);
+	} else if (v >= 0) {
+		if (v < 128)
+			put_byte(out, v);
+		else if (v <= 0xff)
+			put_be(out, 0xcc, v, 1);
+		else if (v <= 0xffff)
+			put_be(out, 0xcd, v, 2);
+		else if (v <= 0xffffffff)
+			put_be(out, 0xce, v, 4);
+		else
+			put_be(out, 0xcf, v, 8);
+	} else {
+		if (v >= -32)
+			put_byte(out, (uint8_t)v);
+		else if (v >= INT8_MIN)
+			put_be(out, 0xd0, v, 1);
+		else if (v >= INT16_MIN)
+			put_be(out, 0xd1, v, 2);
+		else if (v >= INT32_MIN)
+			put_be(out, 0xd2, v, 4);
+		else
+			put_be(out, 0xd3, v, 8);
+	}
+}
+
+// Integral values as integers, single precision when it is exact
+static void enc_number(struct pack_out *out, double d)
+{
+	uint64_t bits;
+	uint32_t fbits;
+	float f;
+
+	if (d >= -9.2e18 && d <= 9.2e18 && (double)(int64_t)d == d) {
+		enc_int(out, (int64_t)d);
+		return;
+	}
+	f = (float)d;
+	if ((double)f == d) {
+		memcpy(&fbits, &f, 4);
+		put_be(out, out->fmt == PACK_CBOR ? 0xfa : 0xca, fbits, 4);
+	} else {
+		memcpy(&bits, &d, 8);
+		put_be(out, out->fmt == PACK_CBOR ? 0xfb : 0xcb, bits, 8);
+	}
+}
+
+// cJSON_False, cJSON_True or cJSON_NULL
+static void enc_simple(struct pack_out *out, int type)
+{
+	static const uint8_t cbor[] = { 0xf4, 0xf5, 0xf6 };
+	static const uint8_t msgpack[] = { 0xc2, 0xc3, 0xc0 };
+
+	put_byte(out, out->fmt == PACK_CBOR ? cbor[type] : msgpack[type]);
+}
+
+// Container with the header written once the item count is known
+static int enc_open(struct pack_out *out)
+{
+	int pos = out->len;
+
+	put_byte(out, 0);						// Placeholder, small containers take one byte
+	return pos;
+}
+
+static void enc_close(struct pack_out *out, int pos, bool map, uint32_t n)
+{
+	uint8_t buf[9];
+	struct pack_out head = { buf, 0, sizeof(buf), out->fmt, false };
+	int extra;
+
+	if (out->full)
+		return;
+	enc_container(&head, map, n);
+	extra = head.len - 1;
+	if (extra) {
+		if (out->max - out->len < extra) {
+			out->full = true;
+			return;
+		}
+		memmove(out->buf + pos + head.len, out->buf + pos + 1, out->len - pos - 1);
+		out->len += extra;
+	}
+	memcpy(out->buf + pos, buf, head.len);
+}
+
+static const char *skip_ws(const char *p)
+{
+	while (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r')
+		p++;
+	return p;
+}
+
+static int pack_json_string(struct pack_out *out, const char **pp)
+{
+	const char *end;
+	int n;
+
+	n = jscan_unescape(*pp + 1, NULL, &end);		// Length first, for the header
+	if (n < 0)
+		return -1;
+	enc_str_head(out, n);
+	if (out->full || out->max - out->len < n) {
+		out->full = true;
+		return 0;
+	}
+	jscan_unescape(*pp + 1, out->buf + out->len, &end);
+	out->len += n;
+	*pp = end;
+	return 0;
+}
+
+static int pack_json_number(struct pack_out *out, const char **pp)
+{
+	const char *p = *pp, *q = *pp;
+	char *end;
+	bool integer = true;
+	long long ll;
+	double d;
+
+	if (*q == '-')
+		q++;
+	while ((*q >= '0' && *q <= '9') || *q == '.' || *q == 'e' || *q == 'E' || *q == '+' || *q == '-') {
+		if (*q == '.' || *q == 'e' || *q == 'E')
+			integer = false;
+		q++;
+	}
+	if (integer) {
+		errno = 0;
+		ll = strtoll(p, &end, 10);
+		if (end == q && errno != ERANGE) {
+			enc_int(out, ll);
+			*pp = q;
+			return 0;
+		}
+	}
+	d = strtod(p, &end);
+	if (end != q)
+		return -1;
+	enc_number(out, d);
+	*pp = q;
+	return 0;
+}
+
+static int pack_json_value(struct pack_out *out, const char **pp, int depth)
+{
+	const char *p = skip_ws(*pp);
+	bool map;
+	uint32_t n;
+	int pos;
+
+	if (depth > PACK_DEPTH_MAX)
+		return -1;
+
+	switch (*p) {
+		case '{':
+		case '[':
+			map = *p == '{';
+			pos = enc_open(out);
+			p = skip_ws(p + 1);
+			n = 0;
+			if (*p != (map ? '}' : ']')) {
+				for (;;) {
+					if (map) {
+						if (*p != '"' || pack_json_string(out, &p))
+							return -1;
+						p = skip_ws(p);
+						if (*p != ':')
+							return -1;
+						p++;
+					}
+					if (pack_json_value(out, &p, depth + 1))
+						return -1;
+					n++;
+					p = skip_ws(p);
+					if (*p != ',')
+						break;
+					p = skip_ws(p + 1);
+				}
+				if (*p != (map ? '}' : ']'))
+					return -1;
+			}
+			enc_close(out, pos, map, n);
+			p++;
+			break;
+		case '"':
+			if (pack_json_string(out, &p))
+				return -1;
+			break;
+		case 't':
+			if (strncmp(p, "true", 4))
+				return -1;
+			enc_simple(out, cJSON_True);
+			p += 4;
+			break;
+		case 'f':
+			if (strncmp(p, "false", 5))
+				return -1;
+			enc_simple(out, cJSON_False);
+			p += 5;
+			break;
+		case 'n':
+			if (strncmp(p, "null", 4))
+				return -1;
+			enc_simple(out, cJSON_NULL);
+			p += 4;
+			break;
+		default:
+			if (*p != '-' && (*p < '0' || *p > '9'))
+				return -1;
+			if (pack_json_number(out, &p))
+				return -1;
+	}
+	if (out->full)
+		return -1;
+	*pp = p;
+	return 0;
+}
+
+// Returns the packed length, -1 when it is not JSON or PACK_NO_ROOM
+int pack_json(int fmt, const char *json, uint8_t *buf, int max)
+{
+	struct pack_out out = { buf, 0, max, fmt, false };
+
+	if (pack_json_value(&out, &json, 0) || *skip_ws(json))
+		return out.full ? PACK_NO_ROOM : -1;
+	return out.len;
+}
+
+static int pack_cjson_item(struct pack_out *out, cJSON *item, int depth)
+{
+	cJSON *child;
+	uint32_t n = 0;
+	bool map;
+
+	if (depth > PACK_DEPTH_MAX)
+		return -1;
+
+	switch (item->type & 255) {
+		case cJSON_False:
+		case cJSON_True:
+		case cJSON_NULL:
+			enc_simple(out, item->type & 255);
+			break;
+		case cJSON_Number:
+			enc_number(out, item->valuedouble);
+			break;
+		case cJSON_String:
+			enc_str(out, item->valuestring, strlen(item->valuestring));
+			break;
+		case cJSON_Array:
+		case cJSON_Object:
+			map = (item->type & 255) == cJSON_Object;
+			for (child = item->child; child; child = child->next)
+				n++;
+			enc_container(out, map, n);
+			for (child = item->child; child; child = child->next) {
+				if (map)
+					enc_str(out, child->string, strlen(child->string));
+				if (pack_cjson_item(out, child, depth + 1))
+					return -1;
+			}
+			break;
+		default:
+			return -1;
+	}
+	return 0;
+}
+
+int pack_cjson(int fmt, cJSON *json, uint8_t *buf, int max)
+{
+	struct pack_out out = { buf, 0, max, fmt, false };
+
+	if (pack_cjson_item(&out, json, 0))
+		return -1;
+	return out.full ? PACK_NO_ROOM : out.len;
+}
+
+static int get_be(struct pack_in *in, int n, uint64_t *v)
+{
+	if (in->end - in->p < n)
+		return -1;
+	*v = 0;
+	while (n--)
+		*v = *v << 8 | *in->p++;
+	return 0;
+}
+
+static cJSON *get_string(struct pack_in *in, uint64_t n)
+{
+	cJSON *item;
+
+	if ((uint64_t)(in->end - in->p) < n)
+		return NULL;
+	item = cJSON_CreateStringLen((const char *)in->p, n);	// Straight into the cJSON hooks
+	in->p += n;
+	return item;
+}
+
+static double get_float(uint64_t bits)
+{
+	uint32_t b = bits;
+	float f;
+
+	memcpy(&f, &b, 4);
+	return f;
+}
+
+static double get_double(uint64_t bits)
+{
+	double d;
+
+	memcpy(&d, &bits, 8);
+	return d;
+}
+
+static double get_half(unsigned int h)
+{
+	int e = h >> 10 & 0x1f, m = h & 0x3ff;
+	double d;
+
+	if (e == 0)
+		d = ldexp(m, -24);
+	else if (e != 31)
+		d = ldexp(m + 1024, e - 25);
+	else
+		d = m ? NAN : INFINITY;
+	return h & 0x8000 ? -d : d;
+}
+
+static cJSON *unpack_item(int, struct pack_in *, int);
+
+// Reads n items, or up to the CBOR break code when indefinite
+static cJSON *unpack_container(int fmt, struct pack_in *in, bool map, uint64_t n, bool indefinite, int depth)
+{
+	cJSON *container, *key = NULL, *item;
+
+	if (!(container = map ? cJSON_CreateObject() : cJSON_CreateArray()))
+		return NULL;
+
+	while (indefinite ? in->p < in->end && *in->p != 0xff : n-- > 0) {
+		if (map) {
+			key = unpack_item(fmt, in, depth + 1);
+			if (!key || key->type != cJSON_String)
+				goto error;
+		}
+		if (!(item = unpack_item(fmt, in, depth + 1)))
+			goto error;
+		if (map) {
+			item->string = key->valuestring;	// Hand the key over, no copy
+			key->valuestring = NULL;
+			cJSON_AddItemToArray(container, item);
+			cJSON_Delete(key);
+			key = NULL;
+		} else {
+			cJSON_AddItemToArray(container, item);
+		}
+	}
+	if (indefinite) {
+		if (in->p == in->end)
+			goto error;
+		in->p++;							// Break code
+	}
+	return container;
+
+error:
+	cJSON_Delete(key);
+	cJSON_Delete(container);
+	return NULL;
+}
+
+static cJSON *unpack_cbor(struct pack_in *in, int depth)
+{
+	uint8_t b, major, info;
+	uint64_t v;
+
+	b = *in->p++;
+	major = b >> 5;
+	info = b & 0x1f;
+
+	if (major == 7) {
+		switch (info) {
+			case 20: return cJSON_CreateFalse();
+			case 21: return cJSON_CreateTrue();
+			case 22:
+			case 23: return cJSON_CreateNull();
+			case 25: return get_be(in, 2, &v) ? NULL : cJSON_CreateNumber(get_half(v));
+			case 26: return get_be(in, 4, &v) ? NULL : cJSON_CreateNumber(get_float(v));
+			case 27: return get_be(in, 8, &v) ? NULL : cJSON_CreateNumber(get_double(v));
+		}
+		return NULL;
+	}
+
+	if (info == 31 && (major == 4 || major == 5))
+		return unpack_container(PACK_CBOR, in, major == 5, 0, true, depth);
+	if (info < 24)
+		v = info;
+	else if (info > 27 || get_be(in, 1 << (info - 24), &v))
+		return NULL;
+
+	switch (major) {
+		case 0: return cJSON_CreateNumber((double)v);
+		case 1: return cJSON_CreateNumber(-1.0 - (double)v);
+		case 3: return get_string(in, v);
+		case 4: return unpack_container(PACK_CBOR, in, false, v, false, depth);
+		case 5: return unpack_container(PACK_CBOR, in, true, v, false, depth);
+		case 6: return unpack_item(PACK_CBOR, in, depth + 1);		// Tag, the content is enough
+	}
+	return NULL;							// Byte strings
+}
+
+static cJSON *unpack_msgpack(struct pack_in *in, int depth)
+{
+	uint8_t b;
+	uint64_t v;
+	int n;
+
+	b = *in->p++;
+
+	if (b < 0x80)
+		return cJSON_CreateNumber(b);
+	if (b >= 0xe0)
+		return cJSON_CreateNumber((int8_t)b);
+	if (b < 0x90)
+		return unpack_container(PACK_MSGPACK, in, true, b & 0x0f, false, depth);
+	if (b < 0xa0)
+		return unpack_container(PACK_MSGPACK, in, false, b & 0x0f, false, depth);
+	if (b < 0xc0)
+		return get_string(in, b & 0x1f);
+
+	switch (b) {
+		case 0xc0: return cJSON_CreateNull();
+		case 0xc2: return cJSON_CreateFalse();
+		case 0xc3: return cJSON_CreateTrue();
+		case 0xca: return get_be(in, 4, &v) ? NULL : cJSON_CreateNumber(get_float(v));
+		case 0xcb: return get_be(in, 8, &v) ? NULL : cJSON_CreateNumber(get_double(v));
+		case 0xcc:
+		case 0xcd:
+		case 0xce:
+		case 0xcf:
+			return get_be(in, 1 << (b - 0xcc), &v) ? NULL : cJSON_CreateNumber((double)v);
+		case 0xd0:
+		case 0xd1:
+		case 0xd2:
+		case 0xd3:
+			n = 1 << (b - 0xd0);
+			if (get_be(in, n, &v))
+				return NULL;
+			switch (n) {
+				case 1: return cJSON_CreateNumber((int8_t)v);
+				case 2: return cJSON_CreateNumber((int16_t)v);
+				case 4: return cJSON_CreateNumber((int32_t)v);
+			}
+			return cJSON_CreateNumber((double)(int64_t)v);
+		case 0xd9:
+		case 0xda:
+		case 0xdb:
+			return get_be(in, 1 << (b - 0xd9), &v) ? NULL : get_string(in, v);
+		case 0xdc:
+		case 0xdd:
+			return get_be(in, 2 << (b - 0xdc), &v) ? NULL : unpack_container(PACK_MSGPACK, in, false, v, false, depth);
+		case 0xde:
+		case 0xdf:
+			return get_be(in, 2 << (b - 0xde), &v) ? NULL : unpack_container(PACK_MSGPACK, in, true, v, false, depth);
+	}
+	return NULL;							// bin, ext
+}
+
+static cJSON *unpack_item(int fmt, struct pack_in *in, int depth)
+{
+	if (depth > PACK_DEPTH_MAX || in->p == in->end)
+		return NULL;
+	return fmt == PACK_CBOR ? unpack_cbor(in, depth) : unpack_msgpack(in, depth);
+}
+
+// Commands are maps, the map headers of CBOR and MessagePack don't overlap
+// and neither starts like a JSON text
+int pack_detect(const uint8_t *buf, int len)
+{
+	if (len < 1)
+		return PACK_JSON;
+	if ((buf[0] >= 0xa0 && buf[0] <= 0xbb) || buf[0] == 0xbf)
+		return PACK_CBOR;
+	if ((buf[0] >= 0x80 && buf[0] <= 0x8f) || buf[0] == 0xde || buf[0] == 0xdf)
+		return PACK_MSGPACK;
+	return PACK_JSON;
+}
+
+cJSON *pack_parse(int fmt, const uint8_t *buf, int len)
+{
+	struct pack_in in = { buf, buf + len };
+	cJSON *json;
+
+	json = unpack_item(fmt, &in, 0);
+	if (json && in.p != in.end) {
+		cJSON_Delete(json);
+		return NULL;
+	}
+	return json;
+}
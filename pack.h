@@ -0,0 +1,53 @@
+/*
+* The MIT License (MIT)
+*
+* Copyright (c) 2013, Marcelo Aquino, https://github.com/mapnull
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+* THE SOFTWARE.
+*/
+
+#ifndef PACK_H
+#define PACK_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "cJSON.h"
+
+/*
+* Binary payload encodings. JSON text, from the serial frames or gbuf, and
+* cJSON trees are packed into CBOR (RFC 8949) or MessagePack; inbound
+* commands are unpacked back into a cJSON tree. Only the JSON data model is
+* used: no byte strings, tags are skipped, integers beyond 2^53 lose
+* precision when unpacked.
+*/
+
+#define PACK_JSON 0
+#define PACK_CBOR 1
+#define PACK_MSGPACK 2
+
+#define PACK_DEPTH_MAX 32
+#define PACK_NO_ROOM -2						// pack_json() and pack_cjson(), buffer too small
+
+int pack_detect(const uint8_t *, int);
+int pack_json(int, const char *, uint8_t *, int);
+int pack_cjson(int, cJSON *, uint8_t *, int);
+cJSON *pack_parse(int, const uint8_t *, int);
+
+#endif
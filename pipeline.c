@@ -0,0 +1,229 @@
+/*
+* The MIT License (MIT)
+*
+* Copyright (c) 2013, Marcelo Aquino, https://github.com/mapnull
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+* THE SOFTWARE.
+*/
+
+#include "pipeline.h"
+#include "bridge.h"
+#include "frame.h"
+#include "pool.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+#define PIPELINE_FULL_WAIT 100			// usecs between retries on a full ring
+
+static int wake_fd = -1;
+
+// Creates the eventfd the readers use to wake up the event loop
+int pipeline_init(void)
+{
+	wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (wake_fd == -1) {
+		perror("eventfd");
+		return -1;
+	}
+	return 0;
+}
+
+void pipeline_cleanup(void)
+{
+	if (wake_fd != -1) {
+		close(wake_fd);
+		wake_fd = -1;
+	}
+}
+
+int pipeline_fd(void)
+{
+	return wake_fd;
+}
+
+void pipeline_wake(void)
+{
+	uint64_t one = 1;
+
+	if (write(wake_fd, &one, sizeof(one)) == -1 && errno != EAGAIN)
+		perror("eventfd write");
+}
+
+// Starts a thread with every signal blocked, they belong to the signalfd
+int pipeline_spawn(pthread_t *thread, void *(*fn)(void *), void *data)
+{
+	sigset_t all, old;
+	int rc;
+
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &old);
+	rc = pthread_create(thread, NULL, fn, data);
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+	if (rc) {
+		fprintf(stderr, "Error: Can't start thread: %s\n", strerror(rc));
+		return -1;
+	}
+	return 0;
+}
+
+// Waits for the event loop to free a slot, NULL when asked to stop
+static struct pipeline_msg *pipeline_reserve(struct pipeline_reader *reader)
+{
+	struct pipeline_msg *msg;
+
+	while (!(msg = ring_reserve(&reader->ring))) {
+		if (atomic_load(&reader->stop))
+			return NULL;
+		usleep(PIPELINE_FULL_WAIT);
+	}
+	return msg;
+}
+
+static void *pipeline_read(void *data)
+{
+	struct pipeline_reader *reader = data;
+	struct bridge_port *port = reader->port;
+	struct pipeline_msg *msg;
+	struct pollfd fds[2];
+	int rc, len, pushed, max = port->serial->max_frame;
+
+	fds[0].fd = port->sd;
+	fds[0].events = POLLIN;
+	fds[1].fd = reader->stop_fd;
+	fds[1].events = POLLIN;
+
+	while (!atomic_load(&reader->stop)) {
+		if (poll(fds, 2, -1) == -1) {
+			if (errno == EINTR)
+				continue;
+			perror("poll");
+			break;
+		}
+		if (fds[1].revents)
+			break;
+
+		rc = serialport_fill(port->sd, &port->rx);
+		if (rc == -1 || (rc == 0 && (fds[0].revents & (POLLHUP | POLLERR)))) {
+			if ((msg = pipeline_reserve(reader))) {
+				msg->kind = PIPELINE_HANG;
+				ring_commit(&reader->ring);
+				pipeline_wake();
+			}
+			break;
+		}
+
+		for (pushed = 0; (msg = pipeline_reserve(reader)); ) {
+			len = frame_next(&port->rx, reader->binary, port->frame, max + 1, port->scratch, FRAME_ENCODED_MAX(max) + 1);
+			if (len == SERIALPORT_NO_FRAME || len == 0) {
+				if (len == 0)
+					continue;
+				break;
+			}
+			if (len == SERIALPORT_OVERFLOW) {
+				if (!reader->binary)
+					continue;
+				reader->binary = false;		// Text lines never carry the delimiter
+				msg->kind = PIPELINE_TEXT_MODE;
+			} else if (len == FRAME_INVALID) {
+				msg->kind = PIPELINE_BAD_FRAME;
+			} else {
+				// Same rule as serial_process() uses for the output side
+				if (len > SERIAL_INIT_LEN && !strncmp(port->frame, SERIAL_BINARY_STR, SERIAL_INIT_LEN))
+					reader->binary = frame_agree(port->frame[SERIAL_INIT_LEN], port->serial->framing) != SERIAL_FRAMING_TEXT;
+				msg->data = pool_get(len + 1);
+				if (!msg->data)
+					continue;		// Dropped, the slot is still ours
+				memcpy(msg->data, port->frame, len + 1);
+				msg->kind = PIPELINE_FRAME;
+				msg->len = len;
+			}
+			ring_commit(&reader->ring);
+			pushed++;
+		}
+		if (pushed)
+			pipeline_wake();		// Once per read, not per message
+	}
+
+	return NULL;
+}
+
+// Hands the reading of an open port to its own thread
+int pipeline_start(struct bridge_port *port)
+{
+	struct pipeline_reader *reader;
+
+	reader = calloc(1, sizeof(struct pipeline_reader));
+	if (!reader || ring_init(&reader->ring, PIPELINE_RING_SLOTS, sizeof(struct pipeline_msg))) {
+		fprintf(stderr, "Error: No memory left.\n");
+		exit(1);
+	}
+	reader->port = port;
+	reader->binary = false;
+	atomic_init(&reader->stop, false);
+	reader->stop_fd = eventfd(0, EFD_CLOEXEC);
+	if (reader->stop_fd == -1) {
+		perror("eventfd");
+		goto err;
+	}
+	if (pipeline_spawn(&reader->thread, pipeline_read, reader)) {
+		close(reader->stop_fd);
+		goto err;
+	}
+	port->reader = reader;
+	return 0;
+
+err:
+	ring_free(&reader->ring);
+	free(reader);
+	return -1;
+}
+
+// Stops the reader and drops what it left in the ring
+void pipeline_stop(struct bridge_port *port)
+{
+	struct pipeline_reader *reader = port->reader;
+	struct pipeline_msg *msg;
+	uint64_t one = 1;
+
+	if (!reader)
+		return;
+
+	atomic_store(&reader->stop, true);
+	if (write(reader->stop_fd, &one, sizeof(one)) == -1)
+		perror("eventfd write");
+	pthread_join(reader->thread, NULL);
+
+	while ((msg = ring_peek(&reader->ring))) {
+		if (msg->kind == PIPELINE_FRAME)
+			pool_put(msg->data);
+		ring_release(&reader->ring);
+	}
+	close(reader->stop_fd);
+	ring_free(&reader->ring);
+	free(reader);
+	port->reader = NULL;
+}
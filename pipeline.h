@@ -0,0 +1,71 @@
+/*
+* The MIT License (MIT)
+*
+* Copyright (c) 2013, Marcelo Aquino, https://github.com/mapnull
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+* THE SOFTWARE.
+*/
+
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include "ring.h"
+#include "serial.h"
+
+/*
+* Pipeline mode: every port gets a reader thread that frames its input
+* and hands the messages to the event loop through a ring, so a stalled
+* main thread never keeps the tty buffer from being drained.
+*/
+
+#define PIPELINE_RING_SLOTS 64
+
+#define PIPELINE_FRAME 0					// A message for serial_process()
+#define PIPELINE_TEXT_MODE 1				// Input fell back to text framing
+#define PIPELINE_BAD_FRAME 2
+#define PIPELINE_HANG 3						// Read error, the reader is gone
+
+struct bridge_port;
+
+struct pipeline_msg {
+	int kind;
+	int len;
+	char *data;								// From the pool, the consumer gives it back
+};
+
+struct pipeline_reader {
+	pthread_t thread;
+	struct bridge_port *port;
+	struct ring_t ring;
+	int stop_fd;							// eventfd, asks the thread to leave
+	atomic_bool stop;
+	bool binary;							// Input framing, follows the @B# messages
+};
+
+int pipeline_init(void);
+void pipeline_cleanup(void);
+int pipeline_fd(void);
+int pipeline_start(struct bridge_port *);
+void pipeline_stop(struct bridge_port *);
+void pipeline_wake(void);
+int pipeline_spawn(pthread_t *, void *(*)(void *), void *);
+
+#endif
@@ -0,0 +1,127 @@
+/*
+* The MIT License (MIT)
+*
+* Copyright (c) 2013, Marcelo Aquino, https://github.com/mapnull
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+* THE SOFTWARE.
+*/
+
+#include "pool.h"
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdlib.h>
+
+// Precedes every buffer, keeps the payload aligned
+union pool_hdr {
+	union pool_hdr *next;					// On a free list
+	int class;								// In use, POOL_CLASSES when not pooled
+	max_align_t align;
+};
+
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static union pool_hdr *pool_free[POOL_CLASSES];
+static int pool_count[POOL_CLASSES];
+static struct pool_stats stats;
+
+static int pool_class(int size)
+{
+	int class = 0;
+
+	while (class < POOL_CLASSES && (POOL_MIN << class) < size)
+		class++;
+	return class;
+}
+
+// Returns a buffer of at least size bytes, NULL when out of memory
+void *pool_get(int size)
+{
+	union pool_hdr *hdr;
+	int class;
+
+	class = pool_class(size);
+
+	pthread_mutex_lock(&pool_lock);
+	stats.gets++;
+	if (class < POOL_CLASSES && (hdr = pool_free[class])) {
+		pool_free[class] = hdr->next;
+		pool_count[class]--;
+		stats.cached--;
+		pthread_mutex_unlock(&pool_lock);
+		hdr->class = class;
+		return hdr + 1;
+	}
+	stats.mallocs++;
+	pthread_mutex_unlock(&pool_lock);
+
+	hdr = malloc(sizeof(union pool_hdr) + (class < POOL_CLASSES ? POOL_MIN << class : size));
+	if (!hdr)
+		return NULL;
+	hdr->class = class;
+	return hdr + 1;
+}
+
+void pool_put(void *buf)
+{
+	union pool_hdr *hdr;
+	int class;
+
+	if (!buf)
+		return;
+
+	hdr = (union pool_hdr *)buf - 1;
+	class = hdr->class;
+	if (class < POOL_CLASSES) {
+		pthread_mutex_lock(&pool_lock);
+		if (pool_count[class] < POOL_KEEP) {
+			hdr->next = pool_free[class];
+			pool_free[class] = hdr;
+			pool_count[class]++;
+			stats.cached++;
+			hdr = NULL;
+		}
+		pthread_mutex_unlock(&pool_lock);
+	}
+	free(hdr);
+}
+
+void pool_stats(struct pool_stats *out)
+{
+	pthread_mutex_lock(&pool_lock);
+	*out = stats;
+	pthread_mutex_unlock(&pool_lock);
+}
+
+// Frees the cached buffers, those in use stay valid
+void pool_cleanup(void)
+{
+	union pool_hdr *hdr;
+	int class;
+
+	pthread_mutex_lock(&pool_lock);
+	for (class = 0; class < POOL_CLASSES; class++) {
+		while ((hdr = pool_free[class])) {
+			pool_free[class] = hdr->next;
+			free(hdr);
+		}
+		pool_count[class] = 0;
+	}
+	stats.cached = 0;
+	pthread_mutex_unlock(&pool_lock);
+}
@@ -0,0 +1,52 @@
+/*
+* The MIT License (MIT)
+*
+* Copyright (c) 2013, Marcelo Aquino, https://github.com/mapnull
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+* THE SOFTWARE.
+*/
+
+#ifndef POOL_H
+#define POOL_H
+
+/*
+* Size classed buffer pool, powers of two from POOL_MIN bytes up. Freed
+* buffers wait on a list per class, up to POOL_KEEP of them, so the
+* variable sized serial messages don't go through malloc every time.
+* Larger requests fall back to malloc. Thread safe, the pipeline readers
+* take buffers that the event loop gives back.
+*/
+
+#define POOL_MIN_SHIFT 6
+#define POOL_MIN (1 << POOL_MIN_SHIFT)
+#define POOL_CLASSES 10						// Up to 32KB
+#define POOL_KEEP 32						// Free buffers kept per class
+
+struct pool_stats {
+	unsigned long gets;
+	unsigned long mallocs;					// Gets the free lists couldn't serve
+	int cached;								// Buffers on the free lists
+};
+
+void *pool_get(int);
+void pool_put(void *);
+void pool_stats(struct pool_stats *);
+void pool_cleanup(void);
+
+#endif
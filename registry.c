@@ -0,0 +1,179 @@
+/*
+* The MIT License (MIT)
+*
+* Copyright (c) 2013, Marcelo Aquino, https://github.com/mapnull
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+* THE SOFTWARE.
+*/
+
+#include "registry.h"
+#include "frame.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+static void registry_format_uuid(const uint8_t *bin, char *uuid)
+{
+	static const char hex[] = "0123456789abcdef";
+	int i, n;
+
+	for (i = 0, n = 0; i < DEVICE_UUID_LEN; i++) {
+		if (i == 8 || i == 13 || i == 18 || i == 23) {
+			uuid[i] = '-';
+		} else {
+			uuid[i] = hex[(n & 1) ? bin[n >> 1] & 0x0f : bin[n >> 1] >> 4];
+			n++;
+		}
+	}
+	uuid[DEVICE_UUID_LEN] = 0;
+}
+
+// Adds the devices of the snapshot to the bridge
+// returns the number of devices restored, -1 when the file is missing or invalid
+int registry_load(const char *path, struct bridge_t *bridge)
+{
+	struct registry_header *header;
+	struct registry_record *record;
+	struct device_t *device;
+	struct bridge_port *port;
+	struct stat st;
+	char uuid[DEVICE_UUID_LEN + 1];
+	void *map;
+	int fd, i, restored = -1;
+
+	fd = open(path, O_RDONLY);
+	if (fd == -1) {
+		if (errno != ENOENT)
+			fprintf(stderr, "Error: Can't open registry %s: %s\n", path, strerror(errno));
+		return -1;
+	}
+	if (fstat(fd, &st) == -1 || st.st_size < (off_t)sizeof(struct registry_header)) {
+		close(fd);
+		return -1;
+	}
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return -1;
+
+	header = map;
+	record = (struct registry_record *)(header + 1);
+	if (header->magic != REGISTRY_MAGIC || header->version != REGISTRY_VERSION ||
+			header->record_size != sizeof(struct registry_record) ||
+			st.st_size != (off_t)(sizeof(struct registry_header) + header->count * sizeof(struct registry_record)) ||
+			header->crc != frame_crc16((uint8_t *)record, header->count * sizeof(struct registry_record))) {
+		fprintf(stderr, "Error: Invalid registry %s, ignored.\n", path);
+		goto out;
+	}
+
+	restored = 0;
+	for (i = 0; i < (int)header->count; i++, record++) {
+		if (record->port < 0 || record->port >= bridge->port_count)
+			continue;		// The port left the config
+		port = &bridge->ports[record->port];
+
+		registry_format_uuid(record->uuid, uuid);
+		if (bridge_get_device(bridge, uuid))
+			continue;
+		device = bridge_add_device(bridge, port, uuid);
+		if (!device)
+			continue;
+		bridge_set_device_id(bridge, device, record->id);
+
+		if (record->id == 0 && !port->serial_uuid) {
+			port->serial_uuid = strdup(uuid);
+			if (!port->serial_uuid) {
+				fprintf(stderr, "Error: No memory left.\n");
+				exit(1);
+			}
+		}
+		restored++;
+	}
+	bridge->dirty = false;
+
+out:
+	munmap(map, st.st_size);
+	return restored;
+}
+
+// Writes the device table to a temporary file and renames it over path,
+// a crash never leaves a half written snapshot behind
+int registry_save(const char *path, struct bridge_t *bridge)
+{
+	struct registry_header *header;
+	struct registry_record *record;
+	struct device_t *device;
+	char tmp[PATH_MAX];
+	size_t size;
+	void *map;
+	int fd;
+
+	size = sizeof(struct registry_header) + bridge->devices * sizeof(struct registry_record);
+	if (snprintf(tmp, sizeof(tmp), "%s.tmp", path) >= (int)sizeof(tmp))
+		return -1;
+
+	fd = open(tmp, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd == -1) {
+		fprintf(stderr, "Error: Can't write registry %s: %s\n", tmp, strerror(errno));
+		return -1;
+	}
+	if (ftruncate(fd, size) == -1) {
+		close(fd);
+		unlink(tmp);
+		return -1;
+	}
+	map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED) {
+		close(fd);
+		unlink(tmp);
+		return -1;
+	}
+
+	header = map;
+	record = (struct registry_record *)(header + 1);
+	for (device = bridge->device_list; device != NULL; device = device->next, record++) {
+		memcpy(record->uuid, device->uuid_bin, DEVICE_UUID_BIN);
+		record->id = device->id;
+		record->port = device->port ? device->port->index : -1;
+	}
+	header->magic = REGISTRY_MAGIC;
+	header->version = REGISTRY_VERSION;
+	header->record_size = sizeof(struct registry_record);
+	header->count = bridge->devices;
+	header->crc = frame_crc16((uint8_t *)(header + 1), bridge->devices * sizeof(struct registry_record));
+
+	msync(map, size, MS_SYNC);
+	munmap(map, size);
+	close(fd);
+
+	if (rename(tmp, path) == -1) {
+		fprintf(stderr, "Error: Can't write registry %s: %s\n", path, strerror(errno));
+		unlink(tmp);
+		return -1;
+	}
+	bridge->dirty = false;
+	return 0;
+}
@@ -0,0 +1,58 @@
+/*
+* The MIT License (MIT)
+*
+* Copyright (c) 2013, Marcelo Aquino, https://github.com/mapnull
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+* THE SOFTWARE.
+*/
+
+#ifndef REGISTRY_H
+#define REGISTRY_H
+
+#include <stdint.h>
+#include "bridge.h"
+
+/*
+* Snapshot of the device table, so a restarted bridge knows its devices
+* and subscribes to them before they speak again. The file is a header
+* followed by fixed size records, written through a mapping and renamed
+* over the previous snapshot.
+*/
+
+#define REGISTRY_MAGIC 0x4d425247			// "MBRG"
+#define REGISTRY_VERSION 2
+
+struct registry_header {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t record_size;
+	uint32_t count;
+	uint32_t crc;							// crc16 of the records
+};
+
+struct registry_record {
+	uint8_t uuid[DEVICE_UUID_BIN];
+	int32_t id;								// Multi-drop id; server ids come again on every connect
+	int32_t port;							// Index in the config, -1 if unknown
+};
+
+int registry_load(const char *, struct bridge_t *);
+int registry_save(const char *, struct bridge_t *);
+
+#endif
@@ -0,0 +1,87 @@
+/*
+* The MIT License (MIT)
+*
+* Copyright (c) 2013, Marcelo Aquino, https://github.com/mapnull
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+* THE SOFTWARE.
+*/
+
+#include "ring.h"
+
+#include <stdlib.h>
+
+// slots is rounded up to a power of two
+int ring_init(struct ring_t *ring, unsigned int slots, size_t slot_size)
+{
+	unsigned int size = 1;
+
+	while (size < slots)
+		size <<= 1;
+
+	ring->slots = malloc(size * slot_size);
+	if (!ring->slots)
+		return -1;
+	ring->mask = size - 1;
+	ring->slot_size = slot_size;
+	atomic_init(&ring->head, 0);
+	atomic_init(&ring->tail, 0);
+	return 0;
+}
+
+void ring_free(struct ring_t *ring)
+{
+	free(ring->slots);
+	ring->slots = NULL;
+}
+
+// Producer side, returns NULL when the ring is full
+void *ring_reserve(struct ring_t *ring)
+{
+	unsigned int head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+	unsigned int tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+
+	if (head - tail > ring->mask)
+		return NULL;
+	return ring->slots + (head & ring->mask) * ring->slot_size;
+}
+
+void ring_commit(struct ring_t *ring)
+{
+	unsigned int head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+
+	atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+}
+
+// Consumer side, returns NULL when the ring is empty
+void *ring_peek(struct ring_t *ring)
+{
+	unsigned int tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+	unsigned int head = atomic_load_explicit(&ring->head, memory_order_acquire);
+
+	if (head == tail)
+		return NULL;
+	return ring->slots + (tail & ring->mask) * ring->slot_size;
+}
+
+void ring_release(struct ring_t *ring)
+{
+	unsigned int tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+
+	atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+}
@@ -0,0 +1,57 @@
+/*
+* The MIT License (MIT)
+*
+* Copyright (c) 2013, Marcelo Aquino, https://github.com/mapnull
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+* THE SOFTWARE.
+*/
+
+#ifndef RING_H
+#define RING_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+
+/*
+* Lock-free ring of fixed size slots for one producer and one consumer
+* thread. The producer fills the slot ring_reserve() hands out and
+* publishes it with ring_commit(), the consumer reads ring_peek() and
+* gives the slot back with ring_release().
+*/
+
+#define RING_CACHELINE 64
+
+struct ring_t {
+	atomic_uint head;						// Written by the producer
+	char pad_head[RING_CACHELINE - sizeof(atomic_uint)];
+	atomic_uint tail;						// Written by the consumer
+	char pad_tail[RING_CACHELINE - sizeof(atomic_uint)];
+	unsigned int mask;
+	size_t slot_size;
+	char *slots;
+};
+
+int ring_init(struct ring_t *, unsigned int, size_t);
+void ring_free(struct ring_t *);
+void *ring_reserve(struct ring_t *);
+void ring_commit(struct ring_t *);
+void *ring_peek(struct ring_t *);
+void ring_release(struct ring_t *);
+
+#endif
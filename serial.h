@@ -25,6 +25,8 @@
 #ifndef SERIAL_H
 #define SERIAL_H
 
+#define SERIAL_MAX_BUF 100					// Longest message from a board, max_frame default
+#define SERIAL_MAX_FRAME 16384				// Largest max_frame
 #define SERIAL_INIT_LEN 3
 #define SERIAL_INIT_0 '@'
 #define SERIAL_INIT_2 '#'
@@ -35,6 +37,7 @@
 #define SERIAL_SINGLE_JSON_STR "@J#"		// Single device, json format
 #define SERIAL_MULTI_COMMA_STR "@c#"		// Multi devices, comma format
 #define SERIAL_MULTI_JSON_STR "@j#"			// Multi devices, json format
+#define SERIAL_BINARY_STR "@B#"				// Framing negotiation, "2" packed, "1" binary, "0" text
 
 #define SERIAL_DEBUG_C 'G'
 #define SERIAL_UUID_C 'U'
@@ -42,5 +45,6 @@
 #define SERIAL_SINGLE_JSON_C 'J'
 #define SERIAL_MULTI_COMMA_C 'c'
 #define SERIAL_MULTI_JSON_C 'j'
+#define SERIAL_BINARY_C 'B'
 
 #endif
@@ -0,0 +1,369 @@
+/*
+* The MIT License (MIT)
+*
+* Copyright (c) 2013, Marcelo Aquino, https://github.com/mapnull
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+* THE SOFTWARE.
+*/
+
+#include "spool.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+static void spool_path(struct spool_t *spool, unsigned int seq, char *path)
+{
+	snprintf(path, PATH_MAX, "%s/%08u.seg", spool->dir, seq);
+}
+
+static struct spool_segment *spool_add_segment(struct spool_t *spool, unsigned int seq)
+{
+	struct spool_segment *segs;
+
+	if (spool->seg_count == spool->seg_alloc) {
+		segs = realloc(spool->segs, (spool->seg_alloc + 8) * sizeof(struct spool_segment));
+		if (!segs) {
+			fprintf(stderr, "Error: No memory left.\n");
+			exit(1);
+		}
+		spool->segs = segs;
+		spool->seg_alloc += 8;
+	}
+	segs = &spool->segs[spool->seg_count++];
+	segs->seq = seq;
+	segs->size = 0;
+	segs->count = 0;
+	return segs;
+}
+
+static int spool_seq_cmp(const void *a, const void *b)
+{
+	const struct spool_segment *sa = a, *sb = b;
+
+	return sa->seq < sb->seq ? -1 : sa->seq > sb->seq;
+}
+
+// Counts the records of a segment left by a previous run, a torn record
+// at the end is cut off
+static void spool_scan_segment(struct spool_t *spool, struct spool_segment *seg)
+{
+	struct spool_record rec;
+	char path[PATH_MAX];
+	long off = 0, len;
+	int fd;
+
+	spool_path(spool, seg->seq, path);
+	fd = open(path, O_RDWR | O_CLOEXEC);
+	if (fd == -1)
+		return;
+
+	for (;;) {
+		if (pread(fd, &rec, sizeof(rec), off) != sizeof(rec) || rec.magic != SPOOL_MAGIC)
+			break;
+		len = sizeof(rec) + rec.topic_len + rec.payload_len;
+		if (rec.topic_len + rec.payload_len > SPOOL_RECORD_LIMIT || off + len > seg->size)
+			break;
+		off += len;
+		seg->count++;
+	}
+	if (off != seg->size) {
+		if (ftruncate(fd, off) == -1)
+			perror("ftruncate");
+		seg->size = off;
+	}
+	close(fd);
+}
+
+// record_max is the longest topic and payload to keep, from the config
+int spool_open(struct spool_t *spool, const char *dir, long max_size, int policy, int record_max)
+{
+	struct spool_segment *seg;
+	struct dirent *entry;
+	struct stat st;
+	char path[PATH_MAX];
+	unsigned int seq;
+	int i, n;
+	DIR *dp;
+
+	memset(spool, 0, sizeof(struct spool_t));
+	spool->write_fd = -1;
+	spool->read_fd = -1;
+	spool->max_size = max_size;
+	spool->policy = policy;
+	spool->record_max = record_max > SPOOL_RECORD_MIN ? record_max : SPOOL_RECORD_MIN;
+	spool->buf_size = spool->record_max + 2;
+	spool->buf = malloc(spool->buf_size);
+	spool->dir = strdup(dir);
+	if (!spool->dir || !spool->buf) {
+		fprintf(stderr, "Error: No memory left.\n");
+		exit(1);
+	}
+
+	if (mkdir(dir, 0755) == -1 && errno != EEXIST) {
+		fprintf(stderr, "Error: Can't create spool folder %s: %s\n", dir, strerror(errno));
+		return -1;
+	}
+	dp = opendir(dir);
+	if (!dp) {
+		fprintf(stderr, "Error: Can't open spool folder %s: %s\n", dir, strerror(errno));
+		return -1;
+	}
+	while ((entry = readdir(dp))) {
+		if (sscanf(entry->d_name, "%u.seg%n", &seq, &n) != 1 || entry->d_name[n] != 0)
+			continue;
+		spool_path(spool, seq, path);
+		if (stat(path, &st) == -1)
+			continue;
+		seg = spool_add_segment(spool, seq);
+		seg->size = st.st_size;
+	}
+	closedir(dp);
+
+	qsort(spool->segs, spool->seg_count, sizeof(struct spool_segment), spool_seq_cmp);
+	for (i = 0; i < spool->seg_count; i++) {
+		spool_scan_segment(spool, &spool->segs[i]);
+		spool->size += spool->segs[i].size;
+		spool->count += spool->segs[i].count;
+	}
+	if (spool->seg_count)
+		spool->next_seq = spool->segs[spool->seg_count - 1].seq + 1;
+	return 0;
+}
+
+void spool_close(struct spool_t *spool)
+{
+	if (spool->write_fd != -1)
+		close(spool->write_fd);
+	if (spool->read_fd != -1)
+		close(spool->read_fd);
+	free(spool->segs);
+	free(spool->dir);
+	free(spool->buf);
+	spool->segs = NULL;
+	spool->dir = NULL;
+	spool->buf = NULL;
+}
+
+// Removes the oldest segment, whatever is left in it is lost
+static void spool_remove_oldest(struct spool_t *spool)
+{
+	struct spool_segment *seg = &spool->segs[0];
+	char path[PATH_MAX];
+
+	if (spool->read_fd != -1) {
+		close(spool->read_fd);
+		spool->read_fd = -1;
+	}
+	spool->read_off = 0;
+	if (spool->seg_count == 1 && spool->write_fd != -1) {
+		close(spool->write_fd);
+		spool->write_fd = -1;
+	}
+
+	spool_path(spool, seg->seq, path);
+	if (unlink(path) == -1)
+		perror("unlink");
+	spool->size -= seg->size;
+	spool->count -= seg->count;
+	spool->dropped += seg->count;
+
+	spool->seg_count--;
+	memmove(&spool->segs[0], &spool->segs[1], spool->seg_count * sizeof(struct spool_segment));
+}
+
+static int spool_open_writer(struct spool_t *spool, bool roll)
+{
+	struct spool_segment *seg;
+	char path[PATH_MAX];
+
+	if (spool->write_fd != -1) {
+		close(spool->write_fd);
+		spool->write_fd = -1;
+	}
+	if (roll || !spool->seg_count)
+		seg = spool_add_segment(spool, spool->next_seq++);
+	else
+		seg = &spool->segs[spool->seg_count - 1];
+
+	spool_path(spool, seg->seq, path);
+	spool->write_fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+	if (spool->write_fd == -1) {
+		fprintf(stderr, "Error: Can't write spool %s: %s\n", path, strerror(errno));
+		return -1;
+	}
+	return 0;
+}
+
+// Appends a message, making room as the policy says
+// returns 0 on success, -1 when the message was dropped
+int spool_push(struct spool_t *spool, const char *topic, const char *payload, int len, int qos)
+{
+	struct spool_record rec;
+	struct spool_segment *seg;
+	struct iovec iov[3];
+	size_t topic_len = strlen(topic);
+	long size;
+
+	size = sizeof(rec) + topic_len + len;
+	if (topic_len > UINT8_MAX || topic_len + len > spool->record_max) {
+		spool->dropped++;
+		return -1;
+	}
+
+	if (spool->size + size > spool->max_size) {
+		if (spool->policy == SPOOL_DROP_NEWEST) {
+			spool->dropped++;
+			return -1;
+		}
+		while (spool->seg_count && spool->size + size > spool->max_size)
+			spool_remove_oldest(spool);
+	}
+
+	seg = spool->seg_count ? &spool->segs[spool->seg_count - 1] : NULL;
+	if (!seg || (seg->size && seg->size + size > SPOOL_SEGMENT_SIZE)) {
+		if (spool_open_writer(spool, true))
+			return -1;
+	} else if (spool->write_fd == -1) {
+		if (spool_open_writer(spool, false))
+			return -1;
+	}
+	seg = &spool->segs[spool->seg_count - 1];
+
+	rec.magic = SPOOL_MAGIC;
+	rec.qos = qos;
+	rec.topic_len = topic_len;
+	rec.payload_len = len;
+	rec.time = time(NULL);
+
+	iov[0].iov_base = &rec;
+	iov[0].iov_len = sizeof(rec);
+	iov[1].iov_base = (void *)topic;
+	iov[1].iov_len = topic_len;
+	iov[2].iov_base = (void *)payload;
+	iov[2].iov_len = len;
+	if (writev(spool->write_fd, iov, 3) != size) {
+		perror("Spool write");
+		if (ftruncate(spool->write_fd, seg->size) == -1)
+			perror("ftruncate");
+		spool->dropped++;
+		return -1;
+	}
+
+	seg->size += size;
+	seg->count++;
+	spool->size += size;
+	spool->count++;
+	return 0;
+}
+
+// Reads the oldest message, msg stays valid until the next call
+// returns 1 when there is one, 0 when the spool is empty
+int spool_peek(struct spool_t *spool, struct spool_msg *msg)
+{
+	struct spool_segment *seg;
+	struct spool_record rec;
+	char path[PATH_MAX], *buf;
+	int len;
+
+	while (spool->count) {
+		seg = &spool->segs[0];
+		if (spool->read_fd == -1) {
+			spool_path(spool, seg->seq, path);
+			spool->read_fd = open(path, O_RDONLY | O_CLOEXEC);
+			if (spool->read_fd == -1) {
+				fprintf(stderr, "Error: Can't read spool %s: %s\n", path, strerror(errno));
+				spool_remove_oldest(spool);
+				continue;
+			}
+		}
+
+		if (spool->read_off >= seg->size ||
+				pread(spool->read_fd, &rec, sizeof(rec), spool->read_off) != sizeof(rec) ||
+				rec.magic != SPOOL_MAGIC || rec.topic_len + rec.payload_len > SPOOL_RECORD_LIMIT) {
+			spool_remove_oldest(spool);		// Done with it, or unreadable
+			continue;
+		}
+
+		len = rec.topic_len + rec.payload_len;
+		if (len + 2 > spool->buf_size) {
+			// Queued under a config with longer messages
+			buf = realloc(spool->buf, len + 2);
+			if (!buf) {
+				fprintf(stderr, "Error: No memory left.\n");
+				exit(1);
+			}
+			spool->buf = buf;
+			spool->buf_size = len + 2;
+		}
+		if (pread(spool->read_fd, spool->buf, len, spool->read_off + sizeof(rec)) != len) {
+			spool_remove_oldest(spool);
+			continue;
+		}
+		// topic\0payload\0
+		memmove(spool->buf + rec.topic_len + 1, spool->buf + rec.topic_len, rec.payload_len);
+		spool->buf[rec.topic_len] = 0;
+		spool->buf[len + 1] = 0;
+
+		msg->topic = spool->buf;
+		msg->payload = spool->buf + rec.topic_len + 1;
+		msg->len = rec.payload_len;
+		msg->qos = rec.qos & ~SPOOL_EXPIRES;
+		msg->expires = rec.qos & SPOOL_EXPIRES;
+		msg->time = rec.time;
+		spool->peek_len = sizeof(rec) + len;
+		return 1;
+	}
+	return 0;
+}
+
+// Drops the message spool_peek() returned, once it has been sent
+void spool_pop(struct spool_t *spool)
+{
+	struct spool_segment *seg = &spool->segs[0];
+	char path[PATH_MAX];
+
+	spool->read_off += spool->peek_len;
+	seg->count--;
+	spool->count--;
+	spool->replayed++;
+
+	if (spool->read_off < seg->size)
+		return;
+
+	if (spool->seg_count > 1) {
+		spool_remove_oldest(spool);
+	} else {
+		// The segment being written, empty it in place
+		spool_path(spool, seg->seq, path);
+		if (truncate(path, 0) == -1)
+			perror("truncate");
+		spool->size -= seg->size;
+		seg->size = 0;
+		spool->read_off = 0;
+	}
+}
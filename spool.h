@@ -0,0 +1,99 @@
+/*
+* The MIT License (MIT)
+*
+* Copyright (c) 2013, Marcelo Aquino, https://github.com/mapnull
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+* THE SOFTWARE.
+*/
+
+#ifndef SPOOL_H
+#define SPOOL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+/*
+* Store-and-forward queue for outbound messages while the broker is away.
+* Messages are appended to segment files in the spool folder and replayed
+* from the oldest one, a segment is removed once fully replayed. Delivery
+* is at least once: after a crash the current segment is replayed again.
+*/
+
+#define SPOOL_SEGMENT_SIZE (64 * 1024)
+#define SPOOL_RECORD_MIN 4096				// Topic and payload of one message, at least
+#define SPOOL_RECORD_LIMIT (1024 * 1024)	// Sanity bound on the records read back
+#define SPOOL_MAGIC 0x5351
+
+#define SPOOL_EXPIRES 0x80					// Flag on the qos: telemetry, subject to message_expiry
+
+#define SPOOL_DROP_OLDEST 0					// Drop the oldest segment to make room
+#define SPOOL_DROP_NEWEST 1					// Refuse new messages when full
+
+struct spool_record {
+	uint16_t magic;
+	uint8_t qos;
+	uint8_t topic_len;
+	uint32_t payload_len;
+	int64_t time;							// Wall clock when queued
+};
+
+struct spool_segment {
+	unsigned int seq;						// File name, %08u.seg
+	long size;
+	int count;
+};
+
+struct spool_msg {
+	char *topic;
+	char *payload;
+	int len;
+	int qos;
+	bool expires;
+	time_t time;
+};
+
+struct spool_t {
+	char *dir;
+	long max_size;
+	int policy;
+	struct spool_segment *segs;				// Oldest first, the last one is written
+	int seg_count;
+	int seg_alloc;
+	unsigned int next_seq;
+	int write_fd;
+	int read_fd;							// On segs[0]
+	long read_off;
+	long peek_len;							// Record spool_peek() returned
+	long size;
+	int count;
+	unsigned long dropped;
+	unsigned long replayed;
+	int record_max;							// Longest topic and payload taken
+	char *buf;								// Record spool_peek() read
+	int buf_size;
+};
+
+int spool_open(struct spool_t *, const char *, long, int, int);
+void spool_close(struct spool_t *);
+int spool_push(struct spool_t *, const char *, const char *, int, int);
+int spool_peek(struct spool_t *, struct spool_msg *);
+void spool_pop(struct spool_t *);
+
+#endif
@@ -0,0 +1,133 @@
+/*
+* The MIT License (MIT)
+*
+* Copyright (c) 2013, Marcelo Aquino, https://github.com/mapnull
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+* THE SOFTWARE.
+*/
+
+#include "wheel.h"
+
+#include <string.h>
+
+void wheel_init(struct wheel_t *wheel, unsigned long now)
+{
+	memset(wheel->slots, 0, sizeof(wheel->slots));
+	wheel->now = now;
+}
+
+void wheel_timer_init(struct wheel_timer *timer)
+{
+	timer->next = NULL;
+	timer->pprev = NULL;
+	timer->expires = 0;
+}
+
+static void wheel_link(struct wheel_t *wheel, struct wheel_timer *timer)
+{
+	struct wheel_timer **slot;
+	unsigned long expires = timer->expires;
+	long delta = (long)(expires - wheel->now);
+	int level;
+
+	if (delta < 0) {
+		// Already due, runs on the next tick
+		slot = &wheel->slots[0][wheel->now & WHEEL_MASK];
+	} else {
+		for (level = 0; level < WHEEL_LEVELS - 1; level++) {
+			if ((unsigned long)delta < (1UL << (WHEEL_BITS * (level + 1))))
+				break;
+		}
+		if ((unsigned long)delta >= (1UL << (WHEEL_BITS * WHEEL_LEVELS))) {
+			// Beyond the wheel, park it as far as it goes
+			expires = wheel->now + (1UL << (WHEEL_BITS * WHEEL_LEVELS)) - 1;
+			level = WHEEL_LEVELS - 1;
+		}
+		slot = &wheel->slots[level][(expires >> (WHEEL_BITS * level)) & WHEEL_MASK];
+	}
+
+	timer->next = *slot;
+	if (timer->next)
+		timer->next->pprev = &timer->next;
+	timer->pprev = slot;
+	*slot = timer;
+}
+
+// Arms the timer to fire at tick expires, re-arming it if already pending
+void wheel_add(struct wheel_t *wheel, struct wheel_timer *timer, unsigned long expires)
+{
+	wheel_del(timer);
+	timer->expires = expires;
+	wheel_link(wheel, timer);
+}
+
+void wheel_del(struct wheel_timer *timer)
+{
+	if (!timer->pprev)
+		return;
+
+	*timer->pprev = timer->next;
+	if (timer->next)
+		timer->next->pprev = timer->pprev;
+	timer->next = NULL;
+	timer->pprev = NULL;
+}
+
+int wheel_pending(struct wheel_timer *timer)
+{
+	return timer->pprev != NULL;
+}
+
+// Moves every timer of a coarse slot down to the finer levels.
+// returns the slot index, 0 means the next level has to cascade too
+static int wheel_cascade(struct wheel_t *wheel, int level)
+{
+	struct wheel_timer *timer, *next;
+	int index = (wheel->now >> (WHEEL_BITS * level)) & WHEEL_MASK;
+
+	timer = wheel->slots[level][index];
+	wheel->slots[level][index] = NULL;
+	for (; timer; timer = next) {
+		next = timer->next;
+		wheel_link(wheel, timer);
+	}
+	return index;
+}
+
+// Runs every tick up to and including now, calling cb for each expired timer.
+// cb may re-arm or cancel any timer
+void wheel_advance(struct wheel_t *wheel, unsigned long now, wheel_cb cb, void *data)
+{
+	struct wheel_timer *timer;
+	int index, level;
+
+	while ((long)(now - wheel->now) >= 0) {
+		index = wheel->now & WHEEL_MASK;
+		for (level = 1; !index && level < WHEEL_LEVELS; level++)
+			index = wheel_cascade(wheel, level);
+
+		index = wheel->now & WHEEL_MASK;
+		wheel->now++;
+
+		while ((timer = wheel->slots[0][index])) {
+			wheel_del(timer);
+			cb(timer, data);
+		}
+	}
+}
@@ -0,0 +1,63 @@
+/*
+* The MIT License (MIT)
+*
+* Copyright (c) 2013, Marcelo Aquino, https://github.com/mapnull
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+* THE SOFTWARE.
+*/
+
+#ifndef WHEEL_H
+#define WHEEL_H
+
+#include <stddef.h>
+
+/*
+* Hierarchical timing wheel, one tick per second. Timers due within
+* WHEEL_SIZE ticks sit in level 0, later ones in coarser levels and are
+* cascaded down as the wheel turns. Arming, re-arming and cancelling are O(1).
+*/
+
+#define WHEEL_BITS 6
+#define WHEEL_SIZE (1 << WHEEL_BITS)
+#define WHEEL_MASK (WHEEL_SIZE - 1)
+#define WHEEL_LEVELS 4						// 2^24 ticks, about 194 days
+
+#define wheel_entry(ptr, type, member) ((type *)((char *)(ptr) - offsetof(type, member)))
+
+struct wheel_timer {
+	struct wheel_timer *next;
+	struct wheel_timer **pprev;			// NULL when not armed
+	unsigned long expires;
+};
+
+struct wheel_t {
+	unsigned long now;					// Next tick to run
+	struct wheel_timer *slots[WHEEL_LEVELS][WHEEL_SIZE];
+};
+
+typedef void (*wheel_cb)(struct wheel_timer *, void *);
+
+void wheel_init(struct wheel_t *, unsigned long);
+void wheel_timer_init(struct wheel_timer *);
+void wheel_add(struct wheel_t *, struct wheel_timer *, unsigned long);
+void wheel_del(struct wheel_timer *);
+int wheel_pending(struct wheel_timer *);
+void wheel_advance(struct wheel_t *, unsigned long, wheel_cb, void *);
+
+#endif